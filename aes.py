@@ -52,6 +52,43 @@ rcon = [
         0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36, 0x6c, 0xd8, 0xab, 0x4d, 0x9a
         ]
 
+
+def finite_feild_mult(x, y):
+    """ Multiplies two numbers in gf2^8
+    Args:
+        input: 
+    return: 
+        a number in the feild space
+    """
+    temp, high = 0, 0
+    while y:
+        if y & 1:
+            temp ^= x
+        high = x & 128 # checking if the high bit is set (x^8)
+        x <<= 1 
+        y >>= 1
+        if high:
+            x ^= 27 # already shifted out the leading one so 27 is the 
+            # irreducable polynomial without the leading one
+    return temp % 256
+
+
+"""
+Multiplication tables, built once at import from finite_feild_mult.
+mul[c][x] is c times x in the feild for every constant that MixColumns
+and its inverse use, so a multiply is one lookup instead of a loop of
+up to 8 steps. xtime is multiplication by 2 (x in the AES polynomial).
+"""
+
+mul = {c: tuple(finite_feild_mult(c, x) for x in range(256))
+       for c in (1, 2, 3, 9, 11, 13, 14)}
+xtime = mul[2]
+
+# SubBytes followed by a multiply, for the fused encryption round
+sbox2 = tuple(mul[2][x] for x in sbox)
+sbox3 = tuple(mul[3][x] for x in sbox)
+
+
 def parse_args():
     """ This function handles the command line interface
     return: 
@@ -59,11 +96,9 @@ def parse_args():
     """
     parser = argparse.ArgumentParser()
     parser.add_argument('-p', '--plaintext',
-                        help='plaintext or cipher text message to be (de)encrypted, required to run program, based on spefification', 
-                        required=True)
+                        help='plaintext or cipher text message to be (de)encrypted, required to run program, based on spefification')
     parser.add_argument('-k', '--key',
-                        help='Cryptographic Key required to run AES, required to run program',
-                        required=True)              
+                        help='Cryptographic Key required to run AES, required to run program')
     parser.add_argument('-d', '--debug',
                         help='debug mode, will print out different things that will hopfully help with debugging the program',
                         action='store_true')
@@ -79,11 +114,17 @@ def parse_args():
     parser.add_argument('-f', '--filestore',
                         help='Do you want to store the result in a file? use the -f flag',
                         action='store_true') 
-
-
+    parser.add_argument('--benchmark',
+                        help='time block encryption and decryption with the old and the table based code, in blocks per second',
+                        action='store_true')
 
     args = parser.parse_args()
 
+    # -p and -k are only optional for the benchmark
+    if not args.benchmark and (args.plaintext is None or args.key is None):
+        parser.error("the following arguments are required: " +
+                     ("-p/--plaintext" if args.plaintext is None else "-k/--key"))
+
     return args       
 
 
@@ -312,11 +353,8 @@ def inv_sub_bytes(block, args):
 def mix_column(column, args):
     """ This is the hard method of the encryption step, this function will preform
         matrix multiplication over the feild of AES. 100011011. Both this function
-        and the inverse function I found easier and more understanable (making it
-        esier to debug when things started to go wrong) to implement
-        a multiplication function (finite_feild_mult) and then XOR those values rather
-        than trying to multiple with bitwise here. It is not the most efficient way
-        to do this but it works. 
+        and the inverse function look the products up in the mul tables, which
+        finite_feild_mult filled in at import, then XOR those values.
     Args:
         column: the column of bytes we want to mix
         args: the arguments from the command line
@@ -327,10 +365,11 @@ def mix_column(column, args):
     # using a temp variable since all updates are not happening simotaniously it messed up the blocks during testing
     temp = [0] * 4
 
-    temp[0] = finite_feild_mult(2, column[0]) ^ finite_feild_mult(3, column[1]) ^ finite_feild_mult(1, column[2]) ^ finite_feild_mult(1, column[3])
-    temp[1] = finite_feild_mult(1, column[0]) ^ finite_feild_mult(2, column[1]) ^ finite_feild_mult(3, column[2]) ^ finite_feild_mult(1, column[3])
-    temp[2] = finite_feild_mult(1, column[0]) ^ finite_feild_mult(1, column[1]) ^ finite_feild_mult(2, column[2]) ^ finite_feild_mult(3, column[3])
-    temp[3] = finite_feild_mult(3, column[0]) ^ finite_feild_mult(1, column[1]) ^ finite_feild_mult(1, column[2]) ^ finite_feild_mult(2, column[3])
+    m2, m3 = mul[2], mul[3]
+    temp[0] = m2[column[0]] ^ m3[column[1]] ^ column[2] ^ column[3]
+    temp[1] = column[0] ^ m2[column[1]] ^ m3[column[2]] ^ column[3]
+    temp[2] = column[0] ^ column[1] ^ m2[column[2]] ^ m3[column[3]]
+    temp[3] = m3[column[0]] ^ column[1] ^ column[2] ^ m2[column[3]]
 
     if args.debug: 
         hexkey = [format(x, 'x').zfill(2) for x in temp]
@@ -353,10 +392,11 @@ def inverse_mix_column(column, args):
         hexkey = [format(x, 'x').zfill(2) for x in column]
         print(hexkey)
 
-    temp[0] = finite_feild_mult(14, column[0]) ^ finite_feild_mult(11, column[1]) ^ finite_feild_mult(13, column[2]) ^ finite_feild_mult(9, column[3])
-    temp[1] = finite_feild_mult(9, column[0]) ^ finite_feild_mult(14, column[1]) ^ finite_feild_mult(11, column[2]) ^ finite_feild_mult(13, column[3])
-    temp[2] = finite_feild_mult(13, column[0]) ^ finite_feild_mult(9, column[1]) ^ finite_feild_mult(14, column[2]) ^ finite_feild_mult(11, column[3])
-    temp[3] = finite_feild_mult(11, column[0]) ^ finite_feild_mult(13, column[1]) ^ finite_feild_mult(9, column[2]) ^ finite_feild_mult(14, column[3])
+    m9, m11, m13, m14 = mul[9], mul[11], mul[13], mul[14]
+    temp[0] = m14[column[0]] ^ m11[column[1]] ^ m13[column[2]] ^ m9[column[3]]
+    temp[1] = m9[column[0]] ^ m14[column[1]] ^ m11[column[2]] ^ m13[column[3]]
+    temp[2] = m13[column[0]] ^ m9[column[1]] ^ m14[column[2]] ^ m11[column[3]]
+    temp[3] = m11[column[0]] ^ m13[column[1]] ^ m9[column[2]] ^ m14[column[3]]
 
     if args.debug: 
         hexkey = [format(x, 'x').zfill(2) for x in temp]
@@ -553,24 +593,177 @@ def decrypt(chipherblock, expanded_key, round_num, block_arr, args):
 
 
 
-def finite_feild_mult(x, y):
-    """ Multiplies two numbers in gf2^8
+
+def encrypt_block(state, round_keys, rounds):
+    """ The same cipher as encrypt(), on a flat state of 16 bytes in the order
+        of the hex input (column by column), which is also the order of the
+        expanded key. Each round is one pass: for each column, pick the four
+        bytes ShiftRows moves there, and look up SubBytes and the MixColumns
+        multiply together in sbox2 and sbox3.
     Args:
-        input: 
-    return: 
-        a number in the feild space
+        state: 16 bytes of plaintext
+        round_keys: the expanded key, as bytes
+        rounds: 10, 12 or 14
+    return:
+        the 16 bytes of ciphertext, as a list
     """
-    temp, high = 0, 0
-    while y:
-        if y & 1:
-            temp ^= x
-        high = x & 128 # checking if the high bit is set (x^8)
-        x <<= 1 
-        y >>= 1
-        if high:
-            x ^= 27 # already shifted out the leading one so 27 is the 
-            # irreducable polynomial without the leading one
-    return temp % 256
+    s = [state[i] ^ round_keys[i] for i in range(16)]
+    for r in range(1, rounds):
+        k = round_keys[16 * r:16 * r + 16]
+        t = [0] * 16
+        for c in range(0, 16, 4):
+            a0, a1, a2, a3 = s[c], s[(c + 5) % 16], s[(c + 10) % 16], s[(c + 15) % 16]
+            t[c] = sbox2[a0] ^ sbox3[a1] ^ sbox[a2] ^ sbox[a3] ^ k[c]
+            t[c + 1] = sbox[a0] ^ sbox2[a1] ^ sbox3[a2] ^ sbox[a3] ^ k[c + 1]
+            t[c + 2] = sbox[a0] ^ sbox[a1] ^ sbox2[a2] ^ sbox3[a3] ^ k[c + 2]
+            t[c + 3] = sbox3[a0] ^ sbox[a1] ^ sbox[a2] ^ sbox2[a3] ^ k[c + 3]
+        s = t
+
+    # last round without mix columns
+    k = round_keys[16 * rounds:16 * rounds + 16]
+    return [sbox[s[(i + 4 * (i % 4)) % 16]] ^ k[i] for i in range(16)]
+
+
+def decrypt_block(state, round_keys, rounds):
+    """ The same cipher as decrypt(), on a flat state like encrypt_block().
+        Each round undoes ShiftRows and SubBytes and adds the round key
+        while gathering a column, then undoes MixColumns on it with the
+        mul tables.
+    Args:
+        state: 16 bytes of ciphertext
+        round_keys: the expanded key, as bytes
+        rounds: 10, 12 or 14
+    return:
+        the 16 bytes of plaintext, as a list
+    """
+    m9, m11, m13, m14 = mul[9], mul[11], mul[13], mul[14]
+    k = round_keys[16 * rounds:16 * rounds + 16]
+    s = [state[i] ^ k[i] for i in range(16)]
+    for r in range(rounds - 1, 0, -1):
+        k = round_keys[16 * r:16 * r + 16]
+        t = [0] * 16
+        for c in range(0, 16, 4):
+            b0 = sbox_inverse[s[c]] ^ k[c]
+            b1 = sbox_inverse[s[(c + 13) % 16]] ^ k[c + 1]
+            b2 = sbox_inverse[s[(c + 10) % 16]] ^ k[c + 2]
+            b3 = sbox_inverse[s[(c + 7) % 16]] ^ k[c + 3]
+            t[c] = m14[b0] ^ m11[b1] ^ m13[b2] ^ m9[b3]
+            t[c + 1] = m9[b0] ^ m14[b1] ^ m11[b2] ^ m13[b3]
+            t[c + 2] = m13[b0] ^ m9[b1] ^ m14[b2] ^ m11[b3]
+            t[c + 3] = m11[b0] ^ m13[b1] ^ m9[b2] ^ m14[b3]
+        s = t
+
+    return [sbox_inverse[s[(i - 4 * (i % 4)) % 16]] ^ round_keys[i] for i in range(16)]
+
+
+def run_blocks(text, expanded_key, args):
+    """ Encrypts or decrypts the hex text with encrypt_block() or
+        decrypt_block(), printing the same lines as the nested list code
+    Args:
+        text: the hex text, a multiple of 32 characters
+        expanded_key: the expanded key from key_expansion()
+        args: the arguments from the command line
+    return:
+        the hex string of the result
+    """
+    data = bytes.fromhex(text)
+    round_keys = bytes(expanded_key)
+    # key_expansion() works in whole key lengths, so 256 bit keys get an
+    # extra 16 bytes; the key size gives the rounds as in encrypt()
+    rounds = {16: 10, 24: 12}.get(len(args.key) // 2, 14)
+    chain = bytes(16) # cbc starts from an all zero block
+    out = bytearray()
+    for i in range(0, len(data), 16):
+        block = data[i:i + 16]
+        if i != 0 and args.cbc_encryption:
+            print("cbc needed")
+        if args.encryption:
+            if args.cbc_encryption:
+                block = [block[j] ^ chain[j] for j in range(16)]
+            result = encrypt_block(block, round_keys, rounds)
+            chain = result
+        else:
+            result = decrypt_block(block, round_keys, rounds)
+            if args.cbc_encryption:
+                result = [result[j] ^ chain[j] for j in range(16)]
+            chain = block
+        out.extend(result)
+
+    outputstr = out.hex()
+    print(outputstr)
+    return outputstr
+
+
+class BitSerialMul:
+    """ Stands in for the mul tables to time the code as it was before them:
+        every lookup runs finite_feild_mult
+    """
+    def __getitem__(self, c):
+        return BitSerialRow(c)
+
+
+class BitSerialRow:
+    def __init__(self, c):
+        self.c = c
+
+    def __getitem__(self, x):
+        return finite_feild_mult(self.c, x)
+
+
+def benchmark(seconds=1.0):
+    """ Times each way of running the cipher on AES-128 for about the given
+        number of seconds, and prints blocks per second for each:
+        the nested lists with finite_feild_mult (before the tables), the
+        nested lists with the mul tables, and the fused flat state
+    Args:
+        seconds: how long to run each measurement
+    """
+    global mul
+    key = "000102030405060708090a0b0c0d0e0f"
+    args = argparse.Namespace(key=key, debug=False, cbc_encryption=False)
+    expanded_key = key_expansion(key, args)
+    round_keys = bytes(expanded_key)
+    plain = "00112233445566778899aabbccddeeff"
+    cipher = bytes.fromhex("69c4e0d86a7b0430d8cdb78070b4c55a")
+
+    def nested_encrypt():
+        encrypt(to_matrix(plain, args)[0], expanded_key, 0, [], args)
+
+    def nested_decrypt():
+        decrypt(to_matrix(cipher.hex(), args)[0], expanded_key, 0, [], args)
+
+    def rate(run):
+        n, start = 0, time.perf_counter()
+        while True:
+            for _ in range(16):
+                run()
+            n += 16
+            elapsed = time.perf_counter() - start
+            if elapsed >= seconds:
+                return n / elapsed
+
+    # both fast paths must agree with FIPS-197 C.1 before being timed
+    assert bytes(encrypt_block(bytes.fromhex(plain), round_keys, 10)) == cipher
+    assert bytes(decrypt_block(cipher, round_keys, 10)).hex() == plain
+
+    tables = mul
+    mul = BitSerialMul()
+    try:
+        before = (rate(nested_encrypt), rate(nested_decrypt))
+    finally:
+        mul = tables
+    results = [
+        ("nested lists, bit-serial multiply", before),
+        ("nested lists, multiply tables", (rate(nested_encrypt), rate(nested_decrypt))),
+        ("fused flat state", (rate(lambda: encrypt_block(bytes.fromhex(plain), round_keys, 10)),
+                              rate(lambda: decrypt_block(cipher, round_keys, 10)))),
+    ]
+    print("%-34s %12s %12s" % ("AES-128, blocks/s", "encrypt", "decrypt"))
+    for name, (enc, dec) in results:
+        print("%-34s %12.0f %12.0f" % (name, enc, dec))
+    print("%-34s %11.1fx %11.1fx" % ("speedup, fused over before",
+                                     results[2][1][0] / before[0],
+                                     results[2][1][1] / before[1]))
 
 
 def concat_blocks(blocks, args): 
@@ -602,6 +795,10 @@ def concat_blocks(blocks, args):
 if __name__ == "__main__":
 
     args = parse_args()
+    if args.benchmark:
+        benchmark()
+        sys.exit(0)
+
     print("Starting Ecryption on: ", args.plaintext, " with key:", args.key)
     
     if args.debug: 
@@ -611,7 +808,19 @@ if __name__ == "__main__":
         print("Using CBC mode")
 
 
-    if(args.encryption): 
+    # The nested list code prints every step for -d, and handles input
+    # that is not whole blocks as it always has; the rest takes the fast path
+    if (args.encryption or args.decryption) and not args.debug \
+            and len(args.plaintext) >= 32 and len(args.plaintext) % 32 == 0:
+        final = run_blocks(args.plaintext, key_expansion(args.key, args), args)
+
+        if (args.filestore):
+            filename = ("encrypt" if args.encryption else "decrypt") + str(int(time.time())) + ".txt"
+            f= open(filename,"w+")
+            f.write(final)
+            f.close() 
+
+    elif(args.encryption): 
         states = to_matrix(args.plaintext, args)
         expanded_key = key_expansion(args.key, args)
         hexkey = [format(x, 'x') for x in expanded_key]
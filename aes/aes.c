@@ -0,0 +1,338 @@
+/**
+ * AES (FIPS-197) block cipher with a choice of kernels.
+ *
+ * This file holds everything that does not depend on how a block
+ * is encrypted: the key schedule, the choice of kernel and the
+ * CBC and CTR modes. The kernels only encrypt or decrypt runs of
+ * independent blocks; see aes_table.c, aes_ni.c and aes_bitslice.c.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aes.h"
+#include "aes_table.h"
+#include "aes_ni.h"
+#include "aes_bitslice.h"
+
+/* Encrypts or decrypts n independent blocks */
+typedef void (*aes_kernel_t)(const struct aes_key *key, const uint8_t *in,
+                             uint8_t *out, size_t n);
+
+static struct engine {
+    const char *name;
+    aes_kernel_t encrypt, decrypt;
+} engine;
+
+static bool initialized;
+
+/* Build the lookup tables and pick the fastest engine */
+void
+aes_init(void)
+{
+    aes_table_init();
+    initialized = true;
+    aes_set_engine(AES_ENGINE_AUTO);
+}
+
+/* Use the given engine from now on, if this CPU can run it */
+bool
+aes_set_engine(enum aes_engine which)
+{
+    assert(initialized || !!!"aes_init was not called");
+
+    if (which == AES_ENGINE_AUTO)
+        which = aes_ni_available() ? AES_ENGINE_AESNI : AES_ENGINE_TABLE;
+
+    switch (which) {
+    case AES_ENGINE_TABLE:
+        engine = (struct engine) { "table", aes_table_encrypt, aes_table_decrypt };
+        return true;
+    case AES_ENGINE_AESNI:
+        if (!aes_ni_available())
+            return false;
+        engine = (struct engine) { "aesni", aes_ni_encrypt, aes_ni_decrypt };
+        return true;
+    case AES_ENGINE_BITSLICE:
+        engine = (struct engine) { "bitslice", aes_bitslice_encrypt,
+                                   aes_bitslice_decrypt };
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Name of the engine in use */
+const char *
+aes_engine_name(void)
+{
+    return engine.name;
+}
+
+/* Multiply by x in GF(2^8), for the round constants */
+static uint8_t
+xtime(uint8_t b)
+{
+    return b << 1 ^ (b & 0x80 ? 0x1b : 0);
+}
+
+/* Expand a 16, 24 or 32 byte key, see FIPS-197 section 5.2 */
+bool
+aes_expand_key(struct aes_key *key, const uint8_t *bytes, size_t len)
+{
+    assert(initialized || !!!"aes_init was not called");
+    if (len != 16 && len != 24 && len != 32)
+        return false;
+
+    int nk = len / 4;
+    key->rounds = nk + 6;
+    int words = 4 * (key->rounds + 1);
+    uint8_t *w = key->enc;
+    memcpy(w, bytes, len);
+
+    uint8_t rcon = 1;
+    for (int i = nk; i < words; i++) {
+        uint8_t t[4];
+        memcpy(t, w + 4 * (i - 1), 4);
+        if (i % nk == 0) {
+            /* RotWord, SubWord, then the round constant */
+            uint8_t first = t[0];
+            t[0] = aes_sbox[t[1]] ^ rcon;
+            t[1] = aes_sbox[t[2]];
+            t[2] = aes_sbox[t[3]];
+            t[3] = aes_sbox[first];
+            rcon = xtime(rcon);
+        }
+        else if (nk > 6 && i % nk == 4) {
+            for (int k = 0; k < 4; k++)
+                t[k] = aes_sbox[t[k]];
+        }
+        for (int k = 0; k < 4; k++)
+            w[4 * i + k] = w[4 * (i - nk) + k] ^ t[k];
+    }
+
+    /* Equivalent inverse cipher: reversed, with InvMixColumns inside */
+    int last = key->rounds * AES_BLOCK_SIZE;
+    for (int i = 0; i <= last; i += AES_BLOCK_SIZE)
+        memcpy(key->dec + i, key->enc + last - i, AES_BLOCK_SIZE);
+    for (int i = AES_BLOCK_SIZE; i < last; i += 4)
+        aes_table_inv_mix_column(key->dec + i);
+    return true;
+}
+
+#define CACHE_BUCKETS 256       /* Hash chains; a few keys is typical */
+
+struct cached_key {
+    struct aes_key key;
+    uint8_t bytes[32];
+    size_t len;
+    struct cached_key *next;    /* In the same bucket */
+};
+
+struct aes_key_cache {
+    struct cached_key *buckets[CACHE_BUCKETS];
+    size_t count;
+};
+
+/* An empty cache */
+struct aes_key_cache *
+aes_key_cache_create(void)
+{
+    struct aes_key_cache *cache = calloc(1, sizeof *cache);
+    if (cache == NULL) {
+        perror("aes_key_cache_create");
+        exit(EXIT_FAILURE);
+    }
+    return cache;
+}
+
+/* Free the cache and every key in it */
+void
+aes_key_cache_destroy(struct aes_key_cache *cache)
+{
+    for (int i = 0; i < CACHE_BUCKETS; i++) {
+        for (struct cached_key *c = cache->buckets[i], *next; c; c = next) {
+            next = c->next;
+            free(c);
+        }
+    }
+    free(cache);
+}
+
+/* The key's expansion, from the cache or made now */
+const struct aes_key *
+aes_key_cache_get(struct aes_key_cache *cache, const uint8_t *bytes, size_t len)
+{
+    if (len != 16 && len != 24 && len != 32)
+        return NULL;
+
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    struct cached_key **bucket = &cache->buckets[hash % CACHE_BUCKETS];
+
+    for (struct cached_key *c = *bucket; c; c = c->next)
+        if (c->len == len && memcmp(c->bytes, bytes, len) == 0)
+            return &c->key;
+
+    /* The round keys are loaded with aligned instructions */
+    struct cached_key *c = aligned_alloc(_Alignof(struct cached_key),
+                                         sizeof *c);
+    if (c == NULL) {
+        perror("aes_key_cache_get");
+        exit(EXIT_FAILURE);
+    }
+    aes_expand_key(&c->key, bytes, len);
+    memcpy(c->bytes, bytes, len);
+    c->len = len;
+    c->next = *bucket;
+    *bucket = c;
+    cache->count++;
+    return &c->key;
+}
+
+/* Number of distinct keys expanded so far */
+size_t
+aes_key_cache_size(const struct aes_key_cache *cache)
+{
+    return cache->count;
+}
+
+/* Encrypt n independent blocks */
+void
+aes_encrypt_blocks(const struct aes_key *key, const uint8_t *in,
+                   uint8_t *out, size_t n)
+{
+    engine.encrypt(key, in, out, n);
+}
+
+/* Decrypt n independent blocks */
+void
+aes_decrypt_blocks(const struct aes_key *key, const uint8_t *in,
+                   uint8_t *out, size_t n)
+{
+    engine.decrypt(key, in, out, n);
+}
+
+static void
+xor_block(uint8_t *dst, const uint8_t *a, const uint8_t *b)
+{
+    for (int i = 0; i < AES_BLOCK_SIZE; i++)
+        dst[i] = a[i] ^ b[i];
+}
+
+/* Encrypt n blocks in CBC mode; each depends on the one before */
+void
+aes_cbc_encrypt(const struct aes_key *key, uint8_t iv[AES_BLOCK_SIZE],
+                const uint8_t *in, uint8_t *out, size_t n)
+{
+    for (; n > 0; n--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+        xor_block(iv, iv, in);
+        engine.encrypt(key, iv, iv, 1);
+        memcpy(out, iv, AES_BLOCK_SIZE);
+    }
+}
+
+/* Blocks per kernel call in CBC and CTR: a full bitsliced batch */
+#define BATCH 128
+
+/**
+ * Decrypt n blocks in CBC mode. Unlike encryption, all blocks can
+ * be decrypted independently and chained afterwards, so they are
+ * handed to the kernel in batches.
+ */
+void
+aes_cbc_decrypt(const struct aes_key *key, uint8_t iv[AES_BLOCK_SIZE],
+                const uint8_t *in, uint8_t *out, size_t n)
+{
+    /* A copy of the ciphertext, since out may overwrite in */
+    uint8_t saved[BATCH * AES_BLOCK_SIZE];
+    while (n > 0) {
+        size_t batch = n < BATCH ? n : BATCH;
+        size_t bytes = batch * AES_BLOCK_SIZE;
+        memcpy(saved, in, bytes);
+        engine.decrypt(key, saved, out, batch);
+
+        xor_block(out, out, iv);
+        for (size_t i = 1; i < batch; i++)
+            xor_block(out + i * AES_BLOCK_SIZE, out + i * AES_BLOCK_SIZE,
+                      saved + (i - 1) * AES_BLOCK_SIZE);
+        memcpy(iv, saved + bytes - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+
+        in += bytes;
+        out += bytes;
+        n -= batch;
+    }
+}
+
+/**
+ * Encrypt several CBC messages side by side, up to BATCH of them
+ * per kernel call.
+ */
+void
+aes_cbc_encrypt_streams(const struct aes_key *key, size_t streams,
+                        uint8_t (*ivs)[AES_BLOCK_SIZE],
+                        const uint8_t *const *in, uint8_t *const *out,
+                        size_t n)
+{
+    uint8_t blocks[BATCH * AES_BLOCK_SIZE];
+    for (size_t first = 0; first < streams; first += BATCH) {
+        size_t group = streams - first < BATCH ? streams - first : BATCH;
+        for (size_t i = 0; i < n; i++) {
+            size_t offset = i * AES_BLOCK_SIZE;
+            for (size_t s = 0; s < group; s++)
+                for (int j = 0; j < AES_BLOCK_SIZE; j++)
+                    blocks[s * AES_BLOCK_SIZE + j] =
+                        in[first + s][offset + j] ^ ivs[first + s][j];
+            engine.encrypt(key, blocks, blocks, group);
+            for (size_t s = 0; s < group; s++) {
+                memcpy(out[first + s] + offset, blocks + s * AES_BLOCK_SIZE,
+                       AES_BLOCK_SIZE);
+                memcpy(ivs[first + s], blocks + s * AES_BLOCK_SIZE,
+                       AES_BLOCK_SIZE);
+            }
+        }
+    }
+}
+
+/* Add to a counter block, as a 128-bit big-endian number */
+void
+aes_ctr_advance(uint8_t counter[AES_BLOCK_SIZE], uint64_t blocks)
+{
+    for (int i = AES_BLOCK_SIZE - 1; i >= 0 && blocks; i--) {
+        blocks += counter[i];
+        counter[i] = blocks;
+        blocks >>= 8;
+    }
+}
+
+/**
+ * Encrypt or decrypt len bytes in CTR mode. Counter blocks are
+ * laid out and encrypted in batches, so the kernel sees runs of
+ * independent blocks as in ECB.
+ */
+void
+aes_ctr_crypt(const struct aes_key *key, uint8_t counter[AES_BLOCK_SIZE],
+              const uint8_t *in, uint8_t *out, size_t len)
+{
+    uint8_t stream[BATCH * AES_BLOCK_SIZE];
+    while (len > 0) {
+        size_t batch = (len + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+        if (batch > BATCH)
+            batch = BATCH;
+        for (size_t i = 0; i < batch; i++) {
+            memcpy(stream + i * AES_BLOCK_SIZE, counter, AES_BLOCK_SIZE);
+            aes_ctr_advance(counter, 1);
+        }
+        engine.encrypt(key, stream, stream, batch);
+
+        size_t bytes = batch * AES_BLOCK_SIZE < len ? batch * AES_BLOCK_SIZE : len;
+        for (size_t i = 0; i < bytes; i++)
+            out[i] = in[i] ^ stream[i];
+        in += bytes;
+        out += bytes;
+        len -= bytes;
+    }
+}
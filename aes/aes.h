@@ -0,0 +1,116 @@
+#ifndef __AES_H
+#define __AES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AES_BLOCK_SIZE 16
+#define AES_MAX_ROUNDS 14
+
+/**
+ * An expanded key, as laid out by FIPS-197 section 5.2: round key
+ * i occupies bytes 16*i to 16*i + 15. The decryption schedule is
+ * the one of the equivalent inverse cipher (section 5.3.5), which
+ * is what both the table kernel and AESDEC consume.
+ */
+struct aes_key {
+    uint8_t enc[(AES_MAX_ROUNDS + 1) * AES_BLOCK_SIZE]
+        __attribute__((aligned(16)));
+    uint8_t dec[(AES_MAX_ROUNDS + 1) * AES_BLOCK_SIZE]
+        __attribute__((aligned(16)));
+    int rounds;                 /* 10, 12 or 14 */
+};
+
+/* Ways of running the cipher; see aes_set_engine */
+enum aes_engine {
+    AES_ENGINE_AUTO,            /* AES-NI if the CPU has it, else tables */
+    AES_ENGINE_TABLE,           /* Portable 32-bit T-tables */
+    AES_ENGINE_AESNI,           /* x86 AES instructions */
+    AES_ENGINE_BITSLICE,        /* Constant-time, many blocks at once */
+};
+
+/**
+ * Build the lookup tables and pick the fastest engine the CPU
+ * supports. Must be called once before anything below.
+ */
+void aes_init(void);
+
+/**
+ * Use the given engine from now on. Returns false, leaving the
+ * engine as it was, if this CPU or build cannot run it.
+ */
+bool aes_set_engine(enum aes_engine engine);
+
+/* Name of the engine in use, e.g. "aesni" */
+const char * aes_engine_name(void);
+
+/**
+ * Expand a 16, 24 or 32 byte key. Returns false for any other
+ * length.
+ */
+bool aes_expand_key(struct aes_key *key, const uint8_t *bytes, size_t len);
+
+/**
+ * A set of expanded keys, for programs that use many keys, often
+ * the same ones: each distinct key is expanded only once. Lookups
+ * must not run concurrently with each other, but the keys they
+ * return stay valid and unchanged until the cache is destroyed.
+ */
+struct aes_key_cache;
+
+struct aes_key_cache * aes_key_cache_create(void);
+void aes_key_cache_destroy(struct aes_key_cache *cache);
+
+/**
+ * The expansion of a 16, 24 or 32 byte key, made on its first
+ * lookup. Returns NULL for any other length.
+ */
+const struct aes_key * aes_key_cache_get(struct aes_key_cache *cache,
+                                         const uint8_t *bytes, size_t len);
+
+/* Number of distinct keys expanded so far */
+size_t aes_key_cache_size(const struct aes_key_cache *cache);
+
+/* Encrypt or decrypt n independent blocks (ECB). In and out may be equal. */
+void aes_encrypt_blocks(const struct aes_key *key, const uint8_t *in,
+                        uint8_t *out, size_t n);
+void aes_decrypt_blocks(const struct aes_key *key, const uint8_t *in,
+                        uint8_t *out, size_t n);
+
+/**
+ * Encrypt or decrypt n blocks in CBC mode. iv holds the previous
+ * ciphertext block on entry and is updated for the next call, so
+ * a long message may be processed in pieces. In and out may be
+ * equal.
+ */
+void aes_cbc_encrypt(const struct aes_key *key, uint8_t iv[AES_BLOCK_SIZE],
+                     const uint8_t *in, uint8_t *out, size_t n);
+void aes_cbc_decrypt(const struct aes_key *key, uint8_t iv[AES_BLOCK_SIZE],
+                     const uint8_t *in, uint8_t *out, size_t n);
+
+/**
+ * Encrypt several messages of n blocks each in CBC mode, as if by
+ * aes_cbc_encrypt on each with its own iv. Block i of every message
+ * goes through the engine in one call, so kernels that work on many
+ * blocks at once stay busy even though each chain is serial.
+ */
+void aes_cbc_encrypt_streams(const struct aes_key *key, size_t streams,
+                             uint8_t (*ivs)[AES_BLOCK_SIZE],
+                             const uint8_t *const *in, uint8_t *const *out,
+                             size_t n);
+
+/**
+ * Encrypt or decrypt len bytes in CTR mode (SP 800-38A 6.5): XOR
+ * them with the encryption of successive counter blocks. counter
+ * is advanced past the blocks used, so a long message may be
+ * processed in pieces of whole blocks; only the last piece may
+ * end in a partial block. In and out may be equal.
+ */
+void aes_ctr_crypt(const struct aes_key *key, uint8_t counter[AES_BLOCK_SIZE],
+                   const uint8_t *in, uint8_t *out, size_t len);
+
+/* Add to a counter block, as a 128-bit big-endian number */
+void aes_ctr_advance(uint8_t counter[AES_BLOCK_SIZE], uint64_t blocks);
+
+#endif /* __AES_H */
@@ -0,0 +1,123 @@
+/**
+ * Throughput of every engine this CPU can run, in MB/s, for ECB and
+ * CTR encryption and for 128 CBC messages encrypted side by side,
+ * on inputs from 1 KB to 1 GB. Prints one JSON object on stdout,
+ * like the shell's bench.py, so results can be compared across
+ * commits.
+ *
+ *   aes_bench [--quick]        # --quick stops at 64 MB
+ *
+ * Inputs over 64 MB reuse one 64 MB buffer, so the numbers are for
+ * the cipher with the data in memory, not for reading files.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aes.h"
+
+#define MAX_BUFFER (64 << 20)
+#define MIN_SECONDS 0.2         /* Repeat small inputs for this long */
+#define STREAMS 128
+
+static struct aes_key key;
+static uint8_t *buffer;
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+ecb(size_t len)
+{
+    aes_encrypt_blocks(&key, buffer, buffer, len / AES_BLOCK_SIZE);
+}
+
+static void
+ctr(size_t len)
+{
+    uint8_t counter[AES_BLOCK_SIZE] = { 0 };
+    aes_ctr_crypt(&key, counter, buffer, buffer, len);
+}
+
+/* The buffer, cut into STREAMS messages, or one per block if fewer */
+static void
+cbc_streams(size_t len)
+{
+    static uint8_t ivs[STREAMS][AES_BLOCK_SIZE];
+    const uint8_t *in[STREAMS];
+    uint8_t *out[STREAMS];
+    size_t blocks = len / AES_BLOCK_SIZE;
+    size_t streams = blocks < STREAMS ? blocks : STREAMS;
+    size_t each = blocks / streams;
+    for (size_t s = 0; s < streams; s++)
+        in[s] = out[s] = buffer + s * each * AES_BLOCK_SIZE;
+    aes_cbc_encrypt_streams(&key, streams, ivs, in, out, each);
+}
+
+/* MB/s of fn over size bytes, in pieces of at most MAX_BUFFER */
+static double
+measure(void (*fn)(size_t), size_t size)
+{
+    size_t done = 0;
+    double start = now(), elapsed;
+    do {
+        for (size_t left = size; left > 0; ) {
+            size_t len = left < MAX_BUFFER ? left : MAX_BUFFER;
+            fn(len);
+            left -= len;
+        }
+        done += size;
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+    return done / elapsed / 1e6;
+}
+
+int
+main(int ac, char *av[])
+{
+    bool quick = ac > 1 && strcmp(av[1], "--quick") == 0;
+    static const struct { const char *name; size_t size; } sizes[] = {
+        { "1KB", 1 << 10 }, { "64KB", 64 << 10 }, { "1MB", 1 << 20 },
+        { "64MB", 64 << 20 }, { "1GB", 1 << 30 },
+    };
+    static const struct { const char *name; void (*fn)(size_t); } modes[] = {
+        { "ecb", ecb }, { "ctr", ctr }, { "cbc-streams", cbc_streams },
+    };
+    static const enum aes_engine engines[] = {
+        AES_ENGINE_TABLE, AES_ENGINE_AESNI, AES_ENGINE_BITSLICE
+    };
+
+    aes_init();
+    uint8_t bytes[16] = { 0 };
+    aes_expand_key(&key, bytes, sizeof bytes);
+    if ((buffer = calloc(1, MAX_BUFFER)) == NULL) {
+        perror("aes_bench");
+        return EXIT_FAILURE;
+    }
+
+    printf("{");
+    const char *sep = "";
+    for (size_t e = 0; e < sizeof engines / sizeof engines[0]; e++) {
+        if (!aes_set_engine(engines[e]))
+            continue;
+        for (size_t m = 0; m < sizeof modes / sizeof modes[0]; m++) {
+            for (size_t s = 0; s < sizeof sizes / sizeof sizes[0]; s++) {
+                if (quick && sizes[s].size > MAX_BUFFER)
+                    continue;
+                printf("%s\n  \"%s_%s_%s_mbps\": %.1f", sep, aes_engine_name(),
+                       modes[m].name, sizes[s].name,
+                       measure(modes[m].fn, sizes[s].size));
+                fflush(stdout);
+                sep = ",";
+            }
+        }
+    }
+    printf("\n}\n");
+    free(buffer);
+    return EXIT_SUCCESS;
+}
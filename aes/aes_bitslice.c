@@ -0,0 +1,330 @@
+/**
+ * Constant-time bitsliced AES kernel.
+ *
+ * A batch of LANES blocks is transposed so that word 8*i + j holds
+ * bit j of byte i of every block, one block per bit. A round then
+ * runs the same logic operations on every block at once:
+ *
+ * - SubBytes is the 128-gate, depth 16 circuit of Boyar and Peralta,
+ *   applied to the eight words of each byte. The inverse S-box wraps
+ *   it in the inverse affine map, see inv_sub_bytes.
+ * - ShiftRows only renames bytes, and MixColumns and AddRoundKey
+ *   are XORs of whole words.
+ *
+ * A word is a GCC vector of two 64-bit integers, which becomes an
+ * SSE2 register on x86-64 and a pair of registers elsewhere.
+ */
+#include <string.h>
+
+#include "aes_bitslice.h"
+
+typedef uint64_t word __attribute__((vector_size(16)));
+
+#define LANES 128               /* Blocks per batch, one per bit of a word */
+
+static inline word
+broadcast(uint64_t x)
+{
+    return (word) { x, x };
+}
+
+/* Transpose a 128 x 128 bit matrix in place; bit c of a row is bit
+ * c % 64 of element c / 64 */
+static void
+transpose(word a[LANES])
+{
+    for (int k = 0; k < 64; k++) {
+        uint64_t t = a[k][1];
+        a[k][1] = a[k + 64][0];
+        a[k + 64][0] = t;
+    }
+
+    /* Swap the top right and bottom left of ever smaller squares */
+    uint64_t m = 0x00000000ffffffff;
+    for (int j = 32; j != 0; j >>= 1, m ^= m << j) {
+        for (int k = 0; k < LANES; k = (k + j + 1) & ~j) {
+            word t = ((a[k] >> j) ^ a[k + j]) & broadcast(m);
+            a[k + j] ^= t;
+            a[k] ^= t << j;
+        }
+    }
+}
+
+static uint64_t
+load64(const uint8_t *p)
+{
+    uint64_t x = 0;
+    for (int i = 7; i >= 0; i--)
+        x = x << 8 | p[i];
+    return x;
+}
+
+static void
+store64(uint8_t *p, uint64_t x)
+{
+    for (int i = 0; i < 8; i++, x >>= 8)
+        p[i] = x;
+}
+
+/* The S-box on the eight bits of a byte, x[0] being the lowest */
+static inline void
+sbox(word x[8])
+{
+    word U0 = x[7], U1 = x[6], U2 = x[5], U3 = x[4],
+         U4 = x[3], U5 = x[2], U6 = x[1], U7 = x[0];
+
+    /* Top linear layer */
+    word T1 = U0 ^ U3, T2 = U0 ^ U5, T3 = U0 ^ U6, T4 = U3 ^ U5;
+    word T5 = U4 ^ U6, T6 = T1 ^ T5, T7 = U1 ^ U2, T8 = U7 ^ T6;
+    word T9 = U7 ^ T7, T10 = T6 ^ T7, T11 = U1 ^ U5, T12 = U2 ^ U5;
+    word T13 = T3 ^ T4, T14 = T6 ^ T11, T15 = T5 ^ T11, T16 = T5 ^ T12;
+    word T17 = T9 ^ T16, T18 = U3 ^ U7, T19 = T7 ^ T18, T20 = T1 ^ T19;
+    word T21 = U6 ^ U7, T22 = T7 ^ T21, T23 = T2 ^ T22, T24 = T2 ^ T10;
+    word T25 = T20 ^ T17, T26 = T3 ^ T16, T27 = T1 ^ T12;
+
+    /* Inversion in GF(2^8), as a nonlinear middle layer */
+    word M1 = T13 & T6, M2 = T23 & T8, M3 = T14 ^ M1, M4 = T19 & U7;
+    word M5 = M4 ^ M1, M6 = T3 & T16, M7 = T22 & T9, M8 = T26 ^ M6;
+    word M9 = T20 & T17, M10 = M9 ^ M6, M11 = T1 & T15, M12 = T4 & T27;
+    word M13 = M12 ^ M11, M14 = T2 & T10, M15 = M14 ^ M11, M16 = M3 ^ M2;
+    word M17 = M5 ^ T24, M18 = M8 ^ M7, M19 = M10 ^ M15, M20 = M16 ^ M13;
+    word M21 = M17 ^ M15, M22 = M18 ^ M13, M23 = M19 ^ T25;
+    word M24 = M22 ^ M23, M25 = M22 & M20, M26 = M21 ^ M25;
+    word M27 = M20 ^ M21, M28 = M23 ^ M25, M29 = M28 & M27;
+    word M30 = M26 & M24, M31 = M20 & M23, M32 = M27 & M31;
+    word M33 = M27 ^ M25, M34 = M21 & M22, M35 = M24 & M34;
+    word M36 = M24 ^ M25, M37 = M21 ^ M29, M38 = M32 ^ M33;
+    word M39 = M23 ^ M30, M40 = M35 ^ M36, M41 = M38 ^ M40;
+    word M42 = M37 ^ M39, M43 = M37 ^ M38, M44 = M39 ^ M40;
+    word M45 = M42 ^ M41, M46 = M44 & T6, M47 = M40 & T8, M48 = M39 & U7;
+    word M49 = M43 & T16, M50 = M38 & T9, M51 = M37 & T17, M52 = M42 & T15;
+    word M53 = M45 & T27, M54 = M41 & T10, M55 = M44 & T13, M56 = M40 & T23;
+    word M57 = M39 & T19, M58 = M43 & T3, M59 = M38 & T22, M60 = M37 & T20;
+    word M61 = M42 & T1, M62 = M45 & T4, M63 = M41 & T2;
+
+    /* Bottom linear layer, including the affine map's constant */
+    word L0 = M61 ^ M62, L1 = M50 ^ M56, L2 = M46 ^ M48, L3 = M47 ^ M55;
+    word L4 = M54 ^ M58, L5 = M49 ^ M61, L6 = M62 ^ L5, L7 = M46 ^ L3;
+    word L8 = M51 ^ M59, L9 = M52 ^ M53, L10 = M53 ^ L4, L11 = M60 ^ L2;
+    word L12 = M48 ^ M51, L13 = M50 ^ L0, L14 = M52 ^ M61, L15 = M55 ^ L1;
+    word L16 = M56 ^ L0, L17 = M57 ^ L1, L18 = M58 ^ L8, L19 = M63 ^ L4;
+    word L20 = L0 ^ L1, L21 = L1 ^ L7, L22 = L3 ^ L12, L23 = L18 ^ L2;
+    word L24 = L15 ^ L9, L25 = L6 ^ L10, L26 = L7 ^ L9, L27 = L8 ^ L10;
+    word L28 = L11 ^ L14, L29 = L11 ^ L17;
+
+    x[7] = L6 ^ L24;
+    x[6] = ~(L16 ^ L26);
+    x[5] = ~(L19 ^ L28);
+    x[4] = L6 ^ L21;
+    x[3] = L20 ^ L22;
+    x[2] = L25 ^ L29;
+    x[1] = ~(L13 ^ L27);
+    x[0] = ~(L6 ^ L23);
+}
+
+/**
+ * The inverse of the S-box's affine map, on its output: y = A^-1(x
+ * ^ 0x63). Since the S-box is A(inv(x)) ^ 0x63, the inverse S-box
+ * is this map, then the S-box, then this map again.
+ */
+static inline void
+inv_affine(word x[8])
+{
+    word y[8];
+    for (int i = 0; i < 8; i++)
+        y[i] = x[(i + 2) % 8] ^ x[(i + 5) % 8] ^ x[(i + 7) % 8];
+    y[0] = ~y[0];               /* A^-1(0x63) is 0x05 */
+    y[2] = ~y[2];
+    memcpy(x, y, sizeof y);
+}
+
+static void
+sub_bytes(word s[128])
+{
+    for (int i = 0; i < 16; i++)
+        sbox(s + 8 * i);
+}
+
+static void
+inv_sub_bytes(word s[128])
+{
+    for (int i = 0; i < 16; i++) {
+        inv_affine(s + 8 * i);
+        sbox(s + 8 * i);
+        inv_affine(s + 8 * i);
+    }
+}
+
+/**
+ * Byte i of the state is row i % 4 and column i / 4. ShiftRows moves
+ * byte shifted[i] to byte i, and its inverse unshifted[i].
+ */
+static const int shifted[16] = {
+    0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11
+};
+static const int unshifted[16] = {
+    0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3
+};
+
+static void
+shift_rows(word s[128], const int from[16])
+{
+    word t[128];
+    for (int i = 0; i < 16; i++)
+        memcpy(t + 8 * i, s + 8 * from[i], 8 * sizeof(word));
+    memcpy(s, t, sizeof t);
+}
+
+/* Multiply a byte by x, modulo x^8 + x^4 + x^3 + x + 1 */
+static inline void
+xtime(word out[8], const word x[8])
+{
+    out[0] = x[7];
+    out[1] = x[0] ^ x[7];
+    out[2] = x[1];
+    out[3] = x[2] ^ x[7];
+    out[4] = x[3] ^ x[7];
+    out[5] = x[4];
+    out[6] = x[5];
+    out[7] = x[6];
+}
+
+/**
+ * MixColumns, reading row r of column c from byte from[4 * c + r],
+ * so that ShiftRows comes for free. s and t must not overlap.
+ */
+static void
+mix_columns(word t[128], const word s[128], const int from[16])
+{
+    for (int c = 0; c < 4; c++) {
+        const word *a[4];
+        for (int r = 0; r < 4; r++)
+            a[r] = s + 8 * from[4 * c + r];
+        for (int r = 0; r < 4; r++) {
+            /* 2a0 + 3a1 + a2 + a3 = 2(a0 + a1) + a1 + a2 + a3 */
+            const word *a0 = a[r], *a1 = a[(r + 1) % 4],
+                *a2 = a[(r + 2) % 4], *a3 = a[(r + 3) % 4];
+            word d[8], *o = t + 8 * (4 * c + r);
+            for (int i = 0; i < 8; i++)
+                d[i] = a0[i] ^ a1[i];
+            xtime(o, d);
+            for (int i = 0; i < 8; i++)
+                o[i] ^= a1[i] ^ a2[i] ^ a3[i];
+        }
+    }
+}
+
+/**
+ * InvMixColumns is MixColumns after adding 4(a0 + a2) to rows 0
+ * and 2, and 4(a1 + a3) to rows 1 and 3. Leaves the result in t.
+ */
+static const int unmoved[16] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+static void
+inv_mix_columns(word t[128], word s[128])
+{
+    for (int c = 0; c < 4; c++) {
+        word *a = s + 32 * c;
+        for (int r = 0; r < 2; r++) {
+            word d[8], d2[8], d4[8];
+            for (int i = 0; i < 8; i++)
+                d[i] = a[8 * r + i] ^ a[8 * (r + 2) + i];
+            xtime(d2, d);
+            xtime(d4, d2);
+            for (int i = 0; i < 8; i++) {
+                a[8 * r + i] ^= d4[i];
+                a[8 * (r + 2) + i] ^= d4[i];
+            }
+        }
+    }
+    mix_columns(t, s, unmoved);
+}
+
+/* XOR each word with all ones or all zeros, as the key bit says */
+static void
+add_round_key(word s[128], const uint8_t *round_key)
+{
+    for (int i = 0; i < 128; i++)
+        s[i] ^= broadcast(-(uint64_t) (round_key[i / 8] >> (i % 8) & 1));
+}
+
+/* Rounds alternate between s and a scratch state */
+static void
+encrypt_batch(const struct aes_key *key, word s[128])
+{
+    word scratch[128], *from = s, *to = scratch;
+    add_round_key(s, key->enc);
+    for (int round = 1; round < key->rounds; round++) {
+        sub_bytes(from);
+        mix_columns(to, from, shifted);
+        add_round_key(to, key->enc + round * AES_BLOCK_SIZE);
+        word *t = from;
+        from = to;
+        to = t;
+    }
+    sub_bytes(from);
+    if (from != s)
+        memcpy(s, from, sizeof scratch);
+    shift_rows(s, shifted);
+    add_round_key(s, key->enc + key->rounds * AES_BLOCK_SIZE);
+}
+
+/* The inverse cipher of FIPS-197 section 5.3, on the encryption keys */
+static void
+decrypt_batch(const struct aes_key *key, word s[128])
+{
+    word scratch[128];
+    add_round_key(s, key->enc + key->rounds * AES_BLOCK_SIZE);
+    for (int round = key->rounds - 1; round > 0; round--) {
+        shift_rows(s, unshifted);
+        inv_sub_bytes(s);
+        add_round_key(s, key->enc + round * AES_BLOCK_SIZE);
+        inv_mix_columns(scratch, s);
+        memcpy(s, scratch, sizeof scratch);
+    }
+    shift_rows(s, unshifted);
+    inv_sub_bytes(s);
+    add_round_key(s, key->enc);
+}
+
+/* Run batches of up to LANES blocks through fn; unused lanes are zero */
+static void
+run(void (*fn)(const struct aes_key *, word *), const struct aes_key *key,
+    const uint8_t *in, uint8_t *out, size_t n)
+{
+    word s[LANES];
+    while (n > 0) {
+        size_t batch = n < LANES ? n : LANES;
+        for (size_t i = 0; i < LANES; i++)
+            s[i] = i < batch ? (word) { load64(in + 16 * i), load64(in + 16 * i + 8) }
+                             : broadcast(0);
+        transpose(s);
+        fn(key, s);
+        transpose(s);
+        for (size_t i = 0; i < batch; i++) {
+            store64(out + 16 * i, s[i][0]);
+            store64(out + 16 * i + 8, s[i][1]);
+        }
+        in += batch * AES_BLOCK_SIZE;
+        out += batch * AES_BLOCK_SIZE;
+        n -= batch;
+    }
+}
+
+/* Encrypt n blocks, LANES at a time */
+void
+aes_bitslice_encrypt(const struct aes_key *key, const uint8_t *in,
+                     uint8_t *out, size_t n)
+{
+    run(encrypt_batch, key, in, out, n);
+}
+
+/* Decrypt n blocks, LANES at a time */
+void
+aes_bitslice_decrypt(const struct aes_key *key, const uint8_t *in,
+                     uint8_t *out, size_t n)
+{
+    run(decrypt_batch, key, in, out, n);
+}
@@ -0,0 +1,17 @@
+#ifndef __AES_BITSLICE_H
+#define __AES_BITSLICE_H
+
+#include "aes.h"
+
+/**
+ * Encrypt or decrypt n blocks with the bitsliced kernel, which
+ * uses no table lookups or branches that depend on the data or the
+ * key, so its timing reveals neither. It works on 128 blocks at a
+ * time and is slow for short runs.
+ */
+void aes_bitslice_encrypt(const struct aes_key *key, const uint8_t *in,
+                          uint8_t *out, size_t n);
+void aes_bitslice_decrypt(const struct aes_key *key, const uint8_t *in,
+                          uint8_t *out, size_t n);
+
+#endif /* __AES_BITSLICE_H */
@@ -0,0 +1,131 @@
+/**
+ * AES kernel using the x86 AES-NI instructions.
+ *
+ * Only compiled into x86 builds, and only used once CPUID reports
+ * the instructions (see aes_ni_available). The functions are
+ * compiled for AES-NI by attribute, so the rest of the program
+ * needs no special flags and still runs on older CPUs.
+ *
+ * AESENC has a latency of several cycles but can issue every
+ * cycle, so independent blocks are processed four at a time.
+ */
+#include <stdlib.h>
+
+#include "aes_ni.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define AESNI __attribute__((target("aes,sse2")))
+
+/* Whether this build and CPU can use the AES instructions */
+bool
+aes_ni_available(void)
+{
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    return (ecx & bit_AES) && (edx & bit_SSE2);
+}
+
+/* Load the round keys of a schedule */
+AESNI static void
+load_keys(__m128i rk[], const uint8_t *schedule, int rounds)
+{
+    for (int i = 0; i <= rounds; i++)
+        rk[i] = _mm_load_si128((const __m128i *) schedule + i);
+}
+
+#define LOAD(p, i)      _mm_loadu_si128((const __m128i *) (p) + (i))
+#define STORE(p, i, v)  _mm_storeu_si128((__m128i *) (p) + (i), v)
+
+/* Encrypt n blocks with AESENC */
+AESNI void
+aes_ni_encrypt(const struct aes_key *key, const uint8_t *in,
+               uint8_t *out, size_t n)
+{
+    __m128i rk[AES_MAX_ROUNDS + 1];
+    int rounds = key->rounds;
+    load_keys(rk, key->enc, rounds);
+
+    for (; n >= 4; n -= 4, in += 4 * AES_BLOCK_SIZE, out += 4 * AES_BLOCK_SIZE) {
+        __m128i b0 = _mm_xor_si128(LOAD(in, 0), rk[0]);
+        __m128i b1 = _mm_xor_si128(LOAD(in, 1), rk[0]);
+        __m128i b2 = _mm_xor_si128(LOAD(in, 2), rk[0]);
+        __m128i b3 = _mm_xor_si128(LOAD(in, 3), rk[0]);
+        for (int i = 1; i < rounds; i++) {
+            b0 = _mm_aesenc_si128(b0, rk[i]);
+            b1 = _mm_aesenc_si128(b1, rk[i]);
+            b2 = _mm_aesenc_si128(b2, rk[i]);
+            b3 = _mm_aesenc_si128(b3, rk[i]);
+        }
+        STORE(out, 0, _mm_aesenclast_si128(b0, rk[rounds]));
+        STORE(out, 1, _mm_aesenclast_si128(b1, rk[rounds]));
+        STORE(out, 2, _mm_aesenclast_si128(b2, rk[rounds]));
+        STORE(out, 3, _mm_aesenclast_si128(b3, rk[rounds]));
+    }
+    for (; n > 0; n--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+        __m128i b = _mm_xor_si128(LOAD(in, 0), rk[0]);
+        for (int i = 1; i < rounds; i++)
+            b = _mm_aesenc_si128(b, rk[i]);
+        STORE(out, 0, _mm_aesenclast_si128(b, rk[rounds]));
+    }
+}
+
+/* Decrypt n blocks with AESDEC, using the equivalent inverse cipher */
+AESNI void
+aes_ni_decrypt(const struct aes_key *key, const uint8_t *in,
+               uint8_t *out, size_t n)
+{
+    __m128i rk[AES_MAX_ROUNDS + 1];
+    int rounds = key->rounds;
+    load_keys(rk, key->dec, rounds);
+
+    for (; n >= 4; n -= 4, in += 4 * AES_BLOCK_SIZE, out += 4 * AES_BLOCK_SIZE) {
+        __m128i b0 = _mm_xor_si128(LOAD(in, 0), rk[0]);
+        __m128i b1 = _mm_xor_si128(LOAD(in, 1), rk[0]);
+        __m128i b2 = _mm_xor_si128(LOAD(in, 2), rk[0]);
+        __m128i b3 = _mm_xor_si128(LOAD(in, 3), rk[0]);
+        for (int i = 1; i < rounds; i++) {
+            b0 = _mm_aesdec_si128(b0, rk[i]);
+            b1 = _mm_aesdec_si128(b1, rk[i]);
+            b2 = _mm_aesdec_si128(b2, rk[i]);
+            b3 = _mm_aesdec_si128(b3, rk[i]);
+        }
+        STORE(out, 0, _mm_aesdeclast_si128(b0, rk[rounds]));
+        STORE(out, 1, _mm_aesdeclast_si128(b1, rk[rounds]));
+        STORE(out, 2, _mm_aesdeclast_si128(b2, rk[rounds]));
+        STORE(out, 3, _mm_aesdeclast_si128(b3, rk[rounds]));
+    }
+    for (; n > 0; n--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+        __m128i b = _mm_xor_si128(LOAD(in, 0), rk[0]);
+        for (int i = 1; i < rounds; i++)
+            b = _mm_aesdec_si128(b, rk[i]);
+        STORE(out, 0, _mm_aesdeclast_si128(b, rk[rounds]));
+    }
+}
+
+#else /* No AES-NI outside x86 */
+
+bool
+aes_ni_available(void)
+{
+    return false;
+}
+
+void
+aes_ni_encrypt(const struct aes_key *key, const uint8_t *in,
+               uint8_t *out, size_t n)
+{
+    abort();
+}
+
+void
+aes_ni_decrypt(const struct aes_key *key, const uint8_t *in,
+               uint8_t *out, size_t n)
+{
+    abort();
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef __AES_NI_H
+#define __AES_NI_H
+
+#include "aes.h"
+
+/* Whether this build and CPU can use the AES instructions */
+bool aes_ni_available(void);
+
+/* Encrypt or decrypt n blocks with AESENC/AESDEC */
+void aes_ni_encrypt(const struct aes_key *key, const uint8_t *in,
+                    uint8_t *out, size_t n);
+void aes_ni_decrypt(const struct aes_key *key, const uint8_t *in,
+                    uint8_t *out, size_t n);
+
+#endif /* __AES_NI_H */
@@ -0,0 +1,180 @@
+/**
+ * Portable AES kernel using 32-bit T-tables.
+ *
+ * Each table entry combines SubBytes and MixColumns for one byte
+ * of the state: te[r][x] is the column that input byte x in row r
+ * contributes to after MixColumns. A round is then 16 lookups and
+ * 16 XORs with ShiftRows folded into which bytes are looked up.
+ * Columns are held as little-endian words, so row r of a column
+ * is byte r of the word and blocks load without byte swapping.
+ */
+#include <string.h>
+#include <endian.h>
+
+#include "aes_table.h"
+
+/* FIPS-197 figure 7; row x, column y holds the value for 0xxy */
+const uint8_t aes_sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+static uint8_t inv_sbox[256];
+static uint32_t te[4][256];     /* SubBytes, then MixColumns */
+static uint32_t td[4][256];     /* InvSubBytes, then InvMixColumns */
+
+/* Multiply by x (that is, 2) in GF(2^8) */
+static uint8_t
+xtime(uint8_t b)
+{
+    return b << 1 ^ (b & 0x80 ? 0x1b : 0);
+}
+
+/* Multiply two elements of GF(2^8) */
+static uint8_t
+gf_mul(uint8_t a, uint8_t b)
+{
+    uint8_t p = 0;
+    for (; b; b >>= 1, a = xtime(a))
+        if (b & 1)
+            p ^= a;
+    return p;
+}
+
+/* A column of four bytes, row 0 in the low byte */
+static uint32_t
+column(uint8_t r0, uint8_t r1, uint8_t r2, uint8_t r3)
+{
+    return r0 | r1 << 8 | r2 << 16 | (uint32_t) r3 << 24;
+}
+
+static uint32_t
+rotl(uint32_t w, int bits)
+{
+    return bits ? w << bits | w >> (32 - bits) : w;
+}
+
+/* Build the T-tables and the inverse S-box */
+void
+aes_table_init(void)
+{
+    for (int x = 0; x < 256; x++)
+        inv_sbox[aes_sbox[x]] = x;
+
+    /* A byte in row r lands in rows r, r+1, ... of its column */
+    for (int x = 0; x < 256; x++) {
+        uint8_t s = aes_sbox[x], i = inv_sbox[x];
+        uint32_t e = column(gf_mul(s, 2), s, s, gf_mul(s, 3));
+        uint32_t d = column(gf_mul(i, 14), gf_mul(i, 9),
+                            gf_mul(i, 13), gf_mul(i, 11));
+        for (int r = 0; r < 4; r++) {
+            te[r][x] = rotl(e, 8 * r);
+            td[r][x] = rotl(d, 8 * r);
+        }
+    }
+}
+
+static uint32_t
+load(const uint8_t *p)
+{
+    uint32_t w;
+    memcpy(&w, p, sizeof w);
+    return le32toh(w);
+}
+
+static void
+store(uint8_t *p, uint32_t w)
+{
+    w = htole32(w);
+    memcpy(p, &w, sizeof w);
+}
+
+/* Byte in row r of a column */
+#define ROW(w, r) ((w) >> (8 * (r)) & 0xff)
+
+/* Apply InvMixColumns to one column */
+void
+aes_table_inv_mix_column(uint8_t col[4])
+{
+    /* td undoes the S-box it applies by way of inv_sbox */
+    uint32_t w = load(col);
+    store(col, td[0][aes_sbox[ROW(w, 0)]] ^ td[1][aes_sbox[ROW(w, 1)]]
+             ^ td[2][aes_sbox[ROW(w, 2)]] ^ td[3][aes_sbox[ROW(w, 3)]]);
+}
+
+/* Round on columns a, b, c, d: row r is taken from the r-th of them */
+#define ROUND(t, a, b, c, d, k) \
+    (t[0][ROW(a, 0)] ^ t[1][ROW(b, 1)] ^ t[2][ROW(c, 2)] ^ t[3][ROW(d, 3)] ^ (k))
+#define FINAL(s, a, b, c, d, k) \
+    (column(s[ROW(a, 0)], s[ROW(b, 1)], s[ROW(c, 2)], s[ROW(d, 3)]) ^ (k))
+
+/* Encrypt n blocks with the T-table kernel */
+void
+aes_table_encrypt(const struct aes_key *key, const uint8_t *in,
+                  uint8_t *out, size_t n)
+{
+    for (; n > 0; n--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+        const uint8_t *rk = key->enc;
+        uint32_t s0 = load(in) ^ load(rk), s1 = load(in + 4) ^ load(rk + 4),
+            s2 = load(in + 8) ^ load(rk + 8), s3 = load(in + 12) ^ load(rk + 12);
+
+        /* ShiftRows moves row r of column j + r into column j */
+        for (int round = 1; round < key->rounds; round++) {
+            rk += AES_BLOCK_SIZE;
+            uint32_t t0 = ROUND(te, s0, s1, s2, s3, load(rk));
+            uint32_t t1 = ROUND(te, s1, s2, s3, s0, load(rk + 4));
+            uint32_t t2 = ROUND(te, s2, s3, s0, s1, load(rk + 8));
+            uint32_t t3 = ROUND(te, s3, s0, s1, s2, load(rk + 12));
+            s0 = t0, s1 = t1, s2 = t2, s3 = t3;
+        }
+
+        /* The last round has no MixColumns */
+        rk += AES_BLOCK_SIZE;
+        store(out, FINAL(aes_sbox, s0, s1, s2, s3, load(rk)));
+        store(out + 4, FINAL(aes_sbox, s1, s2, s3, s0, load(rk + 4)));
+        store(out + 8, FINAL(aes_sbox, s2, s3, s0, s1, load(rk + 8)));
+        store(out + 12, FINAL(aes_sbox, s3, s0, s1, s2, load(rk + 12)));
+    }
+}
+
+/* Decrypt n blocks with the T-table kernel */
+void
+aes_table_decrypt(const struct aes_key *key, const uint8_t *in,
+                  uint8_t *out, size_t n)
+{
+    for (; n > 0; n--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+        const uint8_t *rk = key->dec;
+        uint32_t s0 = load(in) ^ load(rk), s1 = load(in + 4) ^ load(rk + 4),
+            s2 = load(in + 8) ^ load(rk + 8), s3 = load(in + 12) ^ load(rk + 12);
+
+        /* InvShiftRows moves row r of column j - r into column j */
+        for (int round = 1; round < key->rounds; round++) {
+            rk += AES_BLOCK_SIZE;
+            uint32_t t0 = ROUND(td, s0, s3, s2, s1, load(rk));
+            uint32_t t1 = ROUND(td, s1, s0, s3, s2, load(rk + 4));
+            uint32_t t2 = ROUND(td, s2, s1, s0, s3, load(rk + 8));
+            uint32_t t3 = ROUND(td, s3, s2, s1, s0, load(rk + 12));
+            s0 = t0, s1 = t1, s2 = t2, s3 = t3;
+        }
+
+        rk += AES_BLOCK_SIZE;
+        store(out, FINAL(inv_sbox, s0, s3, s2, s1, load(rk)));
+        store(out + 4, FINAL(inv_sbox, s1, s0, s3, s2, load(rk + 4)));
+        store(out + 8, FINAL(inv_sbox, s2, s1, s0, s3, load(rk + 8)));
+        store(out + 12, FINAL(inv_sbox, s3, s2, s1, s0, load(rk + 12)));
+    }
+}
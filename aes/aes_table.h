@@ -0,0 +1,24 @@
+#ifndef __AES_TABLE_H
+#define __AES_TABLE_H
+
+#include "aes.h"
+
+/* The S-box of FIPS-197 figure 7, shared with the key schedule */
+extern const uint8_t aes_sbox[256];
+
+/* Build the T-tables and the inverse S-box */
+void aes_table_init(void);
+
+/**
+ * Apply InvMixColumns to one column, given as 4 bytes, in place.
+ * Used to derive the equivalent inverse cipher's round keys.
+ */
+void aes_table_inv_mix_column(uint8_t column[4]);
+
+/* Encrypt or decrypt n blocks with the portable T-table kernel */
+void aes_table_encrypt(const struct aes_key *key, const uint8_t *in,
+                       uint8_t *out, size_t n);
+void aes_table_decrypt(const struct aes_key *key, const uint8_t *in,
+                       uint8_t *out, size_t n);
+
+#endif /* __AES_TABLE_H */
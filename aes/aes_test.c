@@ -0,0 +1,262 @@
+/**
+ * Known-answer tests for every engine this CPU can run.
+ *
+ * Vectors come from FIPS-197 (appendices A.1, B and C) and, for
+ * CBC and CTR, from NIST SP 800-38A sections F.2 and F.5. Runs of blocks are also
+ * checked against single-block calls, since the kernels take a
+ * different path for groups of blocks.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aes.h"
+
+static int failures;
+
+static void
+from_hex(const char *hex, uint8_t *out)
+{
+    for (size_t i = 0; hex[2 * i]; i++)
+        sscanf(hex + 2 * i, "%2hhx", &out[i]);
+}
+
+static void
+check(const char *what, const uint8_t *got, const char *want_hex)
+{
+    uint8_t want[64];
+    size_t len = strlen(want_hex) / 2;
+    from_hex(want_hex, want);
+    if (memcmp(got, want, len) != 0) {
+        printf("FAIL %s (%s)\n", what, aes_engine_name());
+        failures++;
+    }
+}
+
+static void
+expand(struct aes_key *key, const char *hex)
+{
+    uint8_t bytes[32];
+    from_hex(hex, bytes);
+    if (!aes_expand_key(key, bytes, strlen(hex) / 2)) {
+        printf("FAIL key expansion of %s\n", hex);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* FIPS-197 appendix C, and the example of appendix B */
+static void
+test_block_vectors(void)
+{
+    static const struct {
+        const char *key, *plain, *cipher;
+    } vectors[] = {
+        { "000102030405060708090a0b0c0d0e0f",
+          "00112233445566778899aabbccddeeff",
+          "69c4e0d86a7b0430d8cdb78070b4c55a" },
+        { "000102030405060708090a0b0c0d0e0f1011121314151617",
+          "00112233445566778899aabbccddeeff",
+          "dda97ca4864cdfe06eaf70a0ec0d7191" },
+        { "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+          "00112233445566778899aabbccddeeff",
+          "8ea2b7ca516745bfeafc49904b496089" },
+        { "2b7e151628aed2a6abf7158809cf4f3c",
+          "3243f6a8885a308d313198a2e0370734",
+          "3925841d02dc09fbdc118597196a0b32" },
+    };
+
+    for (size_t i = 0; i < sizeof vectors / sizeof vectors[0]; i++) {
+        struct aes_key key;
+        uint8_t block[AES_BLOCK_SIZE];
+        expand(&key, vectors[i].key);
+        from_hex(vectors[i].plain, block);
+        aes_encrypt_blocks(&key, block, block, 1);
+        check("FIPS-197 encryption", block, vectors[i].cipher);
+        aes_decrypt_blocks(&key, block, block, 1);
+        check("FIPS-197 decryption", block, vectors[i].plain);
+    }
+}
+
+/* FIPS-197 appendix A.1: the last round key */
+static void
+test_key_expansion(void)
+{
+    struct aes_key key;
+    expand(&key, "2b7e151628aed2a6abf7158809cf4f3c");
+    check("FIPS-197 key expansion", key.enc + 10 * AES_BLOCK_SIZE,
+          "d014f9a8c9ee2589e13f0cc8b6630ca6");
+}
+
+/* SP 800-38A F.2.1 and F.2.2, CBC-AES128 */
+static void
+test_cbc(void)
+{
+    const char *plain =
+        "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+        "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710";
+    const char *cipher =
+        "7649abac8119b246cee98e9b12e9197d5086cb9b507219ee95db113a917678b2"
+        "73bed6b8e3c1743b7116e69e222295163ff1caa1681fac09120eca307586e1a7";
+
+    struct aes_key key;
+    uint8_t iv[AES_BLOCK_SIZE], text[4 * AES_BLOCK_SIZE];
+    expand(&key, "2b7e151628aed2a6abf7158809cf4f3c");
+
+    from_hex("000102030405060708090a0b0c0d0e0f", iv);
+    from_hex(plain, text);
+    aes_cbc_encrypt(&key, iv, text, text, 4);
+    check("SP 800-38A CBC encryption", text, cipher);
+
+    /* In two pieces, to check that the IV carries over */
+    from_hex("000102030405060708090a0b0c0d0e0f", iv);
+    aes_cbc_decrypt(&key, iv, text, text, 1);
+    aes_cbc_decrypt(&key, iv, text + AES_BLOCK_SIZE, text + AES_BLOCK_SIZE, 3);
+    check("SP 800-38A CBC decryption", text, plain);
+}
+
+/* SP 800-38A F.5.1 and F.5.2, CTR-AES128 */
+static void
+test_ctr(void)
+{
+    const char *plain =
+        "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+        "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710";
+    const char *cipher =
+        "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+        "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee";
+
+    struct aes_key key;
+    uint8_t counter[AES_BLOCK_SIZE], text[4 * AES_BLOCK_SIZE];
+    expand(&key, "2b7e151628aed2a6abf7158809cf4f3c");
+
+    from_hex("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", counter);
+    from_hex(plain, text);
+    aes_ctr_crypt(&key, counter, text, text, sizeof text);
+    check("SP 800-38A CTR encryption", text, cipher);
+    check("CTR counter after four blocks", counter,
+          "f0f1f2f3f4f5f6f7f8f9fafbfcfdff03");
+
+    /* A block, then the rest ending in a partial block */
+    from_hex("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", counter);
+    aes_ctr_crypt(&key, counter, text, text, AES_BLOCK_SIZE);
+    aes_ctr_crypt(&key, counter, text + AES_BLOCK_SIZE, text + AES_BLOCK_SIZE,
+                  2 * AES_BLOCK_SIZE + 5);
+    check("SP 800-38A CTR decryption", text, "6bc1bee22e409f96e93d7e117393172a"
+          "ae2d8a571e03ac9c9eb76fac45af8e5130c81c46a35ce411e5fbc1191a0a52ef"
+          "f69f2445df");
+
+    /* Carries run through all 128 bits and wrap around */
+    from_hex("ffffffffffffffffffffffffffffff00", counter);
+    aes_ctr_advance(counter, 0x1234);
+    check("CTR counter carry", counter, "00000000000000000000000000001134");
+}
+
+/* Runs of blocks give the same result as one block at a time */
+static void
+test_runs(void)
+{
+    enum { BLOCKS = 301 };      /* Over two bitsliced batches */
+    static uint8_t plain[BLOCKS * AES_BLOCK_SIZE], run[sizeof plain],
+        single[sizeof plain];
+    uint32_t x = 1;
+    for (size_t i = 0; i < sizeof plain; i++)
+        plain[i] = (x = x * 1103515245 + 12345) >> 16;
+
+    struct aes_key key;
+    expand(&key, "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4");
+    aes_encrypt_blocks(&key, plain, run, BLOCKS);
+    for (int i = 0; i < BLOCKS; i++)
+        aes_encrypt_blocks(&key, plain + i * AES_BLOCK_SIZE,
+                           single + i * AES_BLOCK_SIZE, 1);
+    if (memcmp(run, single, sizeof run) != 0) {
+        printf("FAIL encryption of runs (%s)\n", aes_engine_name());
+        failures++;
+    }
+    aes_decrypt_blocks(&key, run, run, BLOCKS);
+    if (memcmp(run, plain, sizeof run) != 0) {
+        printf("FAIL decryption of runs (%s)\n", aes_engine_name());
+        failures++;
+    }
+}
+
+/* A cache returns one expansion per distinct key */
+static void
+test_key_cache(void)
+{
+    uint8_t a[32] = { 1 }, b[32] = { 2 };
+    struct aes_key direct;
+    aes_expand_key(&direct, a, 24);
+
+    struct aes_key_cache *cache = aes_key_cache_create();
+    const struct aes_key *k1 = aes_key_cache_get(cache, a, 24);
+    const struct aes_key *k2 = aes_key_cache_get(cache, b, 24);
+    const struct aes_key *k3 = aes_key_cache_get(cache, a, 24);
+    const struct aes_key *k4 = aes_key_cache_get(cache, a, 32);
+    if (k1 != k3 || k1 == k2 || k1 == k4 || aes_key_cache_size(cache) != 3
+        || aes_key_cache_get(cache, a, 20) != NULL
+        || k1->rounds != direct.rounds
+        || memcmp(k1->enc, direct.enc, (direct.rounds + 1) * AES_BLOCK_SIZE)
+        || memcmp(k1->dec, direct.dec, (direct.rounds + 1) * AES_BLOCK_SIZE)) {
+        printf("FAIL key cache\n");
+        failures++;
+    }
+    aes_key_cache_destroy(cache);
+}
+
+/* Side by side CBC messages match one message at a time */
+static void
+test_cbc_streams(void)
+{
+    enum { STREAMS = 130, BLOCKS = 3 };
+    static uint8_t plain[STREAMS][BLOCKS * AES_BLOCK_SIZE],
+        cipher[STREAMS][BLOCKS * AES_BLOCK_SIZE], want[BLOCKS * AES_BLOCK_SIZE];
+    uint8_t ivs[STREAMS][AES_BLOCK_SIZE];
+    const uint8_t *in[STREAMS];
+    uint8_t *out[STREAMS];
+    for (int s = 0; s < STREAMS; s++) {
+        for (int i = 0; i < BLOCKS * AES_BLOCK_SIZE; i++)
+            plain[s][i] = s * 7 + i;
+        memset(ivs[s], s, AES_BLOCK_SIZE);
+        in[s] = plain[s];
+        out[s] = cipher[s];
+    }
+
+    struct aes_key key;
+    expand(&key, "8e73b0f7da0e6452c810f32b809079e562f8ead2522c6b7b");
+    aes_cbc_encrypt_streams(&key, STREAMS, ivs, in, out, BLOCKS);
+    for (int s = 0; s < STREAMS; s++) {
+        uint8_t iv[AES_BLOCK_SIZE];
+        memset(iv, s, AES_BLOCK_SIZE);
+        aes_cbc_encrypt(&key, iv, plain[s], want, BLOCKS);
+        if (memcmp(cipher[s], want, sizeof want) != 0
+            || memcmp(ivs[s], iv, AES_BLOCK_SIZE) != 0) {
+            printf("FAIL CBC stream %d (%s)\n", s, aes_engine_name());
+            failures++;
+            break;
+        }
+    }
+}
+
+int
+main(void)
+{
+    aes_init();
+    const enum aes_engine engines[] = {
+        AES_ENGINE_TABLE, AES_ENGINE_AESNI, AES_ENGINE_BITSLICE
+    };
+    for (size_t i = 0; i < sizeof engines / sizeof engines[0]; i++) {
+        if (!aes_set_engine(engines[i])) {
+            printf("skipping an engine this CPU does not support\n");
+            continue;
+        }
+        test_key_expansion();
+        test_block_vectors();
+        test_cbc();
+        test_ctr();
+        test_runs();
+        test_cbc_streams();
+        test_key_cache();
+        printf("%s: %s\n", aes_engine_name(), failures ? "FAIL" : "PASS");
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
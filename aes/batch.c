@@ -0,0 +1,525 @@
+/**
+ * Batch mode: many files, one process.
+ *
+ * The list of files is built first, expanding each key as it is
+ * met through an aes_key_cache, so the workers only read keys.
+ * Each pool task then takes a group of files on its own thread;
+ * the pool keeps the threads busy until the list runs out. Files
+ * are streamed one by one with stream_run, except that in CBC
+ * encryption the small files of a group go through the engine
+ * side by side, with aes_cbc_encrypt_streams.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "hex.h"
+
+#define SUFFIX ".aes"
+#define REPORT_INTERVAL 1.0     /* Seconds between progress reports */
+#define LANES 128               /* Files encrypted side by side */
+#define SMALL_FILE (16 << 10)   /* Largest file read whole into a lane */
+
+struct file {
+    char *in, *out;
+    const struct aes_key *key;
+};
+
+struct batch {
+    struct file *files;
+    int nfiles, capacity;
+    const struct stream_options *opts;
+    const char *outdir;
+    int group;                  /* Files per pool task */
+
+    pthread_mutex_t lock;       /* Guards what follows */
+    int done, failed;
+    double bytes;
+    double start, last_report;
+    bool reported;              /* A progress line is on a terminal */
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+xmalloc(size_t size)
+{
+    void *p = malloc(size);
+    if (p == NULL) {
+        perror("batch");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static bool
+has_suffix(const char *name)
+{
+    size_t len = strlen(name), slen = strlen(SUFFIX);
+    return len > slen && strcmp(name + len - slen, SUFFIX) == 0;
+}
+
+/* Where the result for path goes, in a new string */
+static char *
+output_path(const struct batch *b, const char *path)
+{
+    const char *name = path;
+    if (b->outdir) {
+        const char *slash = strrchr(path, '/');
+        name = slash ? slash + 1 : path;
+    }
+    size_t dirlen = b->outdir ? strlen(b->outdir) + 1 : 0;
+    size_t len = strlen(name);
+    char *out = xmalloc(dirlen + len + sizeof SUFFIX);
+
+    if (b->outdir)
+        sprintf(out, "%s/", b->outdir);
+    if (b->opts->encrypt)
+        sprintf(out + dirlen, "%s" SUFFIX, name);
+    else if (has_suffix(name))
+        sprintf(out + dirlen, "%.*s", (int) (len - strlen(SUFFIX)), name);
+    else
+        sprintf(out + dirlen, "%s.dec", name);
+    return out;
+}
+
+static void
+add_file(struct batch *b, const char *path, const struct aes_key *key)
+{
+    if (b->nfiles == b->capacity) {
+        b->capacity = b->capacity ? 2 * b->capacity : 64;
+        b->files = realloc(b->files, b->capacity * sizeof *b->files);
+        if (b->files == NULL) {
+            perror("batch");
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct file *f = &b->files[b->nfiles++];
+    f->in = strdup(path);
+    f->out = output_path(b, path);
+    f->key = key;
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/* Add the directory's regular files, in name order */
+static int
+read_directory(struct batch *b, const char *dir, const struct aes_key *key)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        perror(dir);
+        return -1;
+    }
+
+    char **names = NULL;
+    size_t n = 0, capacity = 0;
+    for (struct dirent *e; (e = readdir(d)) != NULL; ) {
+        if (has_suffix(e->d_name) != !b->opts->encrypt)
+            continue;
+        char *path = xmalloc(strlen(dir) + strlen(e->d_name) + 2);
+        sprintf(path, "%s/%s", dir, e->d_name);
+        struct stat st;
+        if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+        if (n == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            if ((names = realloc(names, capacity * sizeof *names)) == NULL) {
+                perror("batch");
+                exit(EXIT_FAILURE);
+            }
+        }
+        names[n++] = path;
+    }
+    closedir(d);
+
+    qsort(names, n, sizeof *names, compare_names);
+    for (size_t i = 0; i < n; i++) {
+        add_file(b, names[i], key);
+        free(names[i]);
+    }
+    free(names);
+    return 0;
+}
+
+/* Add the files a manifest lists, expanding their keys */
+static int
+read_manifest(struct batch *b, const char *manifest, const struct aes_key *key,
+              struct aes_key_cache *cache)
+{
+    FILE *f = fopen(manifest, "r");
+    if (f == NULL) {
+        perror(manifest);
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t size = 0;
+    int lineno = 0, rc = 0;
+    while (rc == 0 && getline(&line, &size, f) != -1) {
+        lineno++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        const struct aes_key *k = key;
+        char *tab = strchr(line, '\t');
+        if (tab) {
+            *tab = '\0';
+            size_t len;
+            uint8_t *bytes = hex_decode(tab + 1, &len);
+            k = bytes ? aes_key_cache_get(cache, bytes, len) : NULL;
+            free(bytes);
+        }
+        if (k == NULL) {
+            fprintf(stderr, "%s:%d: %s\n", manifest, lineno,
+                    tab ? "the key must be 32, 48 or 64 hex digits"
+                        : "no key here and none given with -k");
+            rc = -1;
+        }
+        else
+            add_file(b, line, k);
+    }
+    free(line);
+    fclose(f);
+    return rc;
+}
+
+static int
+compare_outputs(const void *a, const void *b)
+{
+    const struct file *f = *(const struct file *const *) a;
+    const struct file *g = *(const struct file *const *) b;
+    return strcmp(f->out, g->out);
+}
+
+/* Check that no two files write the same output, as -o DIR may make them */
+static int
+check_outputs(const struct batch *b)
+{
+    const struct file **sorted = xmalloc((b->nfiles + 1) * sizeof *sorted);
+    for (int i = 0; i < b->nfiles; i++)
+        sorted[i] = &b->files[i];
+    qsort(sorted, b->nfiles, sizeof *sorted, compare_outputs);
+
+    int rc = 0;
+    for (int i = 1; i < b->nfiles; i++) {
+        if (strcmp(sorted[i - 1]->out, sorted[i]->out) == 0) {
+            fprintf(stderr, "batch: %s and %s would both write %s\n",
+                    sorted[i - 1]->in, sorted[i]->in, sorted[i]->out);
+            rc = -1;
+        }
+    }
+    free(sorted);
+    return rc;
+}
+
+/* Print progress, at most once per interval unless final; b is locked */
+static void
+report(struct batch *b, bool final)
+{
+    double t = now();
+    if (!final && t - b->last_report < REPORT_INTERVAL)
+        return;
+    b->last_report = t;
+
+    double secs = t - b->start, mb = b->bytes / 1e6;
+    double rate = secs > 0 ? mb / secs : 0.0;
+    if (final) {
+        fprintf(stderr, "%sbatch: %d files, %d failed, %.1f MB in %.3fs,"
+                " %.1f MB/s, %.0f files/s\n", b->reported ? "\n" : "",
+                b->done, b->failed, mb, secs, rate,
+                secs > 0 ? b->done / secs : 0.0);
+    }
+    else if (isatty(STDERR_FILENO)) {
+        fprintf(stderr, "\rbatch: %d/%d files, %d failed, %.1f MB, %.1f MB/s",
+                b->done, b->nfiles, b->failed, mb, rate);
+        b->reported = true;
+    }
+    else {
+        fprintf(stderr, "batch: %d/%d files, %d failed, %.1f MB, %.1f MB/s\n",
+                b->done, b->nfiles, b->failed, mb, rate);
+    }
+}
+
+/**
+ * Give a CBC file an IV of its own: a fresh random one, written
+ * ahead of the ciphertext, or the one read back from there.
+ */
+static int
+file_iv(const struct file *f, struct stream_options *opts, int in, int out)
+{
+    if (opts->mode != STREAM_CBC)
+        return 0;
+    if (!opts->encrypt) {
+        ssize_t n = stream_read(in, opts->iv, AES_BLOCK_SIZE);
+        if (n != -1 && n != AES_BLOCK_SIZE)
+            fprintf(stderr, "batch: %s: too short for an IV\n", f->in);
+        return n == AES_BLOCK_SIZE ? 0 : -1;
+    }
+    if (getrandom(opts->iv, AES_BLOCK_SIZE, 0) != AES_BLOCK_SIZE) {
+        perror("getrandom");
+        return -1;
+    }
+    return stream_write(out, opts->iv, AES_BLOCK_SIZE);
+}
+
+/* Count a file as done, with its size; takes the lock */
+static void
+finish_file(struct batch *b, int rc, off_t size)
+{
+    pthread_mutex_lock(&b->lock);
+    b->done++;
+    b->failed += rc != 0;
+    b->bytes += size;
+    report(b, false);
+    pthread_mutex_unlock(&b->lock);
+}
+
+/* Stream one file to its output */
+static void
+process_file(struct batch *b, struct file *f)
+{
+    struct stat st = { 0 };
+    int rc = -1;
+
+    int in = open(f->in, O_RDONLY);
+    if (in == -1) {
+        fprintf(stderr, "batch: %s: %s\n", f->in, strerror(errno));
+        goto done;
+    }
+    fstat(in, &st);
+    int out = open(f->out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out == -1) {
+        fprintf(stderr, "batch: %s: %s\n", f->out, strerror(errno));
+        close(in);
+        goto done;
+    }
+
+    struct stream_options opts = *b->opts;
+    if (file_iv(f, &opts, in, out) == 0)
+        rc = stream_run(f->key, &opts, NULL, in, out);
+    if (close(out) == -1)
+        rc = -1;
+    close(in);
+    if (rc != 0) {
+        fprintf(stderr, "batch: %s: failed\n", f->in);
+        unlink(f->out);
+    }
+
+done:
+    finish_file(b, rc, st.st_size);
+}
+
+/* A small file encrypted side by side with others */
+struct lane {
+    struct file *file;
+    uint8_t *buf;               /* IV, then the file and its padding */
+    size_t blocks;              /* Blocks after the IV */
+    off_t size;
+};
+
+/**
+ * Read a small regular file whole into a lane, with a random IV
+ * ahead of it and PKCS#7 padding after it. Returns false, having
+ * read nothing, if the file should be streamed instead.
+ */
+static bool
+fill_lane(struct file *f, struct lane *lane)
+{
+    int in = open(f->in, O_RDONLY);
+    struct stat st;
+    if (in == -1 || fstat(in, &st) == -1 || !S_ISREG(st.st_mode)
+        || st.st_size > SMALL_FILE) {
+        if (in != -1)
+            close(in);
+        return false;
+    }
+
+    /* One byte more tells whether the file grew since fstat */
+    size_t room = AES_BLOCK_SIZE + st.st_size + AES_BLOCK_SIZE;
+    uint8_t *buf = xmalloc(room);
+    ssize_t len = stream_read(in, buf + AES_BLOCK_SIZE, st.st_size + 1);
+    close(in);
+    if (len == -1 || len > st.st_size
+        || getrandom(buf, AES_BLOCK_SIZE, 0) != AES_BLOCK_SIZE) {
+        free(buf);
+        return false;
+    }
+
+    int pad = AES_BLOCK_SIZE - len % AES_BLOCK_SIZE;
+    memset(buf + AES_BLOCK_SIZE + len, pad, pad);
+    *lane = (struct lane) { f, buf, (len + pad) / AES_BLOCK_SIZE, len };
+    return true;
+}
+
+/* Order lanes by key, then by length */
+static int
+compare_lanes(const void *a, const void *b)
+{
+    const struct lane *l = a, *m = b;
+    if (l->file->key != m->file->key)
+        return l->file->key < m->file->key ? -1 : 1;
+    return (l->blocks > m->blocks) - (l->blocks < m->blocks);
+}
+
+/**
+ * Encrypt lanes under one key, shortest first, in place. All
+ * lanes take the blocks the shortest one has left at once, in a
+ * single call; then it drops out and the others go on.
+ */
+static void
+encrypt_lanes(struct lane *lanes, int n)
+{
+    uint8_t ivs[LANES][AES_BLOCK_SIZE];
+    uint8_t *blocks[LANES];
+    for (int i = 0; i < n; i++)
+        memcpy(ivs[i], lanes[i].buf, AES_BLOCK_SIZE);
+
+    size_t done = 0;
+    for (int first = 0; first < n; first++) {
+        size_t count = lanes[first].blocks - done;
+        if (count == 0)
+            continue;
+        for (int i = first; i < n; i++)
+            blocks[i - first] = lanes[i].buf + (1 + done) * AES_BLOCK_SIZE;
+        aes_cbc_encrypt_streams(lanes[first].file->key, n - first,
+                                &ivs[first], (const uint8_t *const *) blocks,
+                                blocks, count);
+        done += count;
+    }
+}
+
+/* Write a lane's IV and ciphertext to its output */
+static int
+write_lane(const struct lane *lane)
+{
+    const struct file *f = lane->file;
+    int out = open(f->out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out == -1) {
+        fprintf(stderr, "batch: %s: %s\n", f->out, strerror(errno));
+        return -1;
+    }
+    int rc = stream_write(out, lane->buf, (1 + lane->blocks) * AES_BLOCK_SIZE);
+    if (close(out) == -1)
+        rc = -1;
+    if (rc != 0) {
+        fprintf(stderr, "batch: %s: failed\n", f->in);
+        unlink(f->out);
+    }
+    return rc;
+}
+
+/**
+ * Pool task: the files of one group. In CBC encryption, each file
+ * is a serial chain, so small files are read whole and encrypted
+ * side by side instead, as many as there are lanes in a bitsliced
+ * batch. Everything else is streamed one file at a time.
+ */
+static void
+process_group(void *arg, int index)
+{
+    struct batch *b = arg;
+    int first = index * b->group;
+    int last = first + b->group < b->nfiles ? first + b->group : b->nfiles;
+    bool lanes_apply = b->opts->mode == STREAM_CBC && b->opts->encrypt;
+
+    struct lane lanes[LANES];
+    int n = 0;
+    for (int i = first; i < last; i++) {
+        if (!lanes_apply || !fill_lane(&b->files[i], &lanes[n]))
+            process_file(b, &b->files[i]);
+        else
+            n++;
+    }
+
+    qsort(lanes, n, sizeof *lanes, compare_lanes);
+    for (int i = 0, j; i < n; i = j) {
+        for (j = i + 1; j < n && lanes[j].file->key == lanes[i].file->key; j++)
+            ;
+        encrypt_lanes(lanes + i, j - i);
+    }
+    for (int i = 0; i < n; i++) {
+        finish_file(b, write_lane(&lanes[i]), lanes[i].size);
+        free(lanes[i].buf);
+    }
+}
+
+/* Encrypt or decrypt every file of a directory or manifest */
+int
+batch_run(const char *source, const struct aes_key *key,
+          const struct stream_options *opts, const char *outdir, int threads)
+{
+    struct batch b = { .opts = opts, .outdir = outdir };
+    struct aes_key_cache *cache = aes_key_cache_create();
+    struct stat st;
+    int rc;
+    if (stat(source, &st) == -1) {
+        perror(source);
+        rc = -1;
+    }
+    else if (S_ISDIR(st.st_mode) && key == NULL) {
+        fprintf(stderr, "batch: %s is a directory, so it needs -k\n", source);
+        rc = -1;
+    }
+    else if (S_ISDIR(st.st_mode))
+        rc = read_directory(&b, source, key);
+    else
+        rc = read_manifest(&b, source, key, cache);
+    if (rc == 0)
+        rc = check_outputs(&b);
+
+    if (rc == 0) {
+        /* Spread the lanes of CBC encryption over every thread */
+        b.group = 1;
+        if (opts->mode == STREAM_CBC && opts->encrypt) {
+            b.group = (b.nfiles + threads - 1) / threads;
+            b.group = b.group < 1 ? 1 : b.group > LANES ? LANES : b.group;
+        }
+        int groups = (b.nfiles + b.group - 1) / b.group;
+
+        pthread_mutex_init(&b.lock, NULL);
+        b.start = b.last_report = now();
+        struct pool *pool = pool_create(threads);
+        pool_start(pool, process_group, &b, groups);
+        pool_wait(pool);
+        pool_destroy(pool);
+
+        report(&b, true);
+        size_t keys = aes_key_cache_size(cache);
+        if (keys > 0)
+            fprintf(stderr, "batch: %zu key%s from the manifest, each"
+                    " expanded once\n", keys, keys == 1 ? "" : "s");
+        pthread_mutex_destroy(&b.lock);
+        rc = b.failed;
+    }
+
+    for (int i = 0; i < b.nfiles; i++) {
+        free(b.files[i].in);
+        free(b.files[i].out);
+    }
+    free(b.files);
+    aes_key_cache_destroy(cache);
+    return rc;
+}
@@ -0,0 +1,33 @@
+#ifndef __BATCH_H
+#define __BATCH_H
+
+#include "stream.h"
+
+/**
+ * Encrypt or decrypt many files in one process, as stream_run does
+ * one. source is a directory, whose regular files are processed,
+ * or a manifest with one file per line, optionally followed by a
+ * tab and that file's hex key; key is used for the other lines and
+ * may be NULL if there are none. Each distinct key is expanded
+ * once.
+ *
+ * Encryption appends ".aes" to each name and decryption removes
+ * it; when encrypting a directory, files that already end in
+ * ".aes" are skipped, and when decrypting one, all others are.
+ * Results go next to their inputs, or into outdir if it is not
+ * NULL. In CBC mode, each file is encrypted under a random IV of
+ * its own, which is written ahead of its ciphertext and read back
+ * from there to decrypt it; opts->iv is not used.
+ *
+ * Files are spread over a pool of the given number of threads.
+ * Progress and a summary of the throughput go to stderr.
+ *
+ * Returns the number of files that failed, or -1 if the source or
+ * a key in it is unusable, or two files would have the same
+ * output, in which case no file was touched.
+ */
+int batch_run(const char *source, const struct aes_key *key,
+              const struct stream_options *opts, const char *outdir,
+              int threads);
+
+#endif /* __BATCH_H */
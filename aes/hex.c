@@ -0,0 +1,43 @@
+/**
+ * Hex decoding, for keys and IVs given on the command line or in a
+ * batch manifest.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "hex.h"
+
+/* Value of a hex digit, or -1 */
+static int
+hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/* Decode a hex string into a new buffer; returns NULL if malformed */
+uint8_t *
+hex_decode(const char *hex, size_t *len)
+{
+    size_t digits = strlen(hex);
+    if (digits % 2 != 0)
+        return NULL;
+    uint8_t *bytes = malloc(digits / 2 + 1);
+    if (bytes == NULL)
+        return NULL;
+    for (size_t i = 0; i < digits / 2; i++) {
+        int hi = hex_digit(hex[2 * i]), lo = hex_digit(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            free(bytes);
+            return NULL;
+        }
+        bytes[i] = hi << 4 | lo;
+    }
+    *len = digits / 2;
+    return bytes;
+}
@@ -0,0 +1,14 @@
+#ifndef __HEX_H
+#define __HEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Decode a string of hex digits, in either case, into a new buffer
+ * the caller frees, and store its length in len. Returns NULL if
+ * the string has an odd length or a character that is not a digit.
+ */
+uint8_t * hex_decode(const char *hex, size_t *len);
+
+#endif /* __HEX_H */
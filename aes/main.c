@@ -0,0 +1,379 @@
+/**
+ * Command line front end, a drop-in replacement for aes.py.
+ *
+ * Takes the same options and prints the same lines, so scripts
+ * that read the last line of aes.py's output keep working. As in
+ * aes.py, -cbc chains each block to the ciphertext before it and
+ * leaves the first block unchained, i.e. the IV is all zeros.
+ *
+ * With -s, the input is read from a file or stdin instead and
+ * streamed through stream_run; see stream.c. With -b, a whole
+ * directory or list of files is; see batch.c.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aes.h"
+#include "batch.h"
+#include "hex.h"
+#include "pool.h"
+#include "stream.h"
+
+static struct options {
+    const char *plaintext;      /* Hex text to encrypt or decrypt */
+    const char *key;            /* Hex key of 32, 48 or 64 digits */
+    const char *engine;         /* Kernel to use instead of the fastest */
+    const char *input, *output; /* Files for -s, default stdin and stdout */
+    const char *iv;             /* Hex IV or first counter for -s */
+    const char *threads;        /* Worker threads for -s and -b */
+    const char *batch;          /* Directory or manifest for -b */
+    bool debug, cbc, encrypt, decrypt, filestore;
+    bool stream, ctr, hex;
+} opts;
+
+/* Options as aes.py's argparse defines them */
+static const struct option {
+    const char *shortopt, *longopt;
+    const char **value;         /* Takes an argument, stored here */
+    bool *flag;                 /* Or is a flag, set here */
+    const char *help;
+} options[] = {
+    { "-p", "--plaintext", &opts.plaintext, NULL,
+      "plaintext or cipher text message to be (de)encrypted, in hex" },
+    { "-k", "--key", &opts.key, NULL,
+      "cryptographic key in hex (128, 192 or 256 bits)" },
+    { "-d", "--debug", NULL, &opts.debug,
+      "print the engine and the expanded key" },
+    { "-cbc", "--cbc-encryption", NULL, &opts.cbc,
+      "turn on CBC mode, default off" },
+    { "-e", "--encryption", NULL, &opts.encrypt, "encrypt this text" },
+    { "-de", "--decryption", NULL, &opts.decrypt, "decrypt this text" },
+    { "-f", "--filestore", NULL, &opts.filestore,
+      "also store the result in a file" },
+    { NULL, "--engine", &opts.engine, NULL,
+      "auto, table, aesni or bitslice (default auto)" },
+    { "-s", "--stream", NULL, &opts.stream,
+      "stream a file or stdin instead of -p, padded as in PKCS#7" },
+    { "-i", "--input", &opts.input, NULL, "with -s, read this file" },
+    { "-o", "--output", &opts.output, NULL,
+      "with -s, write this file; with -b, into this directory" },
+    { NULL, "--ctr", NULL, &opts.ctr, "with -s, use CTR mode" },
+    { NULL, "--iv", &opts.iv, NULL,
+      "with -s, hex IV for -cbc or first counter for --ctr" },
+    { NULL, "--hex", NULL, &opts.hex, "with -s, write hex digits" },
+    { "-t", "--threads", &opts.threads, NULL,
+      "with -s or -b, threads to use (default one per CPU)" },
+    { "-b", "--batch", &opts.batch, NULL,
+      "encrypt the files of a directory, or of a manifest of lines"
+      " \"FILE\" or \"FILE<tab>KEY\", into FILE.aes" },
+};
+
+#define NUM_OPTIONS (sizeof options / sizeof options[0])
+
+static void
+usage(const char *progname, FILE *out)
+{
+    fprintf(out, "Usage: %s -p HEX -k HEX [-e | -de] [-cbc] [-f] [-d]"
+            " [--engine NAME]\n"
+            "       %s -s -k HEX [-e | -de] [-cbc | --ctr] [--iv HEX]"
+            " [-i FILE] [-o FILE] [--hex] [-t N]\n"
+            "       %s -b DIR|MANIFEST [-k HEX] [-e | -de] -cbc"
+            " [-o DIR] [-t N]\n", progname, progname, progname);
+    for (size_t i = 0; i < NUM_OPTIONS; i++)
+        fprintf(out, "  %-4s %-18s %s\n",
+                options[i].shortopt ? options[i].shortopt : "",
+                options[i].longopt, options[i].help);
+}
+
+/* Fill in opts; exits with status 2 on a usage error */
+static void
+parse_args(int ac, char *av[])
+{
+    for (int i = 1; i < ac; i++) {
+        if (strcmp(av[i], "-h") == 0 || strcmp(av[i], "--help") == 0) {
+            usage(av[0], stdout);
+            exit(EXIT_SUCCESS);
+        }
+
+        const struct option *o = NULL;
+        const char *value = NULL;
+        for (size_t j = 0; j < NUM_OPTIONS && !o; j++) {
+            const char *s = options[j].shortopt, *l = options[j].longopt;
+            size_t llen = strlen(l);
+            if ((s && strcmp(av[i], s) == 0) || strcmp(av[i], l) == 0)
+                o = &options[j];
+            else if (options[j].value && strncmp(av[i], l, llen) == 0
+                     && av[i][llen] == '=')
+                o = &options[j], value = av[i] + llen + 1;
+        }
+        if (o == NULL) {
+            fprintf(stderr, "%s: unrecognized argument: %s\n", av[0], av[i]);
+            usage(av[0], stderr);
+            exit(2);
+        }
+
+        if (o->flag) {
+            *o->flag = true;
+            continue;
+        }
+        if (value == NULL && ++i == ac) {
+            fprintf(stderr, "%s: %s expects one argument\n", av[0], av[i - 1]);
+            exit(2);
+        }
+        *o->value = value ? value : av[i];
+    }
+
+    /* A manifest may give the keys */
+    if ((!opts.plaintext && !opts.stream && !opts.batch)
+        || (!opts.key && !opts.batch)) {
+        fprintf(stderr, "%s: the following arguments are required: %s\n",
+                av[0], !opts.key ? "-k/--key" : "-p/--plaintext");
+        usage(av[0], stderr);
+        exit(2);
+    }
+}
+
+static void
+print_hex(FILE *out, const uint8_t *bytes, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        fprintf(out, "%02x", bytes[i]);
+}
+
+/* Switch to the engine given by --engine; exits if there is none */
+static void
+select_engine(const char *progname)
+{
+    if (opts.engine == NULL)
+        return;
+
+    enum aes_engine engine = AES_ENGINE_AUTO;
+    if (strcmp(opts.engine, "table") == 0)
+        engine = AES_ENGINE_TABLE;
+    else if (strcmp(opts.engine, "aesni") == 0)
+        engine = AES_ENGINE_AESNI;
+    else if (strcmp(opts.engine, "bitslice") == 0)
+        engine = AES_ENGINE_BITSLICE;
+    else if (strcmp(opts.engine, "auto") != 0) {
+        fprintf(stderr, "%s: unknown engine %s\n", progname, opts.engine);
+        exit(2);
+    }
+    if (!aes_set_engine(engine)) {
+        fprintf(stderr, "%s: engine %s is not supported here\n",
+                progname, opts.engine);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Expand the -k key; exits if it is malformed */
+static void
+expand_key(struct aes_key *key)
+{
+    size_t keylen;
+    uint8_t *keybytes = hex_decode(opts.key, &keylen);
+    if (keybytes == NULL || !aes_expand_key(key, keybytes, keylen)) {
+        fprintf(stderr, "Enter a valid key: 32, 48 or 64 hex digits\n");
+        exit(EXIT_FAILURE);
+    }
+    free(keybytes);
+}
+
+/* Open a -i or -o file, or return fd if none was given */
+static int
+open_or(const char *path, int flags, int fd)
+{
+    if (path == NULL || strcmp(path, "-") == 0)
+        return fd;
+    if ((fd = open(path, flags, 0666)) == -1) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+/**
+ * Fill in the options shared by -s and -b. Returns 0, or the exit
+ * status for a usage error.
+ */
+static int
+stream_setup(const char *progname, const char *mode, struct stream_options *so,
+             long *threads)
+{
+    *so = (struct stream_options) {
+        .mode = opts.ctr ? STREAM_CTR : opts.cbc ? STREAM_CBC : STREAM_ECB,
+        .encrypt = opts.encrypt,
+        .hex = opts.hex,
+    };
+    if (opts.encrypt == opts.decrypt || (opts.ctr && opts.cbc)) {
+        fprintf(stderr, "%s: %s needs one of -e or -de, and at most one"
+                " of -cbc or --ctr\n", progname, mode);
+        return 2;
+    }
+    /* Reusing a counter would reveal the XOR of two plaintexts */
+    if (opts.ctr && opts.iv == NULL) {
+        fprintf(stderr, "%s: --ctr needs --iv\n", progname);
+        return 2;
+    }
+    if (opts.iv) {
+        size_t len;
+        uint8_t *iv = hex_decode(opts.iv, &len);
+        if (iv == NULL || len != AES_BLOCK_SIZE) {
+            fprintf(stderr, "%s: --iv must be 32 hex digits\n", progname);
+            return 2;
+        }
+        memcpy(so->iv, iv, AES_BLOCK_SIZE);
+        free(iv);
+    }
+
+    *threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (opts.threads) {
+        char *end;
+        *threads = strtol(opts.threads, &end, 10);
+        if (*threads < 1 || *threads > 1024 || *end) {
+            fprintf(stderr, "%s: bad thread count %s\n", progname, opts.threads);
+            return 2;
+        }
+    }
+    return 0;
+}
+
+/* The -s mode: no banner, nothing but the result on the output */
+static int
+run_stream(const char *progname)
+{
+    struct stream_options so;
+    long threads;
+    int status = stream_setup(progname, "-s", &so, &threads);
+    if (status != 0)
+        return status;
+
+    struct aes_key key;
+    select_engine(progname);
+    expand_key(&key);
+    int in = open_or(opts.input, O_RDONLY, STDIN_FILENO);
+    int out = open_or(opts.output, O_WRONLY | O_CREAT | O_TRUNC, STDOUT_FILENO);
+
+    struct pool *pool = pool_create(threads);
+    int rc = stream_run(&key, &so, pool, in, out);
+    pool_destroy(pool);
+    if (out != STDOUT_FILENO && close(out) == -1) {
+        perror(opts.output);
+        rc = -1;
+    }
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* The -b mode: a summary on stderr, nothing on stdout */
+static int
+run_batch(const char *progname)
+{
+    struct stream_options so;
+    long threads;
+    int status = stream_setup(progname, "-b", &so, &threads);
+    if (status != 0)
+        return status;
+    /* Every file would start from the same counter */
+    if (opts.ctr) {
+        fprintf(stderr, "%s: -b cannot use --ctr\n", progname);
+        return 2;
+    }
+    /* ECB shows which blocks are equal, within and across files */
+    if (!opts.cbc) {
+        fprintf(stderr, "%s: -b needs -cbc\n", progname);
+        return 2;
+    }
+    if (opts.iv) {
+        fprintf(stderr, "%s: -b gives every file an IV of its own,"
+                " and takes no --iv\n", progname);
+        return 2;
+    }
+    if (opts.hex) {
+        fprintf(stderr, "%s: -b writes raw bytes, without --hex\n", progname);
+        return 2;
+    }
+
+    struct aes_key key;
+    select_engine(progname);
+    if (opts.key)
+        expand_key(&key);
+    int failed = batch_run(opts.batch, opts.key ? &key : NULL, &so,
+                           opts.output, threads);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int
+main(int ac, char *av[])
+{
+    parse_args(ac, av);
+    aes_init();
+
+    if (opts.stream)
+        return run_stream(av[0]);
+    if (opts.batch)
+        return run_batch(av[0]);
+    select_engine(av[0]);
+
+    printf("Starting Ecryption on:  %s  with key: %s\n", opts.plaintext, opts.key);
+    if (opts.debug)
+        printf("Debug mode ON\n");
+    if (opts.cbc)
+        printf("Using CBC mode\n");
+    if (!opts.encrypt && !opts.decrypt) {
+        printf("need to select a mode either -e or -de\n");
+        return EXIT_SUCCESS;
+    }
+
+    size_t len;
+    struct aes_key key;
+    expand_key(&key);
+
+    /* No padding, as in aes.py */
+    uint8_t *text = hex_decode(opts.plaintext, &len);
+    if (text == NULL || len == 0 || len % AES_BLOCK_SIZE != 0) {
+        fprintf(stderr, "Enter Valid Input length: a multiple of 32 hex digits\n");
+        return EXIT_FAILURE;
+    }
+    size_t blocks = len / AES_BLOCK_SIZE;
+
+    if (opts.debug) {
+        printf("Engine: %s\nExpanded key: ", aes_engine_name());
+        print_hex(stdout, key.enc, (key.rounds + 1) * AES_BLOCK_SIZE);
+        printf("\n");
+    }
+
+    uint8_t iv[AES_BLOCK_SIZE] = { 0 };
+    if (opts.cbc) {
+        for (size_t i = 1; i < blocks; i++)
+            printf("cbc needed\n");
+        if (opts.encrypt)
+            aes_cbc_encrypt(&key, iv, text, text, blocks);
+        else
+            aes_cbc_decrypt(&key, iv, text, text, blocks);
+    }
+    else if (opts.encrypt)
+        aes_encrypt_blocks(&key, text, text, blocks);
+    else
+        aes_decrypt_blocks(&key, text, text, blocks);
+
+    print_hex(stdout, text, len);
+    printf("\n");
+
+    if (opts.filestore) {
+        char filename[64];
+        snprintf(filename, sizeof filename, "%s%ld.txt",
+                 opts.encrypt ? "encrypt" : "decrypt", (long) time(NULL));
+        FILE *f = fopen(filename, "w");
+        if (f == NULL) {
+            perror(filename);
+            return EXIT_FAILURE;
+        }
+        print_hex(f, text, len);
+        fclose(f);
+    }
+    free(text);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,129 @@
+/**
+ * Worker threads for batches of independent tasks.
+ *
+ * Tasks are numbered, and each idle thread claims the next number
+ * under the pool's lock. Tasks are meant to be large (a slice of
+ * a megabyte, or a whole file), so one lock round trip per task
+ * is negligible.
+ */
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+struct pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* A batch was started, or shutdown */
+    pthread_cond_t done;        /* The last task of a batch returned */
+    pool_task_t task;
+    void *arg;
+    int count;                  /* Tasks in the current batch */
+    int next;                   /* First task not yet claimed */
+    int finished;               /* Tasks that have returned */
+    bool shutdown;
+    int nthreads;
+    pthread_t threads[];
+};
+
+static void *
+worker(void *p)
+{
+    struct pool *pool = p;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->next == pool->count && !pool->shutdown)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->next == pool->count)
+            break;
+
+        int index = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->task(pool->arg, index);
+        pthread_mutex_lock(&pool->lock);
+
+        if (++pool->finished == pool->count)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* Start a pool of the given number of threads */
+struct pool *
+pool_create(int threads)
+{
+    if (threads < 1)
+        threads = 1;
+    struct pool *pool = calloc(1, sizeof *pool + threads * sizeof(pthread_t));
+    if (pool == NULL) {
+        perror("pool");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (; pool->nthreads < threads; pool->nthreads++) {
+        int rc = pthread_create(&pool->threads[pool->nthreads], NULL,
+                                worker, pool);
+        if (rc != 0) {
+            fprintf(stderr, "pool: pthread_create: %s\n", strerror(rc));
+            exit(EXIT_FAILURE);
+        }
+    }
+    return pool;
+}
+
+/* Wait for the current batch, then stop the threads */
+void
+pool_destroy(struct pool *pool)
+{
+    pool_wait(pool);
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    free(pool);
+}
+
+/* Number of threads in the pool */
+int
+pool_size(struct pool *pool)
+{
+    return pool->nthreads;
+}
+
+/* Run a batch of tasks on the pool's threads, without waiting */
+void
+pool_start(struct pool *pool, pool_task_t task, void *arg, int count)
+{
+    pthread_mutex_lock(&pool->lock);
+    assert(pool->finished == pool->count || !!!"previous batch not waited for");
+    pool->task = task;
+    pool->arg = arg;
+    pool->count = count;
+    pool->next = 0;
+    pool->finished = 0;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Wait until every task of the current batch has returned */
+void
+pool_wait(struct pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->finished < pool->count)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,33 @@
+#ifndef __POOL_H
+#define __POOL_H
+
+/**
+ * A fixed set of worker threads that run one batch of tasks at a
+ * time. The caller may do other work between pool_start and
+ * pool_wait, e.g. read the next input while the pool encrypts.
+ */
+struct pool;
+
+/* Runs task number index of a batch */
+typedef void (*pool_task_t)(void *arg, int index);
+
+/* Start a pool of the given number of threads, at least 1 */
+struct pool * pool_create(int threads);
+
+/* Wait for the current batch, then stop the threads */
+void pool_destroy(struct pool *pool);
+
+/* Number of threads in the pool */
+int pool_size(struct pool *pool);
+
+/**
+ * Run task(arg, i) for every i in [0, count) on the pool's
+ * threads, without waiting for them. The previous batch must have
+ * been waited for.
+ */
+void pool_start(struct pool *pool, pool_task_t task, void *arg, int count);
+
+/* Wait until every task of the current batch has returned */
+void pool_wait(struct pool *pool);
+
+#endif /* __POOL_H */
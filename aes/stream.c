@@ -0,0 +1,301 @@
+/**
+ * Streaming encryption of files or pipes.
+ *
+ * Two chunk buffers alternate: while the pool encrypts one, the
+ * main thread reads into the other. Each chunk is cut into slices
+ * of SLICE bytes, one task each:
+ *
+ * - ECB and CTR blocks are independent; a CTR slice starts from
+ *   the chunk's counter advanced by the slice's offset.
+ * - In CBC decryption, a block only needs the ciphertext block
+ *   before it, so each slice is given its chain value up front.
+ * - CBC encryption is inherently serial and runs as a single task,
+ *   which still overlaps with reading.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stream.h"
+
+#define SLICE (1 << 20)         /* Bytes per task; a multiple of blocks */
+
+/* What the pool works on */
+struct chunk {
+    const struct aes_key *key;
+    const struct stream_options *opts;
+    uint8_t *data;
+    size_t len;
+    uint8_t counter[AES_BLOCK_SIZE];    /* CTR: counter for data[0] */
+    uint8_t *chain;             /* CBC: chain value of each slice */
+};
+
+static void
+run_slice(void *arg, int i)
+{
+    struct chunk *c = arg;
+    const struct stream_options *opts = c->opts;
+    size_t offset = (size_t) i * SLICE;
+    size_t len = c->len - offset < SLICE ? c->len - offset : SLICE;
+    uint8_t *p = c->data + offset;
+
+    switch (opts->mode) {
+    case STREAM_CTR: {
+        uint8_t counter[AES_BLOCK_SIZE];
+        memcpy(counter, c->counter, AES_BLOCK_SIZE);
+        aes_ctr_advance(counter, offset / AES_BLOCK_SIZE);
+        aes_ctr_crypt(c->key, counter, p, p, len);
+        break;
+    }
+    case STREAM_ECB:
+        if (opts->encrypt)
+            aes_encrypt_blocks(c->key, p, p, len / AES_BLOCK_SIZE);
+        else
+            aes_decrypt_blocks(c->key, p, p, len / AES_BLOCK_SIZE);
+        break;
+    case STREAM_CBC:
+        if (opts->encrypt)      /* A single task for the whole chunk */
+            aes_cbc_encrypt(c->key, c->chain, p, p, c->len / AES_BLOCK_SIZE);
+        else
+            aes_cbc_decrypt(c->key, c->chain + i * AES_BLOCK_SIZE, p, p,
+                            len / AES_BLOCK_SIZE);
+        break;
+    }
+}
+
+/* Read until the buffer is full or the input ends */
+ssize_t
+stream_read(int fd, uint8_t *buf, size_t size)
+{
+    size_t len = 0;
+    while (len < size) {
+        ssize_t n = read(fd, buf + len, size - len);
+        if (n == 0)
+            break;
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("read");
+            return -1;
+        }
+        len += n;
+    }
+    return len;
+}
+
+/* Write all of the buffer */
+int
+stream_write(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Where results go, in binary or as hex digits */
+struct output {
+    int fd;
+    bool hex;
+    char *digits;               /* Two per byte of a chunk */
+};
+
+static int
+emit(struct output *out, const uint8_t *data, size_t len)
+{
+    if (!out->hex)
+        return stream_write(out->fd, data, len);
+
+    static const char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+        out->digits[2 * i] = hex[data[i] >> 4];
+        out->digits[2 * i + 1] = hex[data[i] & 0xf];
+    }
+    return stream_write(out->fd, out->digits, 2 * len);
+}
+
+/* Buffers of a thread, kept for its next stream_run */
+struct buffers {
+    int slices;                 /* Chunks hold this many slices */
+    uint8_t *buf[2];            /* Two chunks, and room for padding */
+    uint8_t *chain;             /* A chain value per slice */
+    char *digits;               /* Hex output, once a chunk */
+};
+
+static pthread_key_t buffers_key;
+static pthread_once_t buffers_once = PTHREAD_ONCE_INIT;
+
+static void
+free_buffers(void *arg)
+{
+    struct buffers *b = arg;
+    free(b->buf[0]);
+    free(b->buf[1]);
+    free(b->chain);
+    free(b->digits);
+    free(b);
+}
+
+static void
+create_buffers_key(void)
+{
+    pthread_key_create(&buffers_key, free_buffers);
+}
+
+/**
+ * The calling thread's buffers, grown to chunks of the given number
+ * of slices. A batch streams many small files on each thread, which
+ * would otherwise allocate and fault in megabytes for every one.
+ */
+static struct buffers *
+get_buffers(int slices, bool hex)
+{
+    pthread_once(&buffers_once, create_buffers_key);
+    struct buffers *b = pthread_getspecific(buffers_key);
+    if (b == NULL) {
+        if ((b = calloc(1, sizeof *b)) == NULL
+            || pthread_setspecific(buffers_key, b) != 0) {
+            perror("stream");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t size = (size_t) slices * SLICE;
+    if (b->slices < slices) {
+        free(b->buf[0]);
+        free(b->buf[1]);
+        free(b->chain);
+        free(b->digits);
+        b->slices = slices;
+        b->buf[0] = malloc(size + AES_BLOCK_SIZE);
+        b->buf[1] = malloc(size + AES_BLOCK_SIZE);
+        b->chain = malloc(slices * AES_BLOCK_SIZE);
+        b->digits = NULL;
+    }
+    if (hex && b->digits == NULL)
+        b->digits = malloc(2 * (size_t) b->slices * SLICE);
+    if (!b->buf[0] || !b->buf[1] || !b->chain || (hex && !b->digits)) {
+        perror("stream");
+        exit(EXIT_FAILURE);
+    }
+    return b;
+}
+
+/* Encrypt or decrypt everything read from in, writing it to out */
+int
+stream_run(const struct aes_key *key, const struct stream_options *opts,
+           struct pool *pool, int in, int out)
+{
+    int slices = pool ? pool_size(pool) : 1;
+    size_t size = (size_t) slices * SLICE;
+    bool padded = opts->mode != STREAM_CTR;
+
+    struct buffers *b = get_buffers(slices, opts->hex);
+    uint8_t **buf = b->buf, *chain = b->chain;
+    struct output output = { out, opts->hex, b->digits };
+
+    /* Padding is only known to be valid once the input has ended */
+    uint8_t held[AES_BLOCK_SIZE];
+    bool holding = false;
+
+    uint8_t state[AES_BLOCK_SIZE];      /* Counter, or chain value */
+    memcpy(state, opts->iv, AES_BLOCK_SIZE);
+
+    int rc = -1, cur = 0;
+    ssize_t len = stream_read(in, buf[cur], size);
+    for (;;) {
+        if (len == -1)
+            goto done;
+        bool eof = (size_t) len < size;
+        uint8_t *data = buf[cur];
+
+        if (padded && opts->encrypt && eof) {
+            int pad = AES_BLOCK_SIZE - len % AES_BLOCK_SIZE;
+            memset(data + len, pad, pad);
+            len += pad;
+        }
+        if (padded && len % AES_BLOCK_SIZE != 0) {
+            fprintf(stderr, "stream: input is not a whole number of blocks\n");
+            goto done;
+        }
+
+        struct chunk chunk = { key, opts, data, len };
+        int tasks = (len + SLICE - 1) / SLICE;
+        if (opts->mode == STREAM_CTR) {
+            memcpy(chunk.counter, state, AES_BLOCK_SIZE);
+            aes_ctr_advance(state, len / AES_BLOCK_SIZE);
+        }
+        else if (opts->mode == STREAM_CBC && opts->encrypt) {
+            chunk.chain = state;        /* Advanced by the task */
+            tasks = len > 0;
+        }
+        else if (opts->mode == STREAM_CBC && len > 0) {
+            /* Each slice chains to the ciphertext before it */
+            chunk.chain = chain;
+            memcpy(chain, state, AES_BLOCK_SIZE);
+            for (int i = 1; i < tasks; i++)
+                memcpy(chain + i * AES_BLOCK_SIZE,
+                       data + i * SLICE - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+            memcpy(state, data + len - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+        }
+
+        /* Read the next chunk while this one is processed */
+        ssize_t next;
+        if (pool) {
+            pool_start(pool, run_slice, &chunk, tasks);
+            next = eof ? 0 : stream_read(in, buf[1 - cur], size);
+            pool_wait(pool);
+        }
+        else {
+            for (int i = 0; i < tasks; i++)
+                run_slice(&chunk, i);
+            next = eof ? 0 : stream_read(in, buf[1 - cur], size);
+        }
+
+        if (padded && !opts->encrypt && len > 0) {
+            /* Hold back the last block, which may be padding */
+            if (holding && emit(&output, held, AES_BLOCK_SIZE) == -1)
+                goto done;
+            if (emit(&output, data, len - AES_BLOCK_SIZE) == -1)
+                goto done;
+            memcpy(held, data + len - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+            holding = true;
+        }
+        else if (emit(&output, data, len) == -1)
+            goto done;
+
+        if (eof)
+            break;
+        cur = 1 - cur;
+        len = next;
+    }
+
+    if (padded && !opts->encrypt) {
+        int pad = holding ? held[AES_BLOCK_SIZE - 1] : 0;
+        bool valid = pad >= 1 && pad <= AES_BLOCK_SIZE;
+        for (int i = AES_BLOCK_SIZE - pad; valid && i < AES_BLOCK_SIZE; i++)
+            valid = held[i] == pad;
+        if (!valid) {
+            fprintf(stderr, "stream: bad padding; wrong key or mode?\n");
+            goto done;
+        }
+        if (emit(&output, held, AES_BLOCK_SIZE - pad) == -1)
+            goto done;
+    }
+    rc = opts->hex ? stream_write(out, "\n", 1) : 0;
+
+done:
+    return rc;
+}
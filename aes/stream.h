@@ -0,0 +1,49 @@
+#ifndef __STREAM_H
+#define __STREAM_H
+
+#include <sys/types.h>
+
+#include "aes.h"
+#include "pool.h"
+
+enum stream_mode {
+    STREAM_ECB,
+    STREAM_CBC,
+    STREAM_CTR,
+};
+
+struct stream_options {
+    enum stream_mode mode;
+    bool encrypt;               /* Else decrypt */
+    bool hex;                   /* Write hex digits rather than bytes */
+    uint8_t iv[AES_BLOCK_SIZE]; /* CBC: the IV; CTR: the first counter */
+};
+
+/**
+ * Encrypt or decrypt everything read from fd in, writing the
+ * result to fd out as it goes. ECB and CBC pad the plaintext as
+ * in PKCS#7; CTR needs no padding.
+ *
+ * Input is processed in chunks of one megabyte per thread of the
+ * pool, and the next chunk is read while the pool works on the
+ * current one, so memory use does not depend on the input size.
+ * The buffers are kept for the next call on the same thread.
+ * Everything but CBC encryption is split across the threads.
+ * With a NULL pool, everything runs on the calling thread, one
+ * megabyte at a time.
+ *
+ * Returns 0, or -1 after printing an error.
+ */
+int stream_run(const struct aes_key *key, const struct stream_options *opts,
+               struct pool *pool, int in, int out);
+
+/**
+ * read(2) until size bytes have been read or the input ends, or
+ * write(2) all of len bytes, retrying after signals. Return the
+ * number of bytes read, or 0 for a write, or -1 after printing an
+ * error.
+ */
+ssize_t stream_read(int fd, uint8_t *buf, size_t size);
+int stream_write(int fd, const void *buf, size_t len);
+
+#endif /* __STREAM_H */
@@ -0,0 +1,95 @@
+/**
+ * Bump allocator for data that shares one lifetime.
+ *
+ * Blocks double in size as the arena grows. On reset only the most
+ * recent (and thus largest) block survives, so after the first few
+ * command lines every allocation is a pointer increment.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+#include "arena.h"
+#include "utils.h"
+
+#define FIRST_BLOCK 4096
+#define ALIGN alignof(max_align_t)
+
+struct arena_block {
+    struct arena_block *prev;   /* Older block, released on reset */
+    size_t size, used;          /* Bytes in data[], bytes handed out */
+    alignas(max_align_t) char data[];
+};
+
+/* Initialize an empty arena */
+void
+arena_init(struct arena *arena)
+{
+    arena->head = NULL;
+    arena->next_size = 0;
+}
+
+/* Allocate size bytes, suitably aligned for any type */
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+    size = (size + ALIGN - 1) & ~(ALIGN - 1);
+
+    struct arena_block *b = arena->head;
+    if (b == NULL || b->size - b->used < size) {
+        if (arena->next_size == 0)
+            arena->next_size = FIRST_BLOCK;
+        while (arena->next_size < size)
+            arena->next_size *= 2;
+
+        b = malloc(sizeof *b + arena->next_size);
+        if (b == NULL)
+            utils_fatal_error("arena: ");
+        b->prev = arena->head;
+        b->size = arena->next_size;
+        b->used = 0;
+        arena->head = b;
+        arena->next_size *= 2;
+    }
+
+    void *p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+/* Copy the first n characters of s into the arena, NUL terminated */
+char *
+arena_strndup(struct arena *arena, const char *s, size_t n)
+{
+    char *p = arena_alloc(arena, n + 1);
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+/* Release everything allocated from the arena but its largest block */
+void
+arena_reset(struct arena *arena)
+{
+    struct arena_block *b = arena->head;
+    if (b == NULL)
+        return;
+
+    for (struct arena_block *old = b->prev; old != NULL; ) {
+        struct arena_block *prev = old->prev;
+        free(old);
+        old = prev;
+    }
+    b->prev = NULL;
+    b->used = 0;
+    arena->next_size = b->size * 2;
+}
+
+/* Release all memory of the arena */
+void
+arena_destroy(struct arena *arena)
+{
+    arena_reset(arena);
+    free(arena->head);
+    arena_init(arena);
+}
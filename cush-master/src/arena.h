@@ -0,0 +1,32 @@
+/**
+ * Bump allocator for data that shares one lifetime.
+ *
+ * Allocations are carved out of large blocks and are never freed
+ * individually; arena_reset() releases all of them at once.
+ */
+#include <stddef.h>
+
+struct arena_block;
+
+struct arena {
+    struct arena_block *head;   /* Block currently allocated from */
+    size_t next_size;           /* Size of the next block to obtain */
+};
+
+/* Initialize an empty arena. A zero-filled arena is empty as well. */
+void arena_init(struct arena *arena);
+
+/* Allocate size bytes, suitably aligned for any type */
+void * arena_alloc(struct arena *arena, size_t size);
+
+/* Copy the first n characters of s into the arena, NUL terminated */
+char * arena_strndup(struct arena *arena, const char *s, size_t n);
+
+/**
+ * Release everything allocated from the arena. The largest block
+ * is kept, so a steady workload stops calling malloc altogether.
+ */
+void arena_reset(struct arena *arena);
+
+/* Release all memory of the arena, leaving it empty */
+void arena_destroy(struct arena *arena);
@@ -0,0 +1,145 @@
+/**
+ * Line reader for batch mode.
+ *
+ * Reads its input 64 KB at a time and splits it into lines, so
+ * thousands of commands cost a handful of read() calls instead of
+ * readline's per-character terminal handling.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "utils.h"
+
+#define CHUNK (1 << 16)
+
+struct batch_input {
+    int fd;             /* Source of input, -1 for a string */
+    bool seekable;      /* Whether read-ahead can be given back */
+    bool eof;           /* No more data beyond the buffer */
+    char *buf;          /* Data read but not yet returned ... */
+    size_t start, end;  /* ... lies in buf[start, end) */
+    size_t cap;
+};
+
+/* Read lines from an open file descriptor */
+struct batch_input *
+batch_open_fd(int fd)
+{
+    struct batch_input *in = calloc(1, sizeof *in);
+    if (in == NULL)
+        utils_fatal_error("calloc: ");
+    in->fd = fd;
+    in->seekable = fd == STDIN_FILENO && lseek(fd, 0, SEEK_CUR) != -1;
+    in->cap = CHUNK;
+    in->buf = malloc(in->cap);
+    if (in->buf == NULL)
+        utils_fatal_error("malloc: ");
+    return in;
+}
+
+/* Read lines from a string, as given to `-c` */
+struct batch_input *
+batch_open_string(const char *str)
+{
+    struct batch_input *in = calloc(1, sizeof *in);
+    if (in == NULL)
+        utils_fatal_error("calloc: ");
+    in->fd = -1;
+    in->eof = true;
+    in->buf = strdup(str);
+    if (in->buf == NULL)
+        utils_fatal_error("strdup: ");
+    in->end = in->cap = strlen(str);
+    return in;
+}
+
+/* Read another chunk into the buffer, return false at end of input */
+static bool
+fill(struct batch_input *in)
+{
+    if (in->eof)
+        return false;
+
+    /* Move the partial line to the front, grow if it fills the buffer */
+    memmove(in->buf, in->buf + in->start, in->end - in->start);
+    in->end -= in->start;
+    in->start = 0;
+    if (in->cap - in->end < CHUNK / 2) {
+        char *buf = realloc(in->buf, in->cap * 2);
+        if (buf == NULL)
+            utils_fatal_error("realloc: ");
+        in->buf = buf;
+        in->cap *= 2;
+    }
+
+    ssize_t n;
+    do {
+        n = read(in->fd, in->buf + in->end, in->cap - in->end);
+    } while (n == -1 && errno == EINTR);
+
+    if (n <= 0) {
+        if (n == -1)
+            utils_error("read: ");
+        in->eof = true;
+        return false;
+    }
+    in->end += n;
+    return true;
+}
+
+/* Return the next line, or NULL at end of input */
+char *
+batch_next_line(struct batch_input *in)
+{
+    size_t scanned = in->start;
+    for (;;) {
+        char *nl = memchr(in->buf + scanned, '\n', in->end - scanned);
+        if (nl) {
+            size_t len = nl - (in->buf + in->start);
+            char *line = strndup(in->buf + in->start, len);
+            in->start += len + 1;
+            return line;
+        }
+        scanned = in->end - in->start;
+        if (!fill(in))
+            break;
+        /* fill() moved the unread data to the front */
+    }
+
+    /* Last line without a trailing newline */
+    if (in->start == in->end)
+        return NULL;
+    char *line = strndup(in->buf + in->start, in->end - in->start);
+    in->start = in->end;
+    return line;
+}
+
+/* Hand read-ahead back to a seekable descriptor */
+void
+batch_sync(struct batch_input *in)
+{
+    if (!in->seekable || in->start == in->end)
+        return;
+
+    off_t ahead = in->end - in->start;
+    if (lseek(in->fd, -ahead, SEEK_CUR) == -1) {
+        in->seekable = false;
+        return;
+    }
+    in->start = in->end = 0;
+    in->eof = false;
+}
+
+/* Release the reader */
+void
+batch_close(struct batch_input *in)
+{
+    if (in->fd > STDIN_FILENO)
+        close(in->fd);
+    free(in->buf);
+    free(in);
+}
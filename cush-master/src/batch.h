@@ -0,0 +1,31 @@
+/**
+ * Line reader for batch mode (`-c`, script files, piped stdin).
+ *
+ * Input is consumed in large chunks instead of through readline,
+ * and each line is returned as a separately allocated string.
+ */
+#include <stdbool.h>
+
+struct batch_input;
+
+/* Read lines from an open file descriptor */
+struct batch_input * batch_open_fd(int fd);
+
+/* Read lines from a string, as given to `-c` */
+struct batch_input * batch_open_string(const char *str);
+
+/**
+ * Return the next line without its trailing newline,
+ * or NULL at end of input. The caller owns the string.
+ */
+char * batch_next_line(struct batch_input *in);
+
+/**
+ * Hand data that was read ahead back to the file descriptor,
+ * so that commands sharing it start reading where the shell
+ * left off. Only possible when the descriptor is seekable.
+ */
+void batch_sync(struct batch_input *in);
+
+/* Release the reader, closing its descriptor unless it is stdin */
+void batch_close(struct batch_input *in);
@@ -0,0 +1,62 @@
+#!/usr/bin/python
+#
+# Tests batch mode: `-c`, script files and piped input
+#
+import atexit, proc_check, time, os, tempfile, testutils
+from testutils import *
+
+console = setup_tests()
+shell = testutils.settings_module.shell
+
+# Run the shell in batch mode from /bin/sh, which stays around
+# to report the exit status and keeps the terminal open
+def run_batch(cmdline):
+    global console
+    console.close(force=True)
+    console = pexpect.spawn("/bin/sh", ["-c", cmdline + '; echo "status=$?"'],
+        drainpty=False)
+    console.timeout = 2
+    return console
+
+#################################################################
+# Test #1:  Running a command string
+#           All commands run, and the last status is returned
+
+run_batch(shell + " -c 'echo first; echo second | tr a-z A-Z; false'")
+console.expect_exact("first\r\nSECOND\r\n")
+console.expect_exact("status=1")
+
+#################################################################
+# Test #2:  Running a script file
+#           Background jobs work, and `exit` sets the status
+
+script, scriptname = tempfile.mkstemp(suffix=".sh")
+os.write(script, "sleep 0 &\nnosuchcommand\necho done\nexit 5\necho never\n")
+os.close(script)
+atexit.register(os.unlink, scriptname)
+
+run_batch(shell + " " + scriptname)
+console.expect("\[1\] \d+")
+console.expect("nosuchcommand: No such file or directory")
+console.expect_exact("done\r\n")
+console.expect_exact("status=5")
+assert "never" not in console.before, "commands after exit were run"
+
+#################################################################
+# Test #3:  Reading commands from a pipe
+#           No prompt is printed, and no history is recorded
+
+run_batch("printf 'echo piped\\nhistory\\necho end\\n' | " + shell)
+console.expect_exact("piped\r\n")
+console.expect_exact("end\r\n")
+assert "cush>" not in console.before, "prompt printed in batch mode"
+assert "echo piped" not in console.before, "history recorded in batch mode"
+console.expect_exact("status=0")
+
+#################################################################
+# Test #4:  `fg` returns the status of the job it waited for
+
+run_batch(shell + " -c 'sh -c \"sleep 0.2; exit 3\" & fg 1'")
+console.expect_exact("status=3")
+
+test_success()
@@ -0,0 +1,99 @@
+#!/usr/bin/python
+#
+# Measures how fast cush launches, reaps, pipes and parses, by
+# feeding it generated scripts in batch mode. Prints one JSON
+# object on stdout, so results can be compared across commits.
+#
+#   bench.py [--quick] [path/to/cush]
+#
+from __future__ import print_function
+import json, os, shutil, subprocess, sys, tempfile, time
+
+args = sys.argv[1:]
+quick = "--quick" in args
+args = [a for a in args if a != "--quick"]
+shell = os.path.abspath(args[0] if args else "./cush")
+scale = 10 if quick else 1
+
+tmpdir = tempfile.mkdtemp("-cush-bench")
+devnull = open(os.devnull, "w")
+
+def script(lines):
+    """Write the lines to a script file and return its path"""
+    path = os.path.join(tmpdir, "script")
+    with open(path, "w") as f:
+        f.write("\n".join(lines) + "\n")
+    return path
+
+def run(lines, flags=[]):
+    """Seconds the shell takes to run the given lines"""
+    path = script(lines)
+    start = time.time()
+    status = subprocess.call([shell] + flags + [path],
+                             stdout=devnull, stderr=devnull)
+    elapsed = time.time() - start
+    if status != 0:
+        sys.exit("bench: %s exited with %d" % (" ".join(lines[:1]), status))
+    return elapsed
+
+def bench_true():
+    n = 2000 // scale
+    seconds = run(["/bin/true"] * n)
+    return {"commands": n, "seconds": seconds, "per_second": n / seconds}
+
+def bench_pipelines():
+    results = []
+    runs = 50 // scale
+    for stages in [1, 2, 4, 8, 16, 32, 64]:
+        line = " | ".join(["/bin/true"] * stages)
+        seconds = run([line] * runs)
+        results.append({"stages": stages, "runs": runs,
+                        "latency_ms": seconds / runs * 1000})
+    return results
+
+def bench_reap():
+    n = 10000 // scale
+    seconds = run(["/bin/true &"] * n + ["wait"])
+    return {"jobs": n, "seconds": seconds, "per_second": n / seconds}
+
+def bench_cat():
+    size = (64 // scale) << 20
+    data = os.path.join(tmpdir, "data")
+    with open(data, "wb") as f:
+        f.write(os.urandom(1 << 20) * (size >> 20))
+    results = []
+    for stages in [1, 4, 16]:
+        line = "cat < %s%s > /dev/null" % (data, " | cat" * (stages - 1))
+        for relay, flags in [(True, ["-R"]), (False, ["-r"])]:
+            seconds = run([line], flags)
+            results.append({"stages": stages, "relay": relay,
+                            "bytes": size, "mb_per_s": size / seconds / 1e6})
+    return results
+
+def bench_parse():
+    words = ["ls", "-l", "\"a quoted word\"", "x.txt", "--flag=value"]
+    lines = []
+    for i in range(20000 // scale):
+        pipe = " | ".join(" ".join(words[:1 + (i + j) % len(words)])
+                          for j in range(1 + i % 4))
+        lines.append(pipe + (" > out.%d" % i if i % 3 == 0 else "")
+                          + (" &" if i % 5 == 0 else " ; echo %d" % i))
+    size = sum(len(l) + 1 for l in lines)
+    seconds = run(lines, ["-n"])
+    return {"lines": len(lines), "bytes": size, "seconds": seconds,
+            "lines_per_second": len(lines) / seconds,
+            "mb_per_s": size / seconds / 1e6}
+
+try:
+    results = {
+        "shell": shell,
+        "quick": quick,
+        "true": bench_true(),
+        "pipeline": bench_pipelines(),
+        "reap": bench_reap(),
+        "cat": bench_cat(),
+        "parse": bench_parse(),
+    }
+finally:
+    shutil.rmtree(tmpdir)
+print(json.dumps(results, indent=2, sort_keys=True))
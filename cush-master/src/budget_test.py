@@ -0,0 +1,69 @@
+#!/usr/bin/python
+#
+# Tests the `limit` prefix and the budgets shown by `jobs`
+#
+import atexit, proc_check, time, os
+from testutils import *
+
+console = setup_tests()
+
+# Ensure that shell prints expected prompt
+no_prompt = "Shell did not print expected prompt (%d)"
+expect_prompt(no_prompt % 0)
+
+def limits(pid):
+    # Soft and hard values of /proc/PID/limits, by name
+    result = {}
+    for line in open("/proc/%d/limits" % pid).readlines()[1:]:
+        words = line[26:].split()
+        result[line[:26].strip()] = (words[0], words[1])
+    return result
+
+#################################################################
+# Test #1:  Processes of the job get the limits, and jobs shows them
+
+sendline("limit -v 64M -t 5 -n 32 sleep 30 &")
+expect("\[(\d+)\] \d+", "background job was not started")
+jid = console.match.group(1)
+expect_prompt(no_prompt % 1)
+
+sendline("jobs -v")
+expect("\tlimits\tas [\d.]+[BKMG]/64.0M\tcputime [\d.]+s/5s\tnofile \d+/32\r\n",
+    "jobs does not show the budget")
+expect("\tstage 1\tpid (\d+)", "jobs -v does not show the process")
+pid = int(console.match.group(1))
+expect_prompt(no_prompt % 2)
+
+got = limits(pid)
+assert got["Max address space"] == ("67108864", "67108864"), "address space"
+assert got["Max cpu time"] == ("5", "6"), "CPU time"
+assert got["Max open files"] == ("32", "32"), "open files"
+
+sendline("kill " + jid)
+expect_prompt(no_prompt % 3)
+
+#################################################################
+# Test #2:  A job over its CPU time is stopped
+
+sendline("limit -t 1 sh -c \"while :; do :; done\"")
+expect_exact("CPU time limit exceeded\r\n", "CPU time is not limited")
+expect_prompt(no_prompt % 4)
+
+#################################################################
+# Test #3:  Cgroup budgets run where the hierarchy allows them
+
+sendline("limit -m 64M -c 50 echo budgeted")
+expect("budgeted\r\n|limit: -m and -c need a cgroup v2 hierarchy",
+    "cgroup budget neither ran nor was refused")
+expect_prompt(no_prompt % 5)
+
+sendline("limit -v 12q echo never")
+expect_exact("limit: bad value 12q for -v\r\n", "sizes are not checked")
+expect_prompt(no_prompt % 6)
+
+sendline("limit -n 32 history")
+expect_exact("limit: history is run by the shell itself\r\n",
+    "budget of a built-in is silently dropped")
+expect_prompt(no_prompt % 7)
+
+test_success()
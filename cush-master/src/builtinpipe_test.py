@@ -0,0 +1,78 @@
+#!/usr/bin/python
+#
+# Tests that built-ins can be stages of a pipeline
+#
+import atexit, proc_check, time, os, tempfile, shutil
+from testutils import *
+
+tmpdir = tempfile.mkdtemp("-cush-builtinpipe-tests")
+atexit.register(shutil.rmtree, tmpdir)
+
+# More history than the default pipe holds
+with open(history_file(), "w") as f:
+    for i in range(100000):
+        f.write("echo entry%d\n" % i)
+
+console = setup_tests()
+
+# Ensure that shell prints expected prompt
+no_prompt = "Shell did not print expected prompt (%d)"
+expect_prompt(no_prompt % 0)
+
+#################################################################
+# Test #1:  A built-in feeds the rest of the pipeline
+
+sendline("history | grep -c entry999[9]")
+expect_exact("11\r\n", "history output did not reach grep")
+expect_prompt(no_prompt % 1)
+
+sendline("history | wc -l")
+expect("\s*100002\r\n", "history output was truncated")
+expect_prompt(no_prompt % 2)
+
+sendline("history 2 | tail -1")
+expect_exact("100003 history 2 | tail -1\r\n", "history length is ignored")
+expect_prompt(no_prompt % 3)
+
+#################################################################
+# Test #2:  Jobs are listed through a pipe, and into a file
+
+sendline("sleep 30 &")
+expect("\[(\d+)\] \d+", "background job was not started")
+jid = console.match.group(1)
+expect_prompt(no_prompt % 4)
+
+sendline("jobs | grep -c sleep")
+expect_exact("1\r\n", "jobs output did not reach grep")
+expect_prompt(no_prompt % 5)
+
+listing = tmpdir + "/jobs"
+sendline("echo ignored | jobs > " + listing)
+expect_prompt(no_prompt % 6)
+assert "sleep 30" in open(listing).read(), "last stage output was lost"
+
+# On its own, too
+os.unlink(listing)
+sendline("jobs > " + listing)
+expect_prompt(no_prompt % 7)
+assert "sleep 30" in open(listing).read(), "jobs ignored its redirection"
+assert "sleep 30" not in console.before, "jobs wrote to the terminal"
+
+history = tmpdir + "/listing"
+sendline("history 1 > " + history)
+expect_prompt(no_prompt % 8)
+assert "history 1 >" in open(history).read(), \
+    "history ignored its redirection"
+
+sendline("kill " + jid)
+expect_prompt(no_prompt % 9)
+
+#################################################################
+# Test #3:  Built-ins that act on the shell refuse to be stages
+
+sendline("cd / | cat")
+expect_exact("cd: cannot be part of a pipeline\r\n",
+    "cd did not refuse to run in a pipeline")
+expect_prompt(no_prompt % 10)
+
+test_success()
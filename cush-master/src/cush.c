@@ -9,98 +9,269 @@
 #include <readline/readline.h>
 #include <setjmp.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
 
 #include "termstate_management.h"
 #include "shell-ast.h"
 #include "utils.h"
 #include "history.h"
 #include "custom_prompt.h"
+#include "batch.h"
 #include "processes/jobs.h"
 #include "processes/launch.h"
+#include "processes/builtins.h"
 #include "processes/handlers.h"
+#include "processes/relay.h"
 
 /* Global for keeping track of whether the prompt is custom */
 bool custom = false;
 
+/* Only parse command lines, do not run them (-n) */
+static bool noexec;
+
 
 static void
 usage(char *progname)
 {
-    printf("Usage: %s -h\n"
-        " -h            print this help\n",
+    printf("Usage: %s [-hFnerR] [-c command | script]\n"
+        " -h            print this help\n"
+        " -c command    run the given command line(s) and exit\n"
+        " -n            parse the command lines without running them\n"
+        " -F            launch commands with fork() instead of posix_spawn()\n"
+        " -e            reap children from an event loop instead of a"
+        " SIGCHLD handler\n"
+        " -r            never run `cat` stages as an in-kernel relay\n"
+        " -R            relay every `cat` stage, even from/to a terminal\n",
         progname);
 
     exit(EXIT_SUCCESS);
 }
 
-/* Build a prompt */
-static char *
+/* Build a prompt, valid until the next one */
+static const char *
 build_prompt(bool newline)
 {
     if(custom){
         return buildCustomPrompt(newline);
     }
     else{
-        return newline ? strdup("\ncush> ") : strdup("cush> ");
+        return newline ? "\ncush> " : "cush> ";
+    }
+}
+
+/* Parse and run one line of input. Takes ownership of cmdline. */
+static void
+eval(char *cmdline, bool interactive)
+{
+    /* Attempt to parse event designators */
+    if (interactive) {
+        cmdline = try_event(cmdline);
+        history_add(cmdline);
+    }
+    struct ast_command_line * cline = ast_parse_command_line(cmdline);
+    free (cmdline);
+    if (cline == NULL)                  /* Error in command line */
+        return;
+
+    if (list_empty(&cline->pipes)       /* User hit enter */
+        || noexec) {
+        ast_command_line_free(cline);
+        return;
     }
+
+    launch_command_line(cline);
+    ast_command_line_free(cline);
 }
 
 
 /* Globals for jumping */
-char * prompt;
 sigjmp_buf prompt_jump;
 volatile sig_atomic_t prompt_jump_active;
 
-int
-main(int ac, char *av[])
+/* Read/eval loop driven by blocking readline() calls */
+static void
+readline_loop(void)
 {
-    int opt;
-
-    /* Process command-line arguments. See getopt(3) */
-    while ((opt = getopt(ac, av, "h")) > 0) {
-        switch (opt) {
-        case 'h':
-            usage(av[0]);
-            break;
-        }
-    }
-
-    history_init();
-    jobs_init();
-    termstate_init();
     handlers_init();
 
-    /* Read/eval loop. */
     for (;;) {
         termstate_give_terminal_back_to_shell();
+        delete_jobs(true);      /* Report finished background jobs */
         bool newline = sigsetjmp(prompt_jump, true);
         if (!newline) prompt_jump_active = true;
 
         /* Do not output a prompt unless shell's stdin is a terminal */
-        prompt = isatty(0) ? build_prompt(newline) : NULL;
+        const char * prompt = isatty(0) ? build_prompt(newline) : NULL;
         char * cmdline = readline(prompt);
-        free (prompt);
-
 
         if (cmdline == NULL)  /* User typed EOF */
             break;
 
-        /* Attempt to parse event designators */
-        cmdline = try_event(cmdline);
-        history_add(cmdline);
-        struct ast_command_line * cline = ast_parse_command_line(cmdline);
-        free (cmdline);
-        if (cline == NULL)                  /* Error in command line */
-            continue;
-
-        if (list_empty(&cline->pipes)) {    /* User hit enter */
-            ast_command_line_free(cline);
-            continue;
+        eval(cmdline, true);
+    }
+}
+
+/* Event loop state shared with the readline line handler */
+static bool event_loop_done;
+static void line_handler(char *cmdline);
+
+/* Show a fresh prompt and wait for the next line */
+static void
+install_prompt(bool newline)
+{
+    termstate_give_terminal_back_to_shell();
+    delete_jobs(true);          /* Report finished background jobs */
+    const char * prompt = isatty(0) ? build_prompt(newline) : NULL;
+    rl_callback_handler_install(prompt, line_handler);
+}
+
+/* Called by readline once a full line has been read */
+static void
+line_handler(char *cmdline)
+{
+    rl_callback_handler_remove();
+    if (cmdline == NULL) {  /* User typed EOF */
+        event_loop_done = true;
+        return;
+    }
+    eval(cmdline, true);
+    install_prompt(false);
+}
+
+/**
+ * Read/eval loop driven by epoll. Readline input and child status
+ * changes (through a signalfd) are multiplexed, so children are
+ * reaped synchronously here rather than in a signal handler.
+ */
+static void
+event_loop(void)
+{
+    int sigfd = handlers_init_event_loop();
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+        utils_fatal_error("epoll_create1: ");
+
+    int fds[] = { fileno(rl_instream ? rl_instream : stdin), sigfd };
+    for (int i = 0; i < 2; i++) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.fd = fds[i] };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev) == -1)
+            utils_fatal_error("epoll_ctl: ");
+    }
+
+    install_prompt(false);
+    while (!event_loop_done) {
+        struct epoll_event events[2];
+        int n = epoll_wait(epfd, events, 2, -1);
+        if (n == -1 && errno != EINTR)
+            utils_fatal_error("epoll_wait: ");
+
+        /* ^C at the prompt: discard the line and start over */
+        if (prompt_interrupted) {
+            prompt_interrupted = false;
+            rl_free_line_state();
+            rl_callback_sigcleanup();
+            rl_replace_line("", 0);
+            rl_callback_handler_remove();
+            install_prompt(true);
         }
 
-        delete_jobs();
-        launch_command_line(cline);
-        ast_command_line_free(cline);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == sigfd)
+                handlers_reap_events(sigfd);
+            else
+                rl_callback_read_char();
+        }
+    }
+    rl_callback_handler_remove();
+    close(epfd);
+    close(sigfd);
+}
+
+/**
+ * Run command lines without a terminal, as under cron or from a
+ * pipe. No terminal or history setup, and no prompt. Returns the
+ * status of the last command.
+ */
+static int
+batch_loop(struct batch_input *in)
+{
+    handlers_init_batch();
+
+    char * cmdline;
+    while ((cmdline = batch_next_line(in)) != NULL) {
+        handlers_reap();        /* Collect finished background jobs */
+        delete_jobs(false);     /* and free them */
+        batch_sync(in);         /* Commands may read the same input */
+        eval(cmdline, false);
+        fflush(stdout);         /* Not line buffered without a tty */
+    }
+    batch_close(in);
+    return launch_last_status;
+}
+
+int
+main(int ac, char *av[])
+{
+    int opt;
+    bool use_event_loop = false;
+    char *command = NULL;
+
+    /* Process command-line arguments. See getopt(3) */
+    while ((opt = getopt(ac, av, "hFnerRc:")) > 0) {
+        switch (opt) {
+        case 'h':
+            usage(av[0]);
+            break;
+        case 'F':
+            launch_force_fork = true;
+            break;
+        case 'n':
+            noexec = true;
+            break;
+        case 'e':
+            use_event_loop = true;
+            break;
+        case 'r':
+            relay_mode = RELAY_NEVER;
+            break;
+        case 'R':
+            relay_mode = RELAY_ALWAYS;
+            break;
+        case 'c':
+            command = optarg;
+            break;
+        }
+    }
+
+    jobs_init();
+    builtins_init();
+    initPrompt();
+
+    /* Batch mode: a command string, a script file or piped input */
+    struct batch_input *in = NULL;
+    if (command) {
+        in = batch_open_string(command);
+    }
+    else if (optind < ac) {
+        int fd = open(av[optind], O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            utils_fatal_error("%s: ", av[optind]);
+        in = batch_open_fd(fd);
     }
+    else if (!isatty(STDIN_FILENO)) {
+        in = batch_open_fd(STDIN_FILENO);
+    }
+    if (in)
+        return batch_loop(in);
+
+    history_init();
+    termstate_init();
+
+    if (use_event_loop)
+        event_loop();
+    else
+        readline_loop();
     return 0;
 }
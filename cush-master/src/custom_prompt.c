@@ -1,42 +1,222 @@
-/**
- * Functionality for building a shell prompt
- * that includes the current host and working directory.
- */
-#include <stdio.h>
-#include <stdlib.h>
-#include <unistd.h>
-#include <string.h>
-
-#include "custom_prompt.h"
-#include "utils.h"
-
-/* Turn the prompt on/off */
-void togglePrompt(void) {
-    custom = !custom;
-}
-
-/* Generate a custom prompt */
-char* buildCustomPrompt(bool newline){
-    //get the host name into dynamically allocated string
-    char* hostBuff = malloc(sizeof(char)*256);
-    gethostname(hostBuff, sizeof(char)*257);
-    char* host = strdup(hostBuff);
-    free(hostBuff);
-    //get the cwd name into a dynamically allocated string
-    char* cwdBuff = malloc(sizeof(char)*256);
-    //previously had a weird issue with cwd, if statement here for testing
-    if(getcwd(cwdBuff, sizeof(char)*257) == NULL) {
-        utils_error("getcwd : ");
-    }
-    char* cwd = strdup(cwdBuff);
-
-    //format the custom prompt and return it as a dynamically allocated string
-    char* str = malloc(sizeof(char)*256);
-    if(newline){
-        snprintf(str, 258, "\nhost[%s] in: %s>", host, cwd);
-    }
-    else{
-        snprintf(str, 258, "host[%s] in: %s>", host, cwd);
-    }
-    return str;
-}
\ No newline at end of file
+/**
+ * Functionality for building a shell prompt
+ * that includes the current host and working directory.
+ *
+ * The format is compiled once into a list of pieces, and each
+ * prompt is rendered into the same buffer. The host name is looked
+ * up at startup, and the working directory is followed through the
+ * `cd` built-in instead of asking the kernel every time.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+
+#include "custom_prompt.h"
+#include "utils.h"
+#include "processes/jobs.h"
+#include "processes/launch.h"
+
+#define DEFAULT_FORMAT "host[\\h] in: \\w>"
+
+/* What a piece of the format expands to */
+enum piece_kind { LITERAL, HOST, CWD, CWD_BASE, STATUS, JOBS, DURATION };
+
+struct piece {
+    enum piece_kind kind;
+    const char *text;           /* LITERAL only, within literals */
+    size_t len;
+};
+
+static struct piece *pieces;    /* The compiled format */
+static int num_pieces;
+static char *literals;          /* Text of the format, escapes resolved */
+
+static char host[HOST_NAME_MAX + 1];
+static char *cwd;               /* NULL if unknown */
+
+static char *buf;               /* Rendered prompt, reused */
+static size_t buf_len, buf_cap;
+
+/* Look up what is cached, and compile the default format */
+void initPrompt(void) {
+    if (gethostname(host, sizeof host) == -1)
+        strcpy(host, "?");
+    host[sizeof host - 1] = '\0';
+    cwd = getcwd(NULL, 0);
+    setPromptFormat(DEFAULT_FORMAT);
+}
+
+/* Turn the prompt on/off */
+void togglePrompt(void) {
+    custom = !custom;
+}
+
+/* Compile a format, or leave the current one if it is not valid */
+bool setPromptFormat(const char *format) {
+    size_t n = strlen(format);
+    struct piece *p = malloc((n + 1) * sizeof *p);
+    char *text = malloc(n + 1);
+    if (p == NULL || text == NULL)
+        utils_fatal_error("prompt: ");
+    int count = 0;
+    char *t = text;
+
+    for (const char *f = format; *f; f++) {
+        enum piece_kind kind = LITERAL;
+        char c = *f;
+        if (c == '\\') {
+            switch (*++f) {
+                case 'h':  kind = HOST;     break;
+                case 'w':  kind = CWD;      break;
+                case 'W':  kind = CWD_BASE; break;
+                case '?':  kind = STATUS;   break;
+                case 'j':  kind = JOBS;     break;
+                case 'D':  kind = DURATION; break;
+                case 'n':  c = '\n';        break;
+                case '\\': c = '\\';        break;
+                default:
+                    fprintf(stderr, "custom: unknown escape \\%.1s\n", f);
+                    free(p);
+                    free(text);
+                    return false;
+            }
+        }
+
+        if (kind != LITERAL)
+            p[count++] = (struct piece) { .kind = kind };
+        else if (count > 0 && p[count - 1].kind == LITERAL)
+            p[count - 1].len++;     /* Extend the previous literal */
+        else
+            p[count++] = (struct piece) { .kind = LITERAL, .text = t, .len = 1 };
+        if (kind == LITERAL)
+            *t++ = c;
+    }
+
+    free(pieces);
+    free(literals);
+    pieces = p;
+    num_pieces = count;
+    literals = text;
+    return true;
+}
+
+/* Add to the prompt being rendered */
+static void append(const char *s, size_t len) {
+    if (buf_len + len + 1 > buf_cap) {
+        buf_cap = (buf_len + len + 1) * 2;
+        buf = realloc(buf, buf_cap);
+        if (buf == NULL)
+            utils_fatal_error("prompt: ");
+    }
+    memcpy(buf + buf_len, s, len);
+    buf_len += len;
+}
+
+/* Generate a custom prompt, valid until the next one */
+const char* buildCustomPrompt(bool newline){
+    char num[32];
+    const char *s;
+    int len;
+
+    buf_len = 0;
+    if (newline)
+        append("\n", 1);
+    for (int i = 0; i < num_pieces; i++) {
+        switch (pieces[i].kind) {
+            case LITERAL:
+                append(pieces[i].text, pieces[i].len);
+                break;
+            case HOST:
+                append(host, strlen(host));
+                break;
+            case CWD:
+                s = cwd ? cwd : "?";
+                append(s, strlen(s));
+                break;
+            case CWD_BASE:
+                s = cwd ? cwd : "?";
+                if (strcmp(s, "/") != 0)
+                    s = strrchr(s, '/') ? strrchr(s, '/') + 1 : s;
+                append(s, strlen(s));
+                break;
+            case STATUS:
+                len = snprintf(num, sizeof num, "%d", launch_last_status);
+                append(num, len);
+                break;
+            case JOBS:
+                len = snprintf(num, sizeof num, "%d", count_jobs());
+                append(num, len);
+                break;
+            case DURATION:
+                len = snprintf(num, sizeof num, "%.3f", launch_last_duration);
+                append(num, len);
+                break;
+        }
+    }
+    append("", 1);
+    return buf;
+}
+
+/* Drop "." and "//", and resolve ".." in an absolute path, in place */
+static void normalize(char *path) {
+    char *out = path;
+    for (char *in = path; *in; ) {
+        while (*in == '/')
+            in++;
+        char *end = strchrnul(in, '/');
+        size_t len = end - in;
+        if (len == 0 || (len == 1 && in[0] == '.')) {
+            /* Nothing to add */
+        }
+        else if (len == 2 && in[0] == '.' && in[1] == '.') {
+            while (out > path && *--out != '/')
+                ;
+        }
+        else {
+            *out++ = '/';
+            memmove(out, in, len);
+            out += len;
+        }
+        in = end;
+    }
+    if (out == path)
+        *out++ = '/';
+    *out = '\0';
+}
+
+/**
+ * Change the working directory, following the path from the
+ * current one like `cd -L` does. Falls back to what the kernel
+ * says if that path does not lead there, e.g. after a symlink.
+ */
+bool changeDirectory(const char *dir) {
+    char *path = NULL;
+    if (dir[0] == '/')
+        path = strdup(dir);
+    else if (cwd && asprintf(&path, "%s/%s", cwd, dir) == -1)
+        path = NULL;
+
+    if (path) {
+        normalize(path);
+        if (chdir(path) == -1) {
+            free(path);
+            path = NULL;
+        }
+    }
+    if (path == NULL) {
+        if (chdir(dir) == -1)
+            return false;
+        path = getcwd(NULL, 0);
+    }
+
+    if (cwd)
+        setenv("OLDPWD", cwd, 1);
+    if (path)
+        setenv("PWD", path, 1);
+    free(cwd);
+    cwd = path;
+    return true;
+}
@@ -1,15 +1,31 @@
-#include <stdbool.h>
-
-/* Flag of whether the prompt is enabled */
-extern bool custom;
-
-/**
- * Check if the given command is a built-in,
- * and perform appropriate actions if it is.
- */
-void togglePrompt(void);
-
-/**
- * Dynamically allocate a custom prompt.
- */
-char* buildCustomPrompt(bool newline);
\ No newline at end of file
+#include <stdbool.h>
+
+/* Flag of whether the prompt is enabled */
+extern bool custom;
+
+/* Cache the host name and working directory; call once at startup */
+void initPrompt(void);
+
+/**
+ * Check if the given command is a built-in,
+ * and perform appropriate actions if it is.
+ */
+void togglePrompt(void);
+
+/**
+ * Use the given format for the custom prompt. Besides text, it can
+ * contain \h (host name), \w (working directory), \W (its last
+ * component), \? (status of the last command), \j (number of jobs),
+ * \D (seconds the last command line took), \n and \\.
+ * Returns false and keeps the current format if format is invalid.
+ */
+bool setPromptFormat(const char *format);
+
+/**
+ * Render the custom prompt into a buffer that is reused by the
+ * next call.
+ */
+const char* buildCustomPrompt(bool newline);
+
+/* Change the working directory, as the `cd` built-in; false on error */
+bool changeDirectory(const char *dir);
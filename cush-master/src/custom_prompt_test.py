@@ -41,4 +41,37 @@ expect_exact(greeting, "can't execute commands at the custom prompt")
 sendline("custom")
 expect_prompt(no_prompt % 1)
 
+#################################################################
+# Test #4:  A format of one's own
+#           Check the escapes for the directory and last status
+
+base = os.path.basename(os.getcwd())
+sendline(r'custom "[\W \?]$ "')
+expect_exact("[%s 0]$ " % base, "custom format is not used")
+
+sendline('sh -c "exit 3"')
+expect_exact("[%s 3]$ " % base, "exit status is not shown")
+
+#################################################################
+# Test #5:  Changing directories
+#           Check that `cd` is followed by the prompt
+
+sendline("cd /tmp")
+expect_exact("[tmp 0]$ ", "cd is not reflected in the prompt")
+sendline("cd ..")
+expect_exact("[/ 0]$ ", "cd .. is not reflected in the prompt")
+sendline("cd -")
+expect_exact("/tmp\r\n", "cd - does not print the directory")
+expect_exact("[tmp 0]$ ", "cd - does not go back")
+sendline("cd /nonexistent-cush-dir")
+expect_exact("No such file or directory", "cd does not report errors")
+expect_exact("[tmp 1]$ ", "failed cd does not set the status")
+
+#################################################################
+# Test #6:  Rejecting an unknown escape
+
+sendline(r'custom "\q"')
+expect_exact("unknown escape", "unknown escape is accepted")
+expect_exact("[tmp 2]$ ", "format changed despite an error")
+
 test_success()
\ No newline at end of file
@@ -1,3 +1,14 @@
 = Tests for Custom Features
 8 custom_prompt_test.py
 12 history_test.py
+5 histstore_test.py
+5 batch_test.py
+5 hash_test.py
+5 relay_test.py
+5 time_test.py
+5 parallel_test.py
+5 done_test.py
+5 termstate_test.py
+5 builtinpipe_test.py
+5 pin_test.py
+5 budget_test.py
@@ -0,0 +1,52 @@
+#!/usr/bin/python
+#
+# Tests that finished background jobs are reported at the next prompt
+#
+import atexit, proc_check, time, os
+from testutils import *
+
+console = setup_tests()
+
+# Ensure that shell prints expected prompt
+no_prompt = "Shell did not print expected prompt (%d)"
+expect_prompt(no_prompt % 0)
+
+#################################################################
+# Test #1:  A finished background job is reported once
+
+sendline("sleep 0.2 &")
+expect("\[(\d+)\] \d+", "background job was not started")
+jid = console.match.group(1)
+expect_prompt(no_prompt % 1)
+time.sleep(0.5)
+sendline("")
+expect("\[%s\]\tDone\t\t\(sleep 0.2\)\r\n" % jid, "finished job was not reported")
+expect_prompt(no_prompt % 2)
+sendline("")
+expect_prompt(no_prompt % 3)
+assert "Done" not in console.before, "finished job reported twice"
+
+#################################################################
+# Test #2:  A failing job is reported with its exit status
+
+sendline('sh -c "exit 3" &')
+expect("\[(\d+)\] \d+", "background job was not started")
+jid = console.match.group(1)
+expect_prompt(no_prompt % 4)
+time.sleep(0.5)
+sendline("")
+expect("\[%s\]\tExit 3\t\t\(sh -c exit 3\)\r\n" % jid, "exit status was not reported")
+expect_prompt(no_prompt % 5)
+
+#################################################################
+# Test #3:  Foreground jobs are not reported, and ids are reused
+
+sendline("echo fg")
+expect_exact("fg\r\n", "foreground job does not run")
+expect_prompt(no_prompt % 6)
+assert "Done" not in console.before, "foreground job was reported"
+sendline("sleep 0.1 &")
+expect("\[1\] \d+", "job id of deleted jobs was not reused")
+expect_prompt(no_prompt % 7)
+
+test_success()
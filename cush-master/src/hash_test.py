@@ -0,0 +1,96 @@
+#!/usr/bin/python
+#
+# Tests the functionality of the `hash` built-in
+#
+import atexit, proc_check, time, os, tempfile, shutil
+from testutils import *
+
+# A program of our own, found through $PATH
+tmpdir = tempfile.mkdtemp("-cush-hash-tests")
+atexit.register(shutil.rmtree, tmpdir)
+prog = "cushhashprog"
+shutil.copy("/bin/echo", tmpdir + "/" + prog)
+os.environ["PATH"] = tmpdir + ":" + os.environ["PATH"] + ":"
+
+console = setup_tests()
+
+# Ensure that shell prints expected prompt
+no_prompt = "Shell did not print expected prompt (%d)"
+expect_prompt(no_prompt % 0)
+
+#################################################################
+# Test #1:  Running commands records their paths
+
+sendline("hash")
+expect_exact("hash table empty", "hash table does not start empty")
+expect_prompt(no_prompt % 1)
+
+sendline("echo hashed | cat")
+expect_exact("hashed\r\n", "pipeline does not run")
+expect_prompt(no_prompt % 2)
+
+sendline("hash")
+expect("hits\tcommand\r\n")
+expect("\s+1\t\S*/cat\r\n")
+expect_prompt(no_prompt % 3)
+
+#################################################################
+# Test #2:  A stale entry is dropped when exec fails
+
+sendline("hash -r")
+expect_prompt(no_prompt % 4)
+sendline("hash " + prog)
+expect_prompt(no_prompt % 5)
+sendline(prog + " first")
+expect_exact("first\r\n", "hashed program does not run")
+expect_prompt(no_prompt % 6)
+sendline("hash")
+expect(tmpdir + "/" + prog, "program was not hashed")
+expect_prompt(no_prompt % 7)
+
+os.unlink(tmpdir + "/" + prog)
+sendline(prog + " second")
+expect("No such file or directory", "removed program still runs")
+expect_prompt(no_prompt % 8)
+
+#################################################################
+# Test #3:  Clearing the table
+
+sendline("hash")
+expect_exact("hash table empty", "stale entry was not dropped")
+expect_prompt(no_prompt % 9)
+
+sendline("echo refill")
+expect_prompt(no_prompt % 10)
+sendline("hash -r")
+expect_prompt(no_prompt % 11)
+sendline("hash")
+expect_exact("hash table empty", "hash -r does not clear the table")
+expect_prompt(no_prompt % 12)
+
+#################################################################
+# Test #4:  A script without a #! line is run by /bin/sh
+
+script = tmpdir + "/cushhashscript"
+with open(script, "w") as f:
+    f.write("echo script says $1\n")
+os.chmod(script, 0755)
+sendline("cushhashscript hello")
+expect_exact("script says hello\r\n", "script without #! does not run")
+expect_prompt(no_prompt % 13)
+
+#################################################################
+# Test #5:  An empty $PATH entry means the current directory
+
+os.mkdir(tmpdir + "/cwd")
+script = tmpdir + "/cwd/cushhashcwd"
+with open(script, "w") as f:
+    f.write("#!/bin/sh\necho found in cwd\n")
+os.chmod(script, 0755)
+sendline("cd " + tmpdir + "/cwd")
+expect_prompt(no_prompt % 14)
+sendline("cushhashcwd")
+expect_exact("found in cwd\r\n", "empty $PATH entry is not searched")
+expect_prompt(no_prompt % 15)
+
+test_success()
@@ -1,70 +1,108 @@
 /**
- * Call GNU History library and keep track of entered commands.
+ * Keep track of entered commands in a persistent store (see
+ * histstore.h), and mirror recent ones into the GNU History
+ * library for readline's line editing.
  * Also detect and parse event designators.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <readline/history.h>
 #include <string.h>
 
 #include "history.h"
+#include "histstore.h"
+#include "utils.h"
 
-/* Initialize an empty history */
+/* Entries handed to readline at startup, for the arrow keys */
+#define RECENT 1000
+
+/* Initialize the history from $HISTFILE, by default ~/.cush_history */
 void history_init(void) {
-    void using_history (void);
+    using_history();
+
+    char *path = NULL;
+    const char *file = getenv("HISTFILE");
+    const char *home = getenv("HOME");
+    if (file) {
+        if (*file)              /* Empty: do not keep a history file */
+            path = strdup(file);
+    }
+    else if (home && asprintf(&path, "%s/.cush_history", home) == -1) {
+        path = NULL;
+    }
+    histstore_open(path);
+    free(path);
+
+    int count = histstore_count();
+    for (int i = count > RECENT ? count - RECENT + 1 : 1; i <= count; i++) {
+        size_t len;
+        const char *entry = histstore_get(i, &len);
+        if (entry == NULL)
+            continue;
+        char *line = strndup(entry, len);
+        if (line == NULL)
+            utils_fatal_error("history: ");
+        add_history(line);
+        free(line);
+    }
 }
 
 /* Add a command to the current history */
 void history_add(const char * cmdline) {
     add_history(cmdline);
+    histstore_append(cmdline);
 }
 
 /* Iterate and print the history */
 void history_print(int length) {
-    register HIST_ENTRY **list;
-    register int i;
+    int count = histstore_count();
+    if (count == 0)
+        return;         /* Nothing recorded, e.g. in batch mode */
 
-    /* Retrieve history */
-    list = history_list();
-    if (!list)
-        printf("Could not retrieve history\n");
-    
     /* Determine where to begin */
-    i = length < 0 ? 0 :
-        history_length > length ? history_length - length : 0;
+    int i = length < 0 ? 1 :
+        count > length ? count - length + 1 : 1;
 
     /* Iterate until completion */
-    for (; list[i]; i++)
-        printf("%5d %s\n", i+1, list[i]->line);
+    for (; i <= count; i++) {
+        size_t len;
+        const char *entry = histstore_get(i, &len);
+        if (entry != NULL)
+            printf("%5d %.*s\n", i, (int) len, entry);
+    }
+}
+
+/* Copy entry n of the history, or return NULL */
+static char * copy_entry(int n) {
+    size_t len;
+    const char *entry = histstore_get(n, &len);
+    return entry ? strndup(entry, len) : NULL;
 }
 
 /* Check for an event designator pattern */
 char * try_event(char * str) {
-    char * result;
+    char * result = NULL;
     switch(str[0]) {
         case '!':;
-            /* Attempt to parse as index */
+            /* Attempt to parse as index, counting back if negative */
             char *end;
             int idx = strtol(str + 1, &end, 10);
             if (str + 1 != end) {
-                HIST_ENTRY * hist = NULL;
-                for (; idx <= history_length; idx += history_length + 1) {
-                    if (history_base <= idx)
-                        hist = history_get(idx);
-                }
-                if (hist) {
-                    result = strdup(hist->line);
+                if (idx < 0)
+                    idx += histstore_count() + 1;
+                result = copy_entry(idx);
+                if (result)
                     break;
-                }
             }
             /* Attempt to get by name */
-            if (history_search_prefix(str + 1, -1) == -1)
+            result = copy_entry(histstore_find_prefix(str + 1));
+            if (!result)
                 return str;
-            result = strdup(current_history()->line);
             break;
         default:
             return str;
     }
     free(str);
     return result;
-}
\ No newline at end of file
+}
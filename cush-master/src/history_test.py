@@ -5,6 +5,7 @@
 import atexit, proc_check, time
 from testutils import *
 
+# Starts from an empty history file, so numbering starts at 1
 console = setup_tests()
 
 # For generating random strings
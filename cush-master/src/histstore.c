@@ -0,0 +1,520 @@
+/**
+ * Persistent command history, shared by concurrent shells.
+ *
+ * The log holds one command per line and is only ever appended to,
+ * under an exclusive flock() so that lines of concurrent shells do
+ * not interleave. The index file is laid out as
+ *   struct index_header | uint64_t offsets[entry_cap] | nodes[node_cap]
+ * where offsets[i] is the start of entry i+1 in the log, and the
+ * nodes form a ternary search tree over the first MAX_DEPTH bytes
+ * of every entry. Each node remembers the latest entry that passes
+ * through it, so `!prefix` costs one walk down the tree. A part of
+ * the tree that only a single key goes through is not spelled out
+ * byte by byte: a tail node stands for the rest of that key, which
+ * is read from the log, and is split once another key diverges.
+ *
+ * The index is a cache of the log. Whoever holds the lock indexes
+ * lines appended since the last time. Running out of nodes grows
+ * the file in place; running out of offsets, or finding the index
+ * unusable, rebuilds it at twice the size under a temporary name
+ * that is renamed into place. Other shells notice the new size or
+ * inode and map the index again.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "histstore.h"
+#include "utils.h"
+
+#define MAGIC       0x68737563      /* "cush" */
+#define VERSION     1
+#define MAX_DEPTH   64              /* Longest prefix kept in the tree */
+#define MIN_ENTRIES 1024
+
+struct index_header {
+    uint32_t magic, version;
+    uint64_t log_size;              /* Bytes of the log indexed so far */
+    uint64_t log_ino;               /* Inode of the log that was indexed */
+    uint32_t count, entry_cap;      /* Entries indexed, room for entries */
+    uint32_t node_count, node_cap;  /* Nodes used (node 0 is unused), room */
+    uint32_t root;                  /* Root of the tree, 0 if empty */
+    uint32_t unused;
+};
+
+/* Node of a ternary search tree */
+struct node {
+    uint32_t lo, eq, hi;            /* Children, 0 for none */
+    uint32_t latest;                /* Latest entry with this prefix */
+    unsigned char c;
+    bool tail;                      /* Stands for the rest of latest */
+};
+
+static int log_fd = -1;
+static ino_t log_ino;
+static const char *log_map;         /* Read-only view of the whole log */
+static size_t log_len;
+
+static char *idx_path;              /* NULL for an in-memory history */
+static int idx_fd = -1;
+static ino_t idx_ino;
+static struct index_header *hdr;
+static size_t idx_len;
+static uint64_t *offsets;
+static struct node *nodes;
+
+/* Size of an index file with the given capacities */
+static size_t
+index_size(uint32_t entry_cap, uint32_t node_cap)
+{
+    return sizeof *hdr + entry_cap * sizeof *offsets
+        + node_cap * sizeof *nodes;
+}
+
+static void
+unmap_index(void)
+{
+    if (hdr)
+        munmap(hdr, idx_len);
+    if (idx_fd != -1)
+        close(idx_fd);
+    hdr = NULL;
+    idx_fd = -1;
+}
+
+/* Switch to the index in fd, return false if it is not valid */
+static bool
+map_index(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof *hdr)
+        return false;
+
+    void *p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        fd, 0);
+    if (p == MAP_FAILED)
+        return false;
+
+    struct index_header *h = p;
+    if (h->magic != MAGIC || h->version != VERSION
+        || index_size(h->entry_cap, h->node_cap) != (size_t) st.st_size
+        || h->count > h->entry_cap || h->node_count > h->node_cap
+        || h->node_count == 0) {
+        munmap(p, st.st_size);
+        return false;
+    }
+
+    unmap_index();
+    idx_fd = fd;
+    idx_ino = st.st_ino;
+    idx_len = st.st_size;
+    hdr = h;
+    offsets = (uint64_t *) (hdr + 1);
+    nodes = (struct node *) (offsets + hdr->entry_cap);
+    return true;
+}
+
+/* Make the view of the log cover all of it */
+static bool
+map_log(void)
+{
+    struct stat st;
+    if (fstat(log_fd, &st) == -1)
+        return false;
+    if ((size_t) st.st_size == log_len)
+        return true;
+
+    if (log_map)
+        munmap((void *) log_map, log_len);
+    log_map = NULL;
+    log_len = 0;
+    if (st.st_size == 0)
+        return true;
+
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, log_fd, 0);
+    if (p == MAP_FAILED)
+        return false;
+    log_map = p;
+    log_len = st.st_size;
+    return true;
+}
+
+/* Start of indexed entry n, and how many of its bytes are keyed */
+static const unsigned char *
+entry_key(uint32_t n, size_t *depth)
+{
+    const char *start = log_map + offsets[n - 1];
+    const char *nl = memchr(start, '\n', log_map + log_len - start);
+    *depth = nl - start < MAX_DEPTH ? nl - start : MAX_DEPTH;
+    return (const unsigned char *) start;
+}
+
+static uint32_t
+new_node(struct node node)
+{
+    uint32_t k = hdr->node_count++;
+    nodes[k] = node;
+    return k;
+}
+
+/**
+ * Add the entry at the given offset of the log to the index. This
+ * takes at most MAX_DEPTH + 1 new nodes.
+ */
+static void
+index_entry(uint64_t off)
+{
+    uint32_t number = hdr->count + 1;
+    offsets[number - 1] = off;
+
+    size_t depth;
+    const unsigned char *s = entry_key(number, &depth);
+    uint32_t *link = &hdr->root;
+    for (size_t i = 0; i < depth; ) {
+        if (*link == 0) {
+            *link = new_node((struct node) { .latest = number, .tail = true });
+            break;
+        }
+
+        struct node *n = &nodes[*link];
+        if (n->tail) {
+            size_t tdepth;
+            const unsigned char *t = entry_key(n->latest, &tdepth);
+            if (tdepth == depth && memcmp(t + i, s + i, depth - i) == 0) {
+                n->latest = number;     /* Same key, newer entry */
+                break;
+            }
+
+            /* Spell out one byte of the tail, and look again */
+            uint32_t latest = n->latest, rest = 0;
+            if (i + 1 < tdepth)
+                rest = new_node((struct node) { .latest = latest, .tail = true });
+            *n = (struct node) { .eq = rest, .latest = latest, .c = t[i] };
+        }
+
+        if (s[i] < n->c)
+            link = &n->lo;
+        else if (s[i] > n->c)
+            link = &n->hi;
+        else {
+            n->latest = number;
+            link = &n->eq;
+            i++;
+        }
+    }
+
+    /* Readers without the lock rely on the offset being there first */
+    __atomic_store_n(&hdr->count, number, __ATOMIC_RELEASE);
+}
+
+/* Double the room for nodes, which sit at the end of the index */
+static bool
+grow_nodes(void)
+{
+    uint32_t cap = hdr->node_cap * 2;
+    int fd = fcntl(idx_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd == -1 || ftruncate(fd, index_size(hdr->entry_cap, cap)) == -1) {
+        if (fd != -1)
+            close(fd);
+        return false;
+    }
+    hdr->node_cap = cap;
+    if (!map_index(fd)) {
+        close(fd);
+        return false;
+    }
+    return true;
+}
+
+/* Index the lines appended since last time, false if out of room */
+static bool
+index_log(void)
+{
+    while (hdr->log_size < log_len) {
+        const char *start = log_map + hdr->log_size;
+        const char *nl = memchr(start, '\n', log_len - hdr->log_size);
+        if (nl == NULL)
+            break;              /* Torn line of a shell that crashed */
+
+        if (hdr->count == hdr->entry_cap)
+            return false;
+        if (hdr->node_count + MAX_DEPTH + 1 > hdr->node_cap && !grow_nodes())
+            return false;
+
+        index_entry(hdr->log_size);
+        hdr->log_size += nl - start + 1;
+    }
+    return true;
+}
+
+/* Index the whole log anew, with room for it to double */
+static bool
+rebuild_index(void)
+{
+    size_t entries = 0;
+    const char *end = log_map + log_len, *nl;
+    for (const char *p = log_map; p < end
+         && (nl = memchr(p, '\n', end - p)) != NULL; p = nl + 1)
+        entries++;
+    uint32_t entry_cap = entries * 2 > MIN_ENTRIES ? entries * 2 : MIN_ENTRIES;
+    uint32_t node_cap = entry_cap * 2;  /* Grown in place as needed */
+
+    /* Built under a temporary name, so readers never see it half done */
+    char *tmp = NULL;
+    int fd;
+    if (idx_path) {
+        if (asprintf(&tmp, "%s.XXXXXX", idx_path) == -1)
+            return false;
+        fd = mkostemp(tmp, O_CLOEXEC);
+    }
+    else {
+        fd = memfd_create("cush-history-index", MFD_CLOEXEC);
+    }
+
+    struct index_header h = {
+        .magic = MAGIC, .version = VERSION, .log_ino = log_ino,
+        .entry_cap = entry_cap, .node_cap = node_cap, .node_count = 1
+    };
+    if (fd == -1
+        || ftruncate(fd, index_size(entry_cap, node_cap)) == -1
+        || pwrite(fd, &h, sizeof h, 0) != sizeof h
+        || !map_index(fd)) {
+        utils_error("history index: ");
+        if (fd != -1)
+            close(fd);
+        if (tmp)
+            unlink(tmp);
+        free(tmp);
+        return false;
+    }
+
+    if (!index_log()) {         /* Only if the nodes cannot grow */
+        utils_error("history index: ");
+        unmap_index();
+        if (tmp)
+            unlink(tmp);
+        free(tmp);
+        return false;
+    }
+    if (tmp && rename(tmp, idx_path) == -1) {
+        utils_error("%s: ", idx_path);
+        unlink(tmp);            /* Still usable by this shell */
+    }
+    free(tmp);
+    return true;
+}
+
+/* Catch up with other shells, with the lock held */
+static bool
+sync_index(void)
+{
+    /* Another shell may have rebuilt the index */
+    struct stat st;
+    if (idx_path && stat(idx_path, &st) == 0
+        && (hdr == NULL || st.st_ino != idx_ino)) {
+        int fd = open(idx_path, O_RDWR | O_CLOEXEC);
+        if (fd != -1 && !map_index(fd))
+            close(fd);
+    }
+    else if (hdr && index_size(hdr->entry_cap, hdr->node_cap) != idx_len) {
+        /* Or grown its nodes */
+        int fd = fcntl(idx_fd, F_DUPFD_CLOEXEC, 0);
+        if (fd == -1 || !map_index(fd)) {
+            if (fd != -1)
+                close(fd);
+            unmap_index();
+        }
+    }
+
+    if (!map_log())
+        return false;
+    if (hdr == NULL || hdr->log_ino != log_ino || hdr->log_size > log_len
+        || !index_log())
+        return rebuild_index();
+    return true;
+}
+
+/* Take the lock that serializes all shells, and catch up */
+static bool
+lock(void)
+{
+    if (log_fd == -1)
+        return false;           /* Never opened, e.g. in batch mode */
+
+    while (flock(log_fd, LOCK_EX) == -1) {
+        if (errno != EINTR) {
+            utils_error("history lock: ");
+            return false;
+        }
+    }
+    if (!sync_index()) {
+        flock(log_fd, LOCK_UN);
+        return false;
+    }
+    return true;
+}
+
+static void
+unlock(void)
+{
+    flock(log_fd, LOCK_UN);
+}
+
+/* Open the history log at path, or keep it in memory */
+void
+histstore_open(const char *path)
+{
+    if (path) {
+        log_fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (log_fd == -1)
+            utils_error("%s: ", path);
+        else if (asprintf(&idx_path, "%s.idx", path) == -1)
+            idx_path = NULL;
+    }
+    if (log_fd == -1) {
+        free(idx_path);
+        idx_path = NULL;
+        log_fd = memfd_create("cush-history", MFD_CLOEXEC);
+        if (log_fd == -1)
+            utils_fatal_error("history: ");
+    }
+
+    struct stat st;
+    if (fstat(log_fd, &st) == 0)
+        log_ino = st.st_ino;
+    if (lock())
+        unlock();
+}
+
+/* Append a command line */
+void
+histstore_append(const char *line)
+{
+    if (!lock())
+        return;
+
+    /* Do not continue the torn last line of a shell that crashed */
+    bool torn = log_len > 0 && log_map[log_len - 1] != '\n';
+    size_t len = strlen(line);
+    char *buf = malloc(len + 2);
+    if (buf == NULL)
+        utils_fatal_error("history: ");
+    char *p = buf;
+    if (torn)
+        *p++ = '\n';
+    memcpy(p, line, len);
+    p[len] = '\n';
+
+    size_t total = p + len + 1 - buf;
+    for (size_t off = 0; off < total; ) {
+        ssize_t n = write(log_fd, buf + off, total - off);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            utils_error("history: ");
+            break;
+        }
+        off += n;
+    }
+    free(buf);
+
+    sync_index();
+    unlock();
+}
+
+/* Number of entries */
+int
+histstore_count(void)
+{
+    if (!lock())
+        return 0;
+    int count = hdr->count;
+    unlock();
+    return count;
+}
+
+/* Entry n, or NULL if it is not within the current mappings */
+static const char *
+get_entry(uint32_t n, size_t *len)
+{
+    if (hdr == NULL || n < 1 || n > __atomic_load_n(&hdr->count, __ATOMIC_ACQUIRE))
+        return NULL;
+    if (offsets[n - 1] >= log_len)
+        return NULL;
+
+    const char *start = log_map + offsets[n - 1];
+    const char *nl = memchr(start, '\n', log_map + log_len - start);
+    if (nl == NULL)
+        return NULL;
+    *len = nl - start;
+    return start;
+}
+
+/**
+ * Return entry n and its length. Indexed entries never change, so
+ * those already visible are read without taking the lock; this
+ * keeps printing a long history cheap.
+ */
+const char *
+histstore_get(int n, size_t *len)
+{
+    const char *entry = get_entry(n, len);
+    if (entry || !lock())
+        return entry;
+    entry = get_entry(n, len);
+    unlock();
+    return entry;
+}
+
+/* Number of the latest entry starting with prefix */
+int
+histstore_find_prefix(const char *prefix)
+{
+    if (!lock())
+        return 0;
+
+    size_t plen = strlen(prefix);
+    uint32_t found = plen == 0 ? hdr->count : 0;
+    uint32_t k = hdr->root;
+    size_t key = plen < MAX_DEPTH ? plen : MAX_DEPTH;
+    for (size_t i = 0; k != 0 && i < key; ) {
+        struct node *n = &nodes[k];
+        if (n->tail) {
+            size_t tdepth;
+            const unsigned char *t = entry_key(n->latest, &tdepth);
+            if (tdepth >= key && memcmp(t + i, prefix + i, key - i) == 0)
+                found = n->latest;
+            break;
+        }
+
+        unsigned char c = prefix[i];
+        if (c < n->c)
+            k = n->lo;
+        else if (c > n->c)
+            k = n->hi;
+        else {
+            if (++i == key)
+                found = n->latest;
+            k = n->eq;
+        }
+    }
+
+    /* The tree only knows the first MAX_DEPTH bytes, check the rest */
+    for (; found > 0 && plen > MAX_DEPTH; found--) {
+        size_t len;
+        const char *entry = get_entry(found, &len);
+        if (entry && len >= plen && memcmp(entry, prefix, plen) == 0)
+            break;
+    }
+    unlock();
+    return found;
+}
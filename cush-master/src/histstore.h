@@ -0,0 +1,35 @@
+/**
+ * Persistent command history, shared by concurrent shells.
+ *
+ * Commands are appended to a plain text log, one per line. A
+ * memory-mapped index next to it (the log's path plus ".idx")
+ * records where each entry starts and, for prefix searches, the
+ * latest entry below every prefix. Starting up maps both files
+ * and only indexes what other shells appended in the meantime.
+ *
+ * Entries are numbered from 1, oldest first.
+ */
+#include <stddef.h>
+
+/**
+ * Open the history log at path, creating it if needed. With a
+ * NULL path, or if the log cannot be opened, the history is kept
+ * in memory for this shell only.
+ */
+void histstore_open(const char *path);
+
+/* Append a command line; it must not contain a newline */
+void histstore_append(const char *line);
+
+/* Number of entries, including those appended by other shells */
+int histstore_count(void);
+
+/**
+ * Return entry n and store its length in *len, or NULL if there
+ * is no such entry. The text is not NUL terminated and is valid
+ * until the next call into the store.
+ */
+const char * histstore_get(int n, size_t *len);
+
+/* Number of the latest entry starting with prefix, or 0 */
+int histstore_find_prefix(const char *prefix);
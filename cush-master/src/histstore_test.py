@@ -0,0 +1,75 @@
+#!/usr/bin/python
+#
+# Tests that the history is kept in $HISTFILE and shared by shells
+#
+import atexit, proc_check, time, os, tempfile, shutil, pexpect
+import testutils
+from testutils import *
+
+histfile = history_file()
+first = setup_tests()
+
+# Ensure that shell prints expected prompt
+no_prompt = "Shell did not print expected prompt (%d)"
+expect_prompt(no_prompt % 0)
+
+#################################################################
+# Test #1:  Commands are appended to the history file
+
+sendline("echo alpha-one")
+expect_exact("alpha-one\r\n", "echo does not seem to work")
+expect_prompt(no_prompt % 1)
+sendline("echo beta-two")
+expect_exact("beta-two\r\n", "echo does not seem to work")
+expect_prompt(no_prompt % 2)
+
+lines = open(histfile).read().splitlines()
+assert lines == ["echo alpha-one", "echo beta-two"], "history file not written"
+
+#################################################################
+# Test #2:  A second shell continues the same history
+
+second = setup_tests()
+expect_prompt(no_prompt % 3)
+sendline("echo beta-three")
+expect_exact("beta-three\r\n", "echo does not seem to work")
+expect_prompt(no_prompt % 4)
+
+sendline("history")
+expect_exact("    1 echo alpha-one\r\n"
+             "    2 echo beta-two\r\n"
+             "    3 echo beta-three\r\n"
+             "    4 history\r\n", "history of the first shell is missing")
+expect_prompt(no_prompt % 5)
+
+#################################################################
+# Test #3:  The first shell sees what the second one added
+
+testutils.console = first
+sendline("!echo b")
+expect_exact("beta-three\r\n", "prefix search misses the other shell")
+expect_prompt(no_prompt % 6)
+
+sendline("!2")
+expect_exact("beta-two\r\n", "event by number does not work")
+expect_prompt(no_prompt % 7)
+
+#################################################################
+# Test #4:  A missing index is rebuilt from the history file
+
+sendline("exit")
+first.expect(pexpect.EOF)
+os.unlink(histfile + ".idx")
+third = setup_tests()
+expect_prompt(no_prompt % 8)
+sendline("history 3")
+expect_exact("    6 echo beta-two\r\n"
+             "    7 exit\r\n"
+             "    8 history 3\r\n", "history was not rebuilt")
+expect_prompt(no_prompt % 9)
+
+sendline("!echo a")
+expect_exact("alpha-one\r\n", "prefix search after rebuild")
+expect_prompt(no_prompt % 10)
+
+test_success()
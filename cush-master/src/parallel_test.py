@@ -0,0 +1,66 @@
+#!/usr/bin/python
+#
+# Tests the `parallel` built-in
+#
+import atexit, proc_check, time, os
+from testutils import *
+
+console = setup_tests()
+
+# Ensure that shell prints expected prompt
+no_prompt = "Shell did not print expected prompt (%d)"
+expect_prompt(no_prompt % 0)
+
+summary = "parallel: (\d+) run, (\d+) failed, (\d+) not started"
+
+#################################################################
+# Test #1:  One instance per argument, with {} substituted
+
+sendline("parallel echo item-{} ::: a b c")
+for item in "abc":
+    expect("item-" + item + "\r\n", "instance for %s did not run" % item)
+expect(summary, "no summary was printed")
+assert console.match.groups() == ("3", "0", "0"), "wrong summary"
+expect_prompt(no_prompt % 1)
+
+#################################################################
+# Test #2:  No more than N instances run at once
+
+start = time.time()
+sendline("parallel -j 2 sleep ::: 0.5 0.5 0.5 0.5")
+time.sleep(0.25)
+proc_check.count_children_timeout(console, 2, 0.1)
+expect(summary, "no summary was printed")
+assert time.time() - start >= 1.0, "more than 2 instances ran at once"
+expect_prompt(no_prompt % 2)
+
+#################################################################
+# Test #3:  Failures are counted and become the exit status
+
+sendline('parallel sh -c "exit {}" ::: 0 3 0 4')
+expect(summary, "no summary was printed")
+assert console.match.groups() == ("4", "2", "0"), "failures were not counted"
+expect_prompt(no_prompt % 3)
+
+#################################################################
+# Test #4:  ^C stops the fan-out
+
+sendline("parallel -j 1 sleep ::: 5 5 5")
+time.sleep(0.5)
+console.sendintr()
+expect(summary, "no summary was printed")
+assert console.match.groups() == ("1", "1", "2"), "^C did not stop parallel"
+expect_prompt(no_prompt % 4)
+
+#################################################################
+# Test #5:  A trailing & is refused, not run in the foreground
+
+sendline("parallel sleep ::: 5 &")
+expect_exact("parallel: cannot run in the background\r\n",
+    "parallel ignored the trailing &")
+expect_prompt(no_prompt % 5)
+sendline("jobs")
+expect_prompt(no_prompt % 6)
+assert "sleep" not in console.before, "instances were started"
+
+test_success()
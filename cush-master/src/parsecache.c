@@ -0,0 +1,151 @@
+/**
+ * Cache of parsed command lines.
+ *
+ * Entries are found through a hash table of chains and kept on a
+ * list from the most to the least recently used. An entry holds
+ * its key inline, and a compacted copy of the command line (see
+ * ast_command_line_compact) that is copied out on every hit.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "parsecache.h"
+#include "shell-ast.h"
+#include "list.h"
+#include "utils.h"
+
+#define MAX_LINE 1024           /* Longer lines are not cached */
+
+struct entry {
+    struct list_elem elem;      /* In the LRU list, most recent first */
+    struct entry *next;         /* In the same bucket */
+    uint32_t hash;
+    size_t len;                 /* Of the line */
+    size_t size;                /* Of the compacted command line */
+    struct ast_command_line *cmdline;
+    char line[];
+};
+
+struct parsecache {
+    struct list lru;
+    int count, capacity;
+    uint32_t mask;              /* Buckets - 1, a power of two minus 1 */
+    struct entry **buckets;
+};
+
+/* FNV-1a */
+static uint32_t
+hash_line(const char *line, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char) line[i]) * 16777619u;
+    return h;
+}
+
+/* Create a cache of up to capacity lines */
+struct parsecache *
+parsecache_create(int capacity)
+{
+    struct parsecache *cache = malloc(sizeof *cache);
+    if (cache == NULL)
+        utils_fatal_error("parsecache: ");
+
+    size_t buckets = 1;
+    while (buckets < (size_t) capacity * 2)
+        buckets *= 2;
+    cache->buckets = calloc(buckets, sizeof *cache->buckets);
+    if (cache->buckets == NULL)
+        utils_fatal_error("parsecache: ");
+
+    list_init(&cache->lru);
+    cache->count = 0;
+    cache->capacity = capacity;
+    cache->mask = buckets - 1;
+    return cache;
+}
+
+static void
+free_entry(struct entry *entry)
+{
+    free(entry->cmdline);
+    free(entry);
+}
+
+void
+parsecache_destroy(struct parsecache *cache)
+{
+    while (!list_empty(&cache->lru))
+        free_entry(list_entry(list_pop_front(&cache->lru),
+                              struct entry, elem));
+    free(cache->buckets);
+    free(cache);
+}
+
+/* Find the link that points to the entry for line, or to NULL */
+static struct entry **
+find(struct parsecache *cache, const char *line, size_t len, uint32_t hash)
+{
+    struct entry **link = &cache->buckets[hash & cache->mask];
+    while (*link && !((*link)->hash == hash && (*link)->len == len
+                      && memcmp((*link)->line, line, len) == 0))
+        link = &(*link)->next;
+    return link;
+}
+
+/* Return a copy of what line parsed to, in the arena */
+struct ast_command_line *
+parsecache_lookup(struct parsecache *cache, const char *line,
+                  struct arena *arena)
+{
+    size_t len = strnlen(line, MAX_LINE + 1);
+    if (len > MAX_LINE)
+        return NULL;
+
+    struct entry *entry = *find(cache, line, len, hash_line(line, len));
+    if (entry == NULL)
+        return NULL;
+
+    list_remove(&entry->elem);
+    list_push_front(&cache->lru, &entry->elem);
+    return ast_command_line_copy(arena, entry->cmdline, entry->size);
+}
+
+/* Remember what line parsed to */
+void
+parsecache_insert(struct parsecache *cache, const char *line,
+                  struct ast_command_line *cmdline)
+{
+    size_t len = strnlen(line, MAX_LINE + 1);
+    if (len > MAX_LINE || cache->capacity == 0)
+        return;
+
+    uint32_t hash = hash_line(line, len);
+    if (*find(cache, line, len, hash))
+        return;
+
+    /* Make room by dropping the least recently used line */
+    if (cache->count == cache->capacity) {
+        struct entry *old = list_entry(list_pop_back(&cache->lru),
+                                       struct entry, elem);
+        struct entry **link = find(cache, old->line, old->len, old->hash);
+        *link = old->next;
+        free_entry(old);
+        cache->count--;
+    }
+
+    struct entry *entry = malloc(sizeof *entry + len);
+    if (entry == NULL)
+        utils_fatal_error("parsecache: ");
+    memcpy(entry->line, line, len);
+    entry->hash = hash;
+    entry->len = len;
+    entry->cmdline = ast_command_line_compact(cmdline, &entry->size);
+
+    struct entry **bucket = &cache->buckets[hash & cache->mask];
+    entry->next = *bucket;
+    *bucket = entry;
+    list_push_front(&cache->lru, &entry->elem);
+    cache->count++;
+}
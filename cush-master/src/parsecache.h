@@ -0,0 +1,26 @@
+/**
+ * Cache of parsed command lines, keyed by their text.
+ *
+ * Every entry holds a compacted copy of the command line a line
+ * parsed to. A hit copies it into the caller's arena, so the line
+ * is neither scanned nor parsed again. The least recently used
+ * entry makes room for a new one.
+ */
+#include <stddef.h>
+
+struct parsecache;
+struct arena;
+struct ast_command_line;
+
+/* Create a cache of up to capacity lines */
+struct parsecache * parsecache_create(int capacity);
+void parsecache_destroy(struct parsecache *cache);
+
+/* Return a copy of what line parsed to, in the arena, or NULL */
+struct ast_command_line * parsecache_lookup(struct parsecache *cache,
+                                           const char *line,
+                                           struct arena *arena);
+
+/* Remember what line parsed to; the cache keeps its own copy */
+void parsecache_insert(struct parsecache *cache, const char *line,
+                       struct ast_command_line *cmdline);
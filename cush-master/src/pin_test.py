@@ -0,0 +1,82 @@
+#!/usr/bin/python
+#
+# Tests that `pin` places the stages of a pipeline, and `jobs -v`
+#
+import atexit, proc_check, time, os
+from testutils import *
+
+console = setup_tests()
+
+# Ensure that shell prints expected prompt
+no_prompt = "Shell did not print expected prompt (%d)"
+expect_prompt(no_prompt % 0)
+
+def stat(pid):
+    # Fields after the command name, numbered as in proc(5)
+    fields = open("/proc/%d/stat" % pid).read().rsplit(")", 1)[1].split()
+    return dict(nice=int(fields[19 - 3]), policy=int(fields[41 - 3]))
+
+def cpus_allowed(pid):
+    for line in open("/proc/%d/status" % pid):
+        if line.startswith("Cpus_allowed_list:"):
+            return line.split()[1]
+
+SCHED_BATCH = 3
+
+#################################################################
+# Test #1:  Stages are pinned, niced and batched as asked
+
+sendline("pin -c 0 -N 4,9 -b sleep 30 | sleep 30 &")
+expect("\[(\d+)\] \d+", "background job was not started")
+jid = console.match.group(1)
+expect_prompt(no_prompt % 1)
+
+sendline("jobs -v")
+expect("\tstage 1\tpid (\d+)\tcpu 0\tpinned 0\tnice \+4\tbatch\r\n",
+    "jobs -v does not show the first stage")
+first = int(console.match.group(1))
+expect("\tstage 2\tpid (\d+)\tcpu 0\tpinned 0\tnice \+9\tbatch\r\n",
+    "jobs -v does not show the second stage")
+second = int(console.match.group(1))
+expect_prompt(no_prompt % 2)
+
+assert stat(first) == dict(nice=4, policy=SCHED_BATCH), "first stage"
+assert stat(second) == dict(nice=9, policy=SCHED_BATCH), "second stage"
+assert cpus_allowed(first) == "0" and cpus_allowed(second) == "0", \
+    "stages are not pinned"
+
+sendline("kill " + jid)
+expect_prompt(no_prompt % 3)
+
+#################################################################
+# Test #2:  Unpinned jobs show where their stages run
+
+sendline("sleep 30 &")
+expect("\[(\d+)\] \d+", "background job was not started")
+jid = console.match.group(1)
+expect_prompt(no_prompt % 4)
+
+sendline("jobs -v")
+expect("\tstage 1\tpid \d+\tcpu \d+\r\n", "jobs -v does not show the stage")
+expect_prompt(no_prompt % 5)
+
+sendline("kill " + jid)
+expect_prompt(no_prompt % 6)
+
+#################################################################
+# Test #3:  Bad placements are refused before anything runs
+
+sendline("pin -c 4096 echo never")
+expect_exact("pin: bad CPU list 4096\r\n", "CPU list is not checked")
+expect_prompt(no_prompt % 7)
+
+sendline("pin -N 3")
+expect_exact("pin: usage", "pin without a command is accepted")
+expect_prompt(no_prompt % 8)
+
+sendline("pin -c 0 jobs")
+expect_exact("pin: jobs is run by the shell itself\r\n",
+    "placement of a built-in is silently dropped")
+expect_prompt(no_prompt % 9)
+
+test_success()
@@ -0,0 +1,477 @@
+/**
+ * Resource budgets of a job.
+ *
+ * Children of a job with a budget are always forked: they must set
+ * their limits and join the job's cgroup before exec, and neither
+ * can be expressed as a posix_spawn attribute.
+ *
+ * cgroup v2 allows controllers in the children of a cgroup only if
+ * no process is left in it. If the shell is the only one in its
+ * cgroup, it therefore first moves into a leaf of its own, next to
+ * which the cgroups of jobs are then created, and which it removes
+ * again when it exits.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <mntent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "budget.h"
+#include "../utils.h"
+
+#define CPU_PERIOD 100000       /* Microseconds of cpu.max's period */
+#define STAT_UTIME 14           /* Fields of /proc/PID/stat, see proc(5) */
+#define STAT_STIME 15
+#define STAT_VSIZE 23
+
+/* Directory of the shell's cgroup, or -1; see find_base */
+static int base = -1;
+static int base_errno;          /* Why there is none, once looked for */
+static char leaf[32];           /* The shell's own leaf, if it made one */
+static pid_t leaf_owner;        /* The shell, rather than a forked child */
+
+/* Read a small file of a cgroup into buf. Returns false on error */
+static bool
+read_file(int dir, const char *name, char *buf, size_t size)
+{
+    int fd = openat(dir, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    ssize_t len = read(fd, buf, size - 1);
+    close(fd);
+    if (len == -1)
+        return false;
+    buf[len] = '\0';
+    return true;
+}
+
+/* Write a control file of a cgroup. Returns false on error */
+static bool
+write_file(int dir, const char *name, const char *text)
+{
+    int fd = openat(dir, name, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    bool ok = write(fd, text, strlen(text)) != -1;
+    int err = errno;
+    close(fd);
+    errno = err;
+    return ok;
+}
+
+/* Check if a list of controllers names the given one */
+static bool
+has_word(const char *list, const char *word)
+{
+    size_t len = strlen(word);
+    for (const char *p = list; (p = strstr(p, word)) != NULL; p += len)
+        if ((p == list || p[-1] == ' ')
+            && (p[len] == ' ' || p[len] == '\n' || p[len] == '\0'))
+            return true;
+    return false;
+}
+
+/* Open the directory of the shell's cgroup in the v2 hierarchy */
+static int
+open_own_cgroup(void)
+{
+    char *mount = NULL;
+    FILE *mounts = setmntent("/proc/self/mounts", "r");
+    struct mntent *entry;
+    while (mounts && (entry = getmntent(mounts)) != NULL) {
+        if (strcmp(entry->mnt_type, "cgroup2") == 0) {
+            mount = strdup(entry->mnt_dir);
+            break;
+        }
+    }
+    if (mounts)
+        endmntent(mounts);
+
+    /* The v2 line of /proc/self/cgroup reads 0::PATH */
+    char line[4096], *path = NULL;
+    FILE *self = fopen("/proc/self/cgroup", "r");
+    while (self && fgets(line, sizeof line, self)) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            path = line + 3;
+            break;
+        }
+    }
+    if (self)
+        fclose(self);
+
+    int dir = -1;
+    char *name;
+    errno = ENOENT;
+    if (mount && path && asprintf(&name, "%s%s", mount, path) != -1) {
+        dir = open(name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        free(name);
+    }
+    free(mount);
+    return dir;
+}
+
+/* Let the children of the cgroup use the memory and cpu controllers */
+static bool
+delegate(int dir)
+{
+    char control[512];
+    if (read_file(dir, "cgroup.subtree_control", control, sizeof control)
+        && has_word(control, "memory") && has_word(control, "cpu"))
+        return true;
+    return write_file(dir, "cgroup.subtree_control", "+memory +cpu");
+}
+
+/* Check if the shell is the only process in the cgroup */
+static bool
+alone_in(int dir)
+{
+    char procs[64];
+    char self[16];
+    snprintf(self, sizeof self, "%d\n", (int) getpid());
+    return read_file(dir, "cgroup.procs", procs, sizeof procs)
+        && strcmp(procs, self) == 0;
+}
+
+/**
+ * Move the shell back out of its leaf and remove it, at exit. The
+ * controllers must be taken back from the children first, which
+ * fails while a job with a budget is left; the leaf then stays.
+ */
+static void
+remove_leaf(void)
+{
+    if (getpid() != leaf_owner)
+        return;                 /* A forked child that exits */
+    if (write_file(base, "cgroup.subtree_control", "-memory -cpu")
+        && write_file(base, "cgroup.procs", "0"))
+        unlinkat(base, leaf, AT_REMOVEDIR);
+}
+
+/* Find the cgroup under which jobs get theirs, or return -1 */
+static int
+find_base(void)
+{
+    if (base != -1 || base_errno != 0)
+        return base;
+    int dir = open_own_cgroup();
+    bool ok = dir != -1 && delegate(dir);
+    if (dir != -1 && !ok && errno == EBUSY && alone_in(dir)) {
+        /* Move into a leaf, so that the cgroup has no process left */
+        snprintf(leaf, sizeof leaf, "cush-%d", (int) getpid());
+        int fd = -1;
+        if (mkdirat(dir, leaf, 0755) == 0 || errno == EEXIST)
+            fd = openat(dir, leaf, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        ok = fd != -1 && write_file(fd, "cgroup.procs", "0")
+            && delegate(dir);
+        if (fd != -1)
+            close(fd);
+        if (ok) {
+            leaf_owner = getpid();
+            atexit(remove_leaf);
+        }
+    }
+    if (ok) {
+        base = dir;
+    }
+    else {
+        base_errno = errno ? errno : ENOENT;
+        if (dir != -1)
+            close(dir);
+    }
+    return base;
+}
+
+/* Parse a number, with a K, M or G suffix if it is a size */
+static bool
+parse_number(const char *text, bool size, long long *number)
+{
+    char *end;
+    errno = 0;
+    long long n = strtoll(text, &end, 10);
+    if (end == text || n <= 0 || errno)
+        return false;
+    if (size && *end) {
+        const char *units = "KMG";
+        const char *unit = strchr(units, toupper((unsigned char) *end));
+        if (unit == NULL)
+            return false;
+        long long scale = 1LL << (10 * (unit - units + 1));
+        if (n > LLONG_MAX / scale)
+            return false;
+        n *= scale;
+        end++;
+    }
+    *number = n;
+    return *end == '\0';
+}
+
+static bool
+usage(void)
+{
+    fprintf(stderr, "limit: usage limit [-v SIZE] [-t SECONDS] [-n FILES] "
+        "[-m SIZE] [-c PERCENT] command\n");
+    return false;
+}
+
+/* Parse the options of a leading `limit` */
+bool
+budget_parse(char ***argv, struct job_budget *budget)
+{
+    *budget = (struct job_budget) {
+        .as = RLIM_INFINITY, .cpu = RLIM_INFINITY, .nofile = RLIM_INFINITY,
+        .cgroup = -1, .procs = -1,
+    };
+    char **arg = *argv + 1;
+    for (; *arg && (*arg)[0] == '-'; arg++) {
+        if (strcmp(*arg, "--") == 0) {
+            arg++;
+            break;
+        }
+        char opt = (*arg)[1];
+        if (!opt || !strchr("vtnmc", opt) || (*arg)[2] || !arg[1])
+            return usage();
+        const char *value = *++arg;
+        long long n;
+        if (!parse_number(value, opt == 'v' || opt == 'm', &n)
+            || (opt == 'c' && n > 100 * 4096)) {
+            fprintf(stderr, "limit: bad value %s for -%c\n", value, opt);
+            return false;
+        }
+        switch (opt) {
+            case 'v':   budget->as = n; break;
+            case 't':   budget->cpu = n; break;
+            case 'n':   budget->nofile = n; break;
+            case 'm':   budget->memory = n; break;
+            case 'c':   budget->cpu_percent = n; break;
+        }
+    }
+    if (!*arg)
+        return usage();
+    *argv = arg;
+    return true;
+}
+
+/* Create the job's cgroup and set its limits */
+static bool
+make_cgroup(struct job_budget *budget)
+{
+    static unsigned jobs;
+    if (find_base() == -1) {
+        fprintf(stderr, "limit: -m and -c need a cgroup v2 hierarchy with "
+            "the memory and cpu controllers: %s\n", strerror(base_errno));
+        return false;
+    }
+    snprintf(budget->name, sizeof budget->name, "cush-%d-%u",
+        (int) getpid(), ++jobs);
+    if (mkdirat(base, budget->name, 0755) == -1) {
+        utils_error("limit: cgroup %s: ", budget->name);
+        return false;
+    }
+    budget->cgroup = openat(base, budget->name,
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    char value[64];
+    bool ok = budget->cgroup != -1;
+    if (ok && budget->memory) {
+        snprintf(value, sizeof value, "%lld\n", budget->memory);
+        ok = write_file(budget->cgroup, "memory.max", value);
+    }
+    if (ok && budget->cpu_percent) {
+        snprintf(value, sizeof value, "%d %d\n",
+            budget->cpu_percent * (CPU_PERIOD / 100), CPU_PERIOD);
+        ok = write_file(budget->cgroup, "cpu.max", value);
+    }
+    if (ok)
+        budget->procs = openat(budget->cgroup, "cgroup.procs",
+            O_WRONLY | O_CLOEXEC);
+    if (!ok || budget->procs == -1) {
+        utils_error("limit: cgroup %s: ", budget->name);
+        if (budget->cgroup != -1)
+            close(budget->cgroup);
+        unlinkat(base, budget->name, AT_REMOVEDIR);
+        return false;
+    }
+    return true;
+}
+
+/* Copy the parsed budget for a job, with a cgroup if it needs one */
+struct job_budget *
+budget_create(const struct job_budget *budget)
+{
+    struct job_budget *copy = malloc(sizeof *copy);
+    if (copy == NULL)
+        utils_fatal_error("malloc: ");
+    *copy = *budget;
+    if ((budget->memory || budget->cpu_percent) && !make_cgroup(copy)) {
+        free(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+/* Set a limit, unless it is to stay as inherited */
+static void
+set_limit(int resource, const char *name, rlim_t soft, rlim_t hard)
+{
+    struct rlimit limit = { .rlim_cur = soft, .rlim_max = hard };
+    if (soft != RLIM_INFINITY && setrlimit(resource, &limit) == -1)
+        utils_fatal_error("limit: %s: ", name);
+}
+
+/* Apply the job's budget to the calling (forked) child */
+void
+budget_apply(const struct job_budget *budget)
+{
+    if (budget->procs != -1 && write(budget->procs, "0", 1) == -1)
+        utils_fatal_error("limit: cgroup %s: ", budget->name);
+    set_limit(RLIMIT_AS, "address space", budget->as, budget->as);
+    set_limit(RLIMIT_NOFILE, "open files", budget->nofile, budget->nofile);
+
+    /* SIGXCPU at the soft limit says why, before SIGKILL at the hard */
+    set_limit(RLIMIT_CPU, "CPU time", budget->cpu, budget->cpu + 1);
+}
+
+/* Current usage of a process, as far as the budgets go */
+struct process_usage {
+    long long vsize;            /* Address space, in bytes */
+    double cputime;             /* User and system time, in seconds */
+    int files;                  /* Open file descriptors */
+};
+
+/* Read the usage of a live process. Returns false if it is gone */
+static bool
+process_usage(pid_t pid, struct process_usage *usage)
+{
+    char path[64], stat[1024];
+    snprintf(path, sizeof path, "/proc/%d/stat", (int) pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+    size_t len = fread(stat, 1, sizeof stat - 1, file);
+    fclose(file);
+    stat[len] = '\0';
+
+    /* The command name may hold spaces, so count from its end */
+    char *p = strrchr(stat, ')');
+    if (p == NULL)
+        return false;
+    long long ticks = 0;
+    int field = 2;
+    for (char *word = strtok(p + 1, " "); word; word = strtok(NULL, " ")) {
+        field++;
+        if (field == STAT_UTIME || field == STAT_STIME)
+            ticks += atoll(word);
+        if (field == STAT_VSIZE)
+            usage->vsize = atoll(word);
+    }
+    usage->cputime = (double) ticks / sysconf(_SC_CLK_TCK);
+
+    snprintf(path, sizeof path, "/proc/%d/fd", (int) pid);
+    DIR *fds = opendir(path);
+    usage->files = 0;
+    if (fds) {
+        struct dirent *entry;
+        while ((entry = readdir(fds)) != NULL)
+            usage->files += entry->d_name[0] != '.';
+        closedir(fds);
+    }
+    return true;
+}
+
+/* Print a size in bytes with a binary unit */
+static const char *
+format_size(char *buf, size_t size, long long bytes)
+{
+    const char *units = "BKMGT";
+    double value = bytes;
+    int i = 0;
+    while (value >= 1024 && units[i + 1]) {
+        value /= 1024;
+        i++;
+    }
+    snprintf(buf, size, i ? "%.1f%c" : "%.0f%c", value, units[i]);
+    return buf;
+}
+
+/* Print the job's current usage against each of its budgets */
+void
+budget_print(const struct job *job, FILE *out)
+{
+    const struct job_budget *budget = job->budget;
+    char used[16], limit[16];
+
+    /* Limits apply to each process, so show the largest user */
+    struct process_usage most = { 0 };
+    for (int i = 0; i < job->num_stages; i++) {
+        struct process_usage usage = { 0 };
+        const struct job_stage *stage = &job->stages[i];
+        if (stage->pid == 0 || stage->exited
+            || !process_usage(stage->pid, &usage))
+            continue;
+        if (usage.vsize > most.vsize)
+            most.vsize = usage.vsize;
+        if (usage.cputime > most.cputime)
+            most.cputime = usage.cputime;
+        if (usage.files > most.files)
+            most.files = usage.files;
+    }
+
+    fprintf(out, "\tlimits");
+    if (budget->as != RLIM_INFINITY)
+        fprintf(out, "\tas %s/%s",
+            format_size(used, sizeof used, most.vsize),
+            format_size(limit, sizeof limit, budget->as));
+    if (budget->cpu != RLIM_INFINITY)
+        fprintf(out, "\tcputime %.2fs/%llus", most.cputime,
+            (unsigned long long) budget->cpu);
+    if (budget->nofile != RLIM_INFINITY)
+        fprintf(out, "\tnofile %d/%llu", most.files,
+            (unsigned long long) budget->nofile);
+
+    /* The cgroup accounts for the job as a whole */
+    char text[512];
+    if (budget->memory) {
+        long long current = 0;
+        if (read_file(budget->cgroup, "memory.current", text, sizeof text))
+            current = atoll(text);
+        fprintf(out, "\tmemory %s/%s",
+            format_size(used, sizeof used, current),
+            format_size(limit, sizeof limit, budget->memory));
+    }
+    if (budget->cpu_percent) {
+        long long usec = 0, throttled = 0;
+        if (read_file(budget->cgroup, "cpu.stat", text, sizeof text)) {
+            char *p = strstr(text, "usage_usec ");
+            if (p)
+                usec = atoll(p + strlen("usage_usec "));
+            p = strstr(text, "nr_throttled ");
+            if (p)
+                throttled = atoll(p + strlen("nr_throttled "));
+        }
+        fprintf(out, "\tcpu %.2fs at %d%%, throttled %lld",
+            usec / 1e6, budget->cpu_percent, throttled);
+    }
+    fprintf(out, "\n");
+}
+
+/* Remove the cgroup and free the budget */
+void
+budget_destroy(struct job_budget *budget)
+{
+    if (budget->cgroup != -1) {
+        close(budget->procs);
+        close(budget->cgroup);
+        if (unlinkat(base, budget->name, AT_REMOVEDIR) == -1)
+            utils_error("limit: cgroup %s: ", budget->name);
+    }
+    free(budget);
+}
@@ -0,0 +1,62 @@
+/**
+ * Resource budgets of a job: the `limit` prefix.
+ *
+ *   limit [-v SIZE] [-t SECONDS] [-n FILES] [-m SIZE] [-c PERCENT]
+ *         command | ...
+ *
+ * -v, -t and -n set the address space, CPU time and open files
+ * limits (setrlimit(2)) of every process of the pipeline, as
+ * `ulimit` does in other shells. -m and -c budget the job as a
+ * whole: it gets a cgroup of its own, under the shell's in the
+ * cgroup v2 hierarchy, with memory.max set to SIZE and cpu.max to
+ * PERCENT of one CPU. Sizes take a K, M or G suffix.
+ */
+#ifndef __BUDGET_H
+#define __BUDGET_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include "jobs.h"
+
+struct job_budget {
+    rlim_t  as;                 /* RLIMIT_AS in bytes, or RLIM_INFINITY */
+    rlim_t  cpu;                /* RLIMIT_CPU in seconds, or RLIM_INFINITY */
+    rlim_t  nofile;             /* RLIMIT_NOFILE, or RLIM_INFINITY */
+    long long memory;           /* memory.max in bytes, 0 for none */
+    int     cpu_percent;        /* cpu.max in percent of a CPU, 0 for none */
+    int     cgroup;             /* Directory of the job's cgroup, or -1 */
+    int     procs;              /* Its cgroup.procs, for children to join */
+    char    name[32];           /* Its name under the shell's cgroup */
+};
+
+/**
+ * Parse the options of a leading `limit`, advancing *argv past
+ * them to the command. Prints an error and returns false if they
+ * are malformed or not followed by a command.
+ */
+bool budget_parse(char ***argv, struct job_budget *budget);
+
+/**
+ * Make a copy of the parsed budget for a job, creating its cgroup
+ * if -m or -c asked for one. Prints an error and returns NULL if
+ * there is no cgroup v2 hierarchy the shell may write to, or it
+ * lacks the memory or cpu controller.
+ */
+struct job_budget * budget_create(const struct job_budget *budget);
+
+/**
+ * Apply the job's budget to the calling (forked) child: join the
+ * cgroup and set the limits. Exits if it cannot, since the program
+ * would otherwise run unbounded.
+ */
+void budget_apply(const struct job_budget *budget);
+
+/* Print the job's current usage against each of its budgets */
+void budget_print(const struct job *job, FILE *out);
+
+/* Remove the cgroup and free the budget, once the job is done */
+void budget_destroy(struct job_budget *budget);
+
+#endif /* __BUDGET_H */
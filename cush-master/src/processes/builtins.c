@@ -1,46 +1,31 @@
 /**
  * Commands for functionality internal to the shell.
+ *
+ * Every built-in is one entry of builtins[] below, naming the
+ * function that runs it. Since each command of every pipeline is
+ * checked against them, names are found through a perfect hash
+ * over their length and first, middle and last bytes: a command
+ * that is not a built-in costs one table lookup and, at most, one
+ * strcmp.
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <assert.h>
 #include <sys/wait.h>
 
 #include "builtins.h"
 #include "jobs.h"
+#include "pathcache.h"
+#include "parallel.h"
+#include "launch.h"
 #include "../history.h"
 #include "../signal_support.h"
 #include "../termstate_management.h"
 #include "../utils.h"
 #include "../custom_prompt.h"
 
-/* Possible built-in commands */
-typedef enum {UNKNOWN, KILL, FG, BG, JOBS, STOP, EXIT, HISTORY, CUSTOM} BUILTIN;
-const static struct {
-    BUILTIN     bin;
-    const char *str;
-} convert [] = {
-    {KILL,      "kill"},
-    {FG,        "fg"},
-    {BG,        "bg"},
-    {JOBS,      "jobs"},
-    {STOP,      "stop"},
-    {EXIT,      "exit"},
-    {HISTORY,   "history"},
-    {CUSTOM,    "custom"}
-};
-
-/* Check if a string is a built-in command */
-static BUILTIN
-builtins_check(char* str) {
-    int n = sizeof(convert) / sizeof(convert[0]);
-    for (int i = 0; i < n; i++) {
-        if (strcmp(convert[i].str, str) == 0)
-            return convert[i].bin;
-    }
-    return UNKNOWN;
-}
-
 /* Retrieve the job referenced by the argument */
 static struct job *
 get_job(char *argv[]) {
@@ -60,86 +45,323 @@ get_job(char *argv[]) {
     return job;
 }
 
+static int
+builtin_kill(struct ast_command *cmd) {
+    struct job *job = get_job(cmd->argv);
+    if (!job)
+        return 1;
+    if (killpg(job->pgid, SIGTERM) == -1)
+        utils_error("killpg: ");
+    return 0;
+}
+
+static int
+builtin_fg(struct ast_command *cmd) {
+    struct job *job = get_job(cmd->argv);
+    if (!job)
+        return 1;
+    termstate_give_terminal_to(job->has_tty_state ?
+        &job->saved_tty_state : NULL, job->pgid);
+
+    /* Revive the stopped process */
+    if (is_stopped(job))
+        if (killpg(job->pgid, SIGCONT) == -1)
+            utils_error("killpg: ");
+    job->status = FOREGROUND;
+    print_cmdline(job->pipe);
+    printf("\n");
+
+    /* Wait for new foreground to complete */
+    signal_block(SIGCHLD);
+    wait_for_job(job);
+    signal_unblock(SIGCHLD);
+    report_job_time(job);
+    return job->exit_status;
+}
+
+static int
+builtin_bg(struct ast_command *cmd) {
+    struct job *job = get_job(cmd->argv);
+    if (!job)
+        return 1;
+
+    /* Revive the stopped process */
+    if (is_stopped(job))
+        if (killpg(job->pgid, SIGCONT) == -1)
+            utils_error("killpg: ");
+    job->status = BACKGROUND;
+    print_job(job, false);
+    return 0;
+}
+
+static int
+builtin_jobs(struct ast_command *cmd) {
+    /* -v adds each job's resource usage */
+    print_jobs(true, cmd->argv[1] && strcmp(cmd->argv[1], "-v") == 0);
+    return 0;
+}
+
+static int
+builtin_stop(struct ast_command *cmd) {
+    struct job *job = get_job(cmd->argv);
+    if (!job)
+        return 1;
+
+    /* Stop the background process */
+    if (!is_stopped(job))
+        if (killpg(job->pgid, SIGTSTP) == -1)
+            utils_error("killpg: ");
+    return 0;
+}
+
+static int
+builtin_exit(struct ast_command *cmd) {
+    exit(cmd->argv[1] ? atoi(cmd->argv[1]) : EXIT_SUCCESS);
+}
+
+static int
+builtin_history(struct ast_command *cmd) {
+    int length = -1;
+    if (cmd->argv[1]) {
+        /* Parse optional parameter */
+        char *end;
+        length = strtol(cmd->argv[1], &end, 10);
+        if (cmd->argv[1] == end || length < 0) {
+            fprintf(stderr, "%1$s: usage %1$s [len]\n", cmd->argv[0]);
+            return 2;
+        }
+    }
+    history_print(length);
+    return 0;
+}
+
+static int
+builtin_custom(struct ast_command *cmd) {
+    /* A format switches to it, and turns the prompt on */
+    if (!cmd->argv[1])
+        togglePrompt();
+    else if (setPromptFormat(cmd->argv[1]))
+        custom = true;
+    else
+        return 2;
+    return 0;
+}
+
+static int
+builtin_hash(struct ast_command *cmd) {
+    if (!cmd->argv[1]) {
+        pathcache_print();
+        return 0;
+    }
+    if (strcmp(cmd->argv[1], "-r") == 0) {
+        pathcache_clear();
+        return 0;
+    }
+    /* Forget the given names, or look them up ahead of time */
+    int status = 0;
+    bool forget = strcmp(cmd->argv[1], "-d") == 0;
+    for (char **name = cmd->argv + 1 + forget; *name; name++) {
+        if (forget ? !pathcache_forget(*name)
+                   : !pathcache_lookup(*name)) {
+            fprintf(stderr, "%s: %s: not found\n",
+                cmd->argv[0], *name);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+static int
+builtin_parallel(struct ast_command *cmd) {
+    int failed = parallel_run(cmd);
+    return failed == -1 ? 2 : failed;
+}
+
+static int
+builtin_cd(struct ast_command *cmd) {
+    const char *dir = cmd->argv[1] ? cmd->argv[1] : getenv("HOME");
+    bool back = dir && strcmp(dir, "-") == 0;
+    if (back)
+        dir = getenv("OLDPWD");
+    if (!dir) {
+        fprintf(stderr, "%s: %s not set\n", cmd->argv[0],
+            back ? "OLDPWD" : "HOME");
+        return 1;
+    }
+    if (!changeDirectory(dir)) {
+        utils_error("%s: %s: ", cmd->argv[0], dir);
+        return 1;
+    }
+    if (back)
+        printf("%s\n", getenv("PWD") ? getenv("PWD") : dir);
+    return 0;
+}
+
+static int
+builtin_wait(struct ast_command *cmd) {
+    signal_block(SIGCHLD);
+    wait_for_background_jobs();
+    signal_unblock(SIGCHLD);
+    return 0;
+}
+
+static int
+builtin_termstate(struct ast_command *cmd) {
+    const struct termstate_stats *stats = termstate_get_stats();
+    printf("%s: %lu tcsetpgrp, %lu tcsetattr, %lu avoided\n", cmd->argv[0],
+        stats->tcsetpgrp, stats->tcsetattr, stats->avoided);
+    return 0;
+}
+
+/* Possible built-in commands */
+const static struct builtin {
+    const char *name;
+    int (*run)(struct ast_command *cmd);    /* Returns the exit status */
+    bool stage;                 /* Only prints, so may feed a pipeline */
+} builtins[] = {
+    {"kill",        builtin_kill,       false},
+    {"fg",          builtin_fg,         false},
+    {"bg",          builtin_bg,         false},
+    {"jobs",        builtin_jobs,       true},
+    {"stop",        builtin_stop,       false},
+    {"exit",        builtin_exit,       false},
+    {"history",     builtin_history,    true},
+    {"custom",      builtin_custom,     false},
+    {"hash",        builtin_hash,       true},
+    {"parallel",    builtin_parallel,   false},
+    {"cd",          builtin_cd,         false},
+    {"wait",        builtin_wait,       false},
+    {"termstate",   builtin_termstate,  true},
+};
+
+#define NUM_BUILTINS (sizeof builtins / sizeof builtins[0])
+#define MAX_NAME    15          /* No built-in has a longer name */
+#define SLOT_BITS   6
+#define NUM_SLOTS   (1 << SLOT_BITS)
+#define MAX_SEEDS   (1 << 16)   /* Multipliers tried by builtins_init */
+
+static uint8_t slots[NUM_SLOTS];    /* Index into builtins + 1, or 0 */
+static uint32_t seed;               /* Makes the hash perfect, odd */
+
+/* Key of a name of the given length, 1 to MAX_NAME */
+static uint32_t
+key_of(const char *name, size_t len)
+{
+    return (unsigned char) name[0]
+        | (unsigned char) name[len / 2] << 8
+        | (unsigned char) name[len - 1] << 16
+        | len << 24;
+}
+
+/* Slot for a name of the given length */
+static unsigned
+slot_of(const char *name, size_t len)
+{
+    return (uint32_t) (key_of(name, len) * seed) >> (32 - SLOT_BITS);
+}
+
+/**
+ * Pick a multiplier under which no two built-ins share a slot.
+ * Names that share a key can never be told apart by any of them,
+ * so a table that adds one is refused up front.
+ */
+void
+builtins_init(void)
+{
+    _Static_assert(NUM_BUILTINS < NUM_SLOTS / 2, "too many built-ins");
+
+    for (size_t i = 0; i < NUM_BUILTINS; i++) {
+        const char *name = builtins[i].name;
+        assert(strlen(name) <= MAX_NAME);
+        for (size_t j = 0; j < i; j++) {
+            const char *other = builtins[j].name;
+            if (key_of(name, strlen(name)) == key_of(other, strlen(other))) {
+                fprintf(stderr, "built-ins %s and %s hash alike\n",
+                    other, name);
+                abort();
+            }
+        }
+    }
+
+    seed = 0x9e3779b1;
+    for (int tries = 0; tries < MAX_SEEDS; tries++, seed += 2) {
+        memset(slots, 0, sizeof slots);
+        size_t i;
+        for (i = 0; i < NUM_BUILTINS; i++) {
+            const char *name = builtins[i].name;
+            unsigned s = slot_of(name, strlen(name));
+            if (slots[s])
+                break;
+            slots[s] = i + 1;
+        }
+        if (i == NUM_BUILTINS)
+            return;
+    }
+    fprintf(stderr, "no perfect hash for the built-ins in %d tries\n",
+        MAX_SEEDS);
+    abort();
+}
+
+/* Check if a string is a built-in command */
+static const struct builtin *
+builtins_check(const char *str) {
+    assert(seed != 0 || !!!"builtins_init was not called");
+
+    size_t len = strnlen(str, MAX_NAME + 1);
+    if (len == 0 || len > MAX_NAME)
+        return NULL;
+    int i = slots[slot_of(str, len)];
+    if (i == 0 || strcmp(builtins[i - 1].name, str) != 0)
+        return NULL;
+    return &builtins[i - 1];
+}
+
+/* Check if a command is a built-in */
+bool
+builtins_is_builtin(struct ast_command *cmd) {
+    return builtins_check(cmd->argv[0]) != NULL;
+}
+
+/* Check if a command is a built-in that only prints */
+bool
+builtins_is_stage(struct ast_command *cmd) {
+    const struct builtin *builtin = builtins_check(cmd->argv[0]);
+    return builtin && builtin->stage;
+}
+
 /* Attempt to launch command as a built-in */
 int builtins_try(struct ast_command *cmd) {
-    struct job *job;
-    switch (builtins_check(cmd->argv[0])) {
-        case UNKNOWN:
-            return false;
-        
-        case KILL:
-            if (!(job = get_job(cmd->argv))) break;
-            if (killpg(job->pgid, SIGTERM) == -1)
-                utils_error("killpg: ");
-            break;
-
-        case FG:
-            if (!(job = get_job(cmd->argv))) break;
-            termstate_give_terminal_to(job->has_tty_state ?
-                &job->saved_tty_state : NULL, job->pgid);
-
-            /* Revive the stopped process */
-            if (is_stopped(job))
-                if (killpg(job->pgid, SIGCONT) == -1)
-                    utils_error("killpg: ");
-            job->status = FOREGROUND;
-            print_cmdline(job->pipe);
-            printf("\n");
-
-            /* Wait for new foreground to complete */
-            signal_block(SIGCHLD);
-            wait_for_job(job);
-            signal_unblock(SIGCHLD);
-            break;
-
-        case BG:
-            if (!(job = get_job(cmd->argv))) break;
-            
-            /* Revive the stopped process */
-            if (is_stopped(job))
-                if (killpg(job->pgid, SIGCONT) == -1)
-                    utils_error("killpg: ");
-            job->status = BACKGROUND;
-            print_job(job, false);
-            break;
-
-        case JOBS:
-            print_jobs(true);
-            break;
-        
-        case STOP:
-            if (!(job = get_job(cmd->argv))) break;
-
-            /* Stop the background process */
-            if (!is_stopped(job))
-                if (killpg(job->pgid, SIGTSTP) == -1)
-                    utils_error("killpg: ");
-            break;
-
-        case EXIT:
-            exit(EXIT_SUCCESS);
-            break;
-
-        case HISTORY:;
-            int length = -1;
-            if (cmd->argv[1]) {
-                /* Parse optional parameter */
-                char *end;
-                length = strtol(cmd->argv[1], &end, 10);
-                if (cmd->argv[1] == end || length < 0) {
-                    fprintf(stderr, "%1$s: usage %1$s [len]\n", cmd->argv[0]);
-                    break;
-                }
-            }
-            history_print(length);
-            break;
-
-        case CUSTOM:
-            togglePrompt();
-            break;
-        
-        default:
-            fprintf(stderr, "%s not yet implemented\n", cmd->argv[0]);
+    const struct builtin *builtin = builtins_check(cmd->argv[0]);
+    if (!builtin)
+        return false;
+    launch_last_status = builtin->run(cmd);
+    return true;
+}
+
+/* Run a built-in that is one stage of a pipeline, see builtins.h */
+bool
+builtins_capture(struct ast_command *cmd, char **out, size_t *len,
+    int *status) {
+    const struct builtin *builtin = builtins_check(cmd->argv[0]);
+    if (!builtin)
+        return false;
+
+    FILE *memory = open_memstream(out, len);
+    if (memory == NULL)
+        utils_fatal_error("open_memstream: ");
+    if (!builtin->stage) {
+        fprintf(stderr, "%s: cannot be part of a pipeline\n", cmd->argv[0]);
+        *status = 2;
     }
+    else {
+        /* Whatever the built-in prints goes to memory instead */
+        fflush(stdout);
+        FILE *saved = stdout;
+        stdout = memory;
+        *status = builtin->run(cmd);
+        stdout = saved;
+    }
+    if (fclose(memory) == EOF)
+        utils_fatal_error("fclose: ");
     return true;
-}
\ No newline at end of file
+}
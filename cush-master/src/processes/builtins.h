@@ -1,7 +1,31 @@
+#include <stdbool.h>
+#include <stddef.h>
 #include "../shell-ast.h"
 
+/* Prepare the lookup of built-in names; call once at startup */
+void builtins_init(void);
+
 /**
  * Check if the given command is a built-in,
  * and perform appropriate actions if it is.
  */
-int builtins_try(struct ast_command *cmd);
\ No newline at end of file
+int builtins_try(struct ast_command *cmd);
+
+/* Check if the command is a built-in, without running it */
+bool builtins_is_builtin(struct ast_command *cmd);
+
+/**
+ * Check if the command is a built-in that only prints, and so may
+ * run as a stage of a pipeline, see builtins_capture.
+ */
+bool builtins_is_stage(struct ast_command *cmd);
+
+/**
+ * Run a built-in as one stage of a pipeline. Built-ins do not read
+ * their input; what they print is collected in a buffer, which the
+ * caller must free, and their exit status is stored in status.
+ * Built-ins that act on the shell itself, such as `cd` or `fg`,
+ * only report an error. Returns false if cmd is not a built-in.
+ */
+bool builtins_capture(struct ast_command *cmd, char **out, size_t *len,
+    int *status);
@@ -9,12 +9,15 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
 
 #include "handlers.h"
 #include "jobs.h"
 #include "pid.h"
 #include "../signal_support.h"
 #include "../termstate_management.h"
+#include "../utils.h"
 
 
 /**
@@ -27,26 +30,38 @@
  * Step 3. Update the job status accordingly, and adjust
  *         num_processes_alive if appropriate.
  *         If a process was stopped, save the terminal state.
+ * Step 4. Add the resources used by a terminated process to the job.
+ * Step 5. Once no process is left, queue the job for deletion.
  */
 void
-handle_child_status(pid_t pid, int status)
+handle_child_status(pid_t pid, int status, const struct rusage *usage)
 {
     assert(signal_is_blocked(SIGCHLD));
     /* Note: Removing the job here would cause
     a use-after-free error in wait_for_job. */
 
     /* 1. Retrieve the pid->job correspondence */
-    struct job *job = get_job_from_pid(pid, false);
+    /* A terminated pid may be reused, so forget it right away */
+    bool terminated = WIFEXITED(status) || WIFSIGNALED(status);
+    struct job *job = get_job_from_pid(pid, terminated);
     if (job == NULL) {
         fprintf(stderr, "PID record does not exist\n");
         return;
     }
 
     /* 2. Determine what to do based on status */
+    if (pid == job->last_pid) {
+        if (WIFEXITED(status))
+            job->exit_status = WEXITSTATUS(status);
+        else if (WIFSIGNALED(status))
+            job->exit_status = 128 + WTERMSIG(status);
+    }
+    if (terminated && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+        job->num_failed++;
 
     /* Process exited on its own terms */
     if (WIFEXITED(status)) {
-        bool completed = --job->num_processes_alive <= 0;
+        --job->num_processes_alive;
         switch (job->status) {
             case FOREGROUND:
                 if (WEXITSTATUS(status) == 0) {
@@ -54,9 +69,6 @@ handle_child_status(pid_t pid, int status)
                 }
                 break;
             case BACKGROUND:
-                if (completed) {
-                    /* TODO: Queue response */
-                }
                 break;
             default:
                 fprintf(stderr, "Process in status %s was still running",
@@ -70,7 +82,7 @@ handle_child_status(pid_t pid, int status)
         --job->num_processes_alive;
         int sig = WTERMSIG(status);
         switch (sig) {
-            case SIGINT:    break;
+            case SIGINT:    job->interrupted = true; break;
             default:        fprintf(stderr, "%s\n", strsignal(sig));
         }
     }
@@ -106,36 +118,53 @@ handle_child_status(pid_t pid, int status)
     else {
         fprintf(stderr, "Unchecked status: %d\n", status);
     }
+
+    /* 4. Only terminated processes report their final usage */
+    if (terminated) {
+        add_job_usage(job, usage);
+        mark_stage_exited(job, pid);
+    }
+
+    /* 5. Leave the job to the main loop to report and delete */
+    if (terminated && job->num_processes_alive == 0)
+        queue_completed_job(job);
 }
 
 /*
  * Suggested SIGCHLD handler.
  *
- * Call waitpid() to learn about any child processes that
+ * Call wait4() to learn about any child processes that
  * have exited or changed status (been stopped, needed the
  * terminal, etc.)
  * Just record the information by updating the job list
  * data structures.  Since the call may be spurious (e.g.
  * an already pending SIGCHLD is delivered even though
  * a foreground process was already reaped), ignore when
- * waitpid returns -1.
+ * wait4 returns -1. Unlike waitpid, wait4 also reports the
+ * resources used by a terminated child.
  * Use a loop with WNOHANG since only a single SIGCHLD
  * signal may be delivered for multiple children that have
  * exited. All of them need to be reaped.
  */
 static void
-sigchld_handler(int sig, siginfo_t *info, void *_ctxt)
+reap_children(void)
 {
     pid_t child;
     int status;
+    struct rusage usage;
 
-    assert(sig == SIGCHLD);
-
-    while ((child = waitpid(-1, &status, WUNTRACED|WNOHANG)) > 0) {
-        handle_child_status(child, status);
+    while ((child = wait4(-1, &status, WUNTRACED|WNOHANG, &usage)) > 0) {
+        handle_child_status(child, status, &usage);
     }
 }
 
+static void
+sigchld_handler(int sig, siginfo_t *info, void *_ctxt)
+{
+    assert(sig == SIGCHLD);
+    reap_children();
+}
+
 /*
  * SIGINT (^C) handler.
  *
@@ -150,11 +179,25 @@ sigint_handler(int sig, siginfo_t *info, void *_ctxt)
     assert(sig == SIGINT);
 
     /* Soft-reset by jumping to the top of the main.c loop */
-    free(prompt);
     if (prompt_jump_active)
         siglongjmp(prompt_jump, SIGINT);
 }
 
+/*
+ * SIGINT (^C) handler for the event loop.
+ *
+ * Only records the interrupt. Since epoll_wait is never restarted,
+ * the main loop sees EINTR and resets the line buffer itself.
+ */
+volatile sig_atomic_t prompt_interrupted;
+
+static void
+sigint_flag_handler(int sig, siginfo_t *info, void *_ctxt)
+{
+    assert(sig == SIGINT);
+    prompt_interrupted = true;
+}
+
 /**
  * Initialize all signal handlers.
  * 
@@ -169,4 +212,61 @@ handlers_init(void)
     /* Hard-ignore the signal to avoid printing ^Z */
     /* Don't forget to unignore in spawned children*/
     signal(SIGTSTP, SIG_IGN);
-}
\ No newline at end of file
+}
+
+/**
+ * Initialize signal handling for the event loop.
+ *
+ * SIGCHLD is held blocked for the lifetime of the shell and
+ * delivered through the returned signalfd instead, so that child
+ * status changes are processed synchronously by the main loop.
+ */
+int
+handlers_init_event_loop(void)
+{
+    signal_hold(SIGCHLD);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1)
+        utils_fatal_error("signalfd: ");
+
+    signal_set_handler(SIGINT, sigint_flag_handler);
+    signal(SIGTSTP, SIG_IGN);
+    return fd;
+}
+
+/**
+ * Consume pending SIGCHLD notifications from the signalfd and
+ * reap every child whose status changed.
+ */
+void
+handlers_reap_events(int fd)
+{
+    /* Several SIGCHLDs may coalesce, so the count is meaningless */
+    struct signalfd_siginfo info[8];
+    while (read(fd, info, sizeof info) > 0)
+        continue;
+    reap_children();
+}
+
+/**
+ * Initialize signals for batch mode.
+ *
+ * No terminal is involved, so SIGINT and SIGTSTP keep their default
+ * actions. SIGCHLD is held blocked and children are reaped by
+ * polling through handlers_reap between commands.
+ */
+void
+handlers_init_batch(void)
+{
+    signal_hold(SIGCHLD);
+}
+
+/* Reap all children whose status changed, without waiting */
+void
+handlers_reap(void)
+{
+    reap_children();
+}
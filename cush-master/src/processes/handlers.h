@@ -1,13 +1,32 @@
 #include <unistd.h>
 #include <setjmp.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 
-extern char * prompt;
 extern sigjmp_buf prompt_jump;
 extern volatile sig_atomic_t prompt_jump_active;
 
+/* Set by SIGINT in the event loop; cleared by the main loop */
+extern volatile sig_atomic_t prompt_interrupted;
+
 /* SIGCHLD handler may also be called when waiting */
-void handle_child_status(pid_t pid, int status);
+void handle_child_status(pid_t pid, int status, const struct rusage *usage);
 
 /* Initialize all signal handlers */
-void handlers_init(void);
\ No newline at end of file
+void handlers_init(void);
+
+/**
+ * Initialize signals for the event loop instead of handlers_init.
+ * Returns a signalfd that becomes readable when children change
+ * status; pass it to handlers_reap_events.
+ */
+int handlers_init_event_loop(void);
+
+/* Reap all children after the signalfd became readable */
+void handlers_reap_events(int fd);
+
+/* Initialize signals for batch mode instead of handlers_init */
+void handlers_init_batch(void);
+
+/* Reap all children whose status changed, without waiting */
+void handlers_reap(void);
\ No newline at end of file
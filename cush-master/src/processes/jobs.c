@@ -1,62 +1,161 @@
 /**
  * Utility functions for job list management.
- * We use 2 data structures: 
+ * We use 4 data structures:
  * (a) an array jid2job to quickly find a job based on its id
  * (b) a linked list to support iteration
+ * (c) a min-heap of released ids to quickly find the lowest free one
+ * (d) a lock-free stack of completed jobs, pushed by the SIGCHLD
+ *     handler and drained by the main loop
  * 
  * Note: originally located in cush.c (all but delete_jobs)
  * Moved here for easier imports from student code,
  * which is located outside of cush.c for better separation.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/wait.h>
+#include <sys/time.h>
 #include <assert.h>
 #include <limits.h>
+#include <errno.h>
+#include <stdatomic.h>
 
 #include "jobs.h"
 #include "handlers.h"
+#include "pid.h"
+#include "placement.h"
+#include "budget.h"
 #include "../shell-ast.h"
 #include "../signal_support.h"
 #include "../utils.h"
 
 
-#define MAXJOBS (1<<16)
 static struct list job_list;
 
-static struct job * jid2job[MAXJOBS];
+/* Grown on demand: ids [1, next_jid) have been handed out before */
+static struct job ** jid2job;
+static int jid_capacity;
+static int next_jid = 1;
+
+/* Ids below next_jid that were released, smallest on top */
+static int * free_jids;
+static int free_count;
+static int free_capacity;
+
+/* Completed jobs, most recent first; linked through next_completed */
+static _Atomic(struct job *) completed_jobs;
+_Static_assert(ATOMIC_POINTER_LOCK_FREE == 2,
+    "the completion queue must be signal-safe");
+
+/* Grow an array to hold at least 'needed' items, doubling its size */
+static void *
+grow(void *array, int *capacity, int needed, size_t size)
+{
+    if (needed <= *capacity)
+        return array;
+    int n = *capacity ? *capacity : 16;
+    while (n < needed) {
+        if (n > INT_MAX / 2) {
+            fprintf(stderr, "Maximum number of jobs exceeded\n");
+            abort();
+        }
+        n *= 2;
+    }
+    array = realloc(array, n * size);
+    if (array == NULL)
+        utils_fatal_error("realloc: ");
+    *capacity = n;
+    return array;
+}
+
+/* Add a released id to the heap */
+static void
+push_free_jid(int jid)
+{
+    free_jids = grow(free_jids, &free_capacity, free_count + 1,
+        sizeof *free_jids);
+    int i = free_count++;
+    while (i > 0 && free_jids[(i - 1) / 2] > jid) {
+        free_jids[i] = free_jids[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    free_jids[i] = jid;
+}
+
+/* Remove and return the smallest released id */
+static int
+pop_free_jid(void)
+{
+    int top = free_jids[0];
+    int last = free_jids[--free_count];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= free_count)
+            break;
+        if (child + 1 < free_count && free_jids[child + 1] < free_jids[child])
+            child++;
+        if (last <= free_jids[child])
+            break;
+        free_jids[i] = free_jids[child];
+        i = child;
+    }
+    free_jids[i] = last;
+    return top;
+}
 
 /* Return job corresponding to jid */
 struct job * 
 get_job_from_jid(int jid)
 {
-    if (jid > 0 && jid < MAXJOBS && jid2job[jid] != NULL)
+    if (jid > 0 && jid < next_jid && jid2job[jid] != NULL)
         return jid2job[jid];
 
     return NULL;
 }
 
-/* Add a new job to the job list */
+/**
+ * Add a new job to the job list. The job may outlive the command
+ * line, so it keeps its own compacted copy of the pipeline.
+ */
 struct job *
 add_job(struct ast_pipeline *pipe)
 {
     struct job * job = malloc(sizeof *job);
-    job->pipe = pipe;
+    job->pipe = ast_pipeline_compact(pipe);
     job->pgid = 0;
     job->status = pipe->bg_job ? BACKGROUND : FOREGROUND;
     job->num_processes_alive = 0;
     job->has_tty_state = false;
+    job->last_pid = -1;
+    job->exit_status = 0;
+    job->num_failed = 0;
+    job->interrupted = false;
+    job->usage = (struct job_usage) { .maxrss = 0 };
+    clock_gettime(CLOCK_MONOTONIC, &job->usage.started);
+    job->timed = false;
+    job->queued = false;
+    job->num_stages = list_size(&job->pipe->commands);
+    job->stages = malloc(job->num_stages * sizeof *job->stages);
+    if (job->stages == NULL)
+        utils_fatal_error("malloc: ");
+    for (int i = 0; i < job->num_stages; i++)
+        job->stages[i] = (struct job_stage) { .cpu = -1 };
+    job->budget = NULL;
     list_push_back(&job_list, &job->elem);
-    for (int i = 1; i < MAXJOBS; i++) {
-        if (jid2job[i] == NULL) {
-            jid2job[i] = job;
-            job->jid = i;
-            return job;
-        }
+
+    /* Reuse the lowest released id, or hand out a new one */
+    if (free_count > 0) {
+        job->jid = pop_free_jid();
     }
-    fprintf(stderr, "Maximum number of jobs exceeded\n");
-    abort();
-    return NULL;
+    else {
+        jid2job = grow(jid2job, &jid_capacity, next_jid + 1,
+            sizeof *jid2job);
+        job->jid = next_jid++;
+    }
+    jid2job[job->jid] = job;
+    return job;
 }
 
 /* Delete a job */
@@ -67,39 +166,73 @@ delete_job(struct job *job)
     assert(jid != -1);
     jid2job[jid]->jid = -1;
     jid2job[jid] = NULL;
+    push_free_jid(jid);
+    report_job_time(job);               /* Timed background job */
     ast_pipeline_free(job->pipe);
+    free(job->stages);
+    if (job->budget)
+        budget_destroy(job->budget);
     free(job);
 }
 
-/* Remove all completed jobs */
+/* Queue a job whose processes have all terminated */
+void
+queue_completed_job(struct job *job)
+{
+    if (job->queued)
+        return;
+    job->queued = true;
+
+    struct job *head = atomic_load_explicit(&completed_jobs,
+        memory_order_relaxed);
+    do
+        job->next_completed = head;
+    while (!atomic_compare_exchange_weak_explicit(&completed_jobs, &head,
+        job, memory_order_release, memory_order_relaxed));
+}
+
+/* Print a finished job the way `jobs` would list it */
+static void
+print_done(struct job *job)
+{
+    if (job->exit_status == 0)
+        printf("[%d]\tDone\t\t(", job->jid);
+    else
+        printf("[%d]\tExit %d\t\t(", job->jid, job->exit_status);
+    print_cmdline(job->pipe);
+    printf(")\n");
+}
+
+/* Delete the jobs on the completion queue */
 int
-delete_jobs(void) {
-    int unblock;
-    if ((unblock = !signal_is_blocked(SIGCHLD)))
-        signal_block(SIGCHLD);
+delete_jobs(bool notify) {
+    struct job *job = atomic_exchange_explicit(&completed_jobs, NULL,
+        memory_order_acquire);
+
+    /* Reverse into the order in which the jobs completed */
+    struct job *done = NULL;
+    while (job) {
+        struct job *next = job->next_completed;
+        job->next_completed = done;
+        done = job;
+        job = next;
+    }
 
     int deleted = 0;
-    for (struct list_elem * e = list_begin (&job_list);
-        e != list_end (&job_list); ) {
-        struct job *job = list_entry(e, struct job, elem);
+    for (; done; done = job) {
+        job = done->next_completed;
+        done->queued = false;
 
-        switch (job->num_processes_alive) {
-            case INT_MIN ... -1:
-                fprintf(stderr, "Extra SIGCHLD caught\n");
-            case 0:
-                /* Delete the job */
-                e = list_remove (e);
-                delete_job(job);
-                deleted++;
-                break;
-            default:
-                e = list_next (e);
-                break;
-        }
+        /* `parallel` starts new processes in a job that ran dry */
+        if (done->num_processes_alive > 0)
+            continue;
+        if (notify && done->status != FOREGROUND)
+            print_done(done);
+        list_remove(&done->elem);
+        delete_job(done);
+        deleted++;
     }
-    
-    if (unblock)
-        signal_unblock(SIGCHLD);
+    delete_pids();
     return deleted;
 }
 
@@ -145,19 +278,94 @@ print_cmdline(struct ast_pipeline *pipeline)
     }
 }
 
-/* Print all jobs */
+/* Print all jobs, with their resource usage and placement if requested */
 void
-print_jobs(int verbose)
+print_jobs(int verbose, bool usage)
 {
     for (struct list_elem * e = list_begin (&job_list);
         e != list_end (&job_list);
         e = list_next (e)) {
         struct job *job = list_entry(e, struct job, elem);
-        if (job->num_processes_alive > 0)
+        if (job->num_processes_alive > 0) {
             print_job(job, verbose);
+            if (job->budget)
+                budget_print(job, stdout);
+            if (usage) {
+                print_job_usage(job, stdout);
+                placement_print(job, stdout);
+            }
+        }
     }
 }
 
+/* Number of jobs with processes alive, as `jobs` would list */
+int
+count_jobs(void)
+{
+    int count = 0;
+    for (struct list_elem * e = list_begin (&job_list);
+        e != list_end (&job_list);
+        e = list_next (e)) {
+        struct job *job = list_entry(e, struct job, elem);
+        if (job->num_processes_alive > 0)
+            count++;
+    }
+    return count;
+}
+
+/* Account for a terminated process of this job */
+void
+add_job_usage(struct job *job, const struct rusage *ru)
+{
+    struct job_usage *u = &job->usage;
+    timeradd(&u->utime, &ru->ru_utime, &u->utime);
+    timeradd(&u->stime, &ru->ru_stime, &u->stime);
+    if (ru->ru_maxrss > u->maxrss)
+        u->maxrss = ru->ru_maxrss;
+    u->nvcsw += ru->ru_nvcsw;
+    u->nivcsw += ru->ru_nivcsw;
+    if (job->num_processes_alive <= 0)
+        clock_gettime(CLOCK_MONOTONIC, &u->finished);
+}
+
+/* Note that the process running one of the job's stages terminated */
+void
+mark_stage_exited(struct job *job, pid_t pid)
+{
+    for (int i = 0; i < job->num_stages; i++)
+        if (job->stages[i].pid == pid)
+            job->stages[i].exited = true;
+}
+
+/* Print a job's resource usage; running jobs show their age */
+void
+print_job_usage(struct job *job, FILE *out)
+{
+    struct job_usage *u = &job->usage;
+    struct timespec end = u->finished;
+    if (job->num_processes_alive > 0)
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double real = (end.tv_sec - u->started.tv_sec)
+        + (end.tv_nsec - u->started.tv_nsec) / 1e9;
+    fprintf(out, "\treal %.3fs\tuser %ld.%03lds\tsys %ld.%03lds"
+        "\tmaxrss %ldk\tcsw %ld/%ld\n",
+        real,
+        (long) u->utime.tv_sec, (long) u->utime.tv_usec / 1000,
+        (long) u->stime.tv_sec, (long) u->stime.tv_usec / 1000,
+        u->maxrss, u->nvcsw, u->nivcsw);
+}
+
+/* Report the usage of a finished job started with `time` */
+void
+report_job_time(struct job *job)
+{
+    if (!job->timed || job->num_processes_alive > 0)
+        return;
+    job->timed = false;
+    print_job_usage(job, stderr);
+}
+
 /* Print a job */
 void
 print_job(struct job *job, int verbose)
@@ -183,13 +391,53 @@ jobs_init(void)
 /* Wait for all processes in this job to complete */
 void
 wait_for_job(struct job *job)
+{
+    wait_for_job_slots(job, 1);
+}
+
+/* Whether some process of this job may still change status */
+static bool
+is_running(struct job *job)
+{
+    return job->num_processes_alive > 0 && !is_stopped(job);
+}
+
+/* Wait until no job has processes running */
+void
+wait_for_background_jobs(void)
+{
+    assert(signal_is_blocked(SIGCHLD));
+
+    /* Jobs are not removed meanwhile, so each is passed over once */
+    struct list_elem *e = list_begin (&job_list);
+    for (;;) {
+        while (e != list_end (&job_list)
+               && !is_running(list_entry(e, struct job, elem)))
+            e = list_next (e);
+        if (e == list_end (&job_list))
+            break;
+
+        int status;
+        struct rusage usage;
+        pid_t child = wait4(-1, &status, WUNTRACED, &usage);
+        if (child != -1)
+            handle_child_status(child, status, &usage);
+        else if (errno != EINTR)
+            utils_fatal_error("waitpid failed: ");
+    }
+}
+
+/* Wait until fewer than 'limit' processes of this job are alive */
+void
+wait_for_job_slots(struct job *job, int limit)
 {
     assert(signal_is_blocked(SIGCHLD));
 
-    while (job->status == FOREGROUND && job->num_processes_alive > 0) {
+    while (job->status == FOREGROUND && job->num_processes_alive >= limit) {
         int status;
+        struct rusage usage;
 
-        pid_t child = waitpid(-1, &status, WUNTRACED);
+        pid_t child = wait4(-1, &status, WUNTRACED, &usage);
 
         // When called here, any error returned by waitpid indicates a logic
         // bug in the shell.
@@ -201,7 +449,7 @@ wait_for_job(struct job *job)
         // Since SIGCHLD is blocked, there cannot be races where a child's exit
         // was handled via the SIGCHLD signal handler.
         if (child != -1)
-            handle_child_status(child, status);
+            handle_child_status(child, status, &usage);
         else
             utils_fatal_error("waitpid failed, see code for explanation: ");
     }
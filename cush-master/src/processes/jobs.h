@@ -1,10 +1,17 @@
 #ifndef __JOB_H
 #define __JOB_H
 
+#include <stdio.h>
+#include <stdbool.h>
 #include <termios.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
 
 #include "../list.h"
 
+struct job_budget;                  /* See budget.h */
+
 enum job_status {
     FOREGROUND,     /* job is running in foreground.  Only one job can be
                        in the foreground state. */
@@ -14,15 +21,44 @@ enum job_status {
                        and requires exclusive terminal access */
 };
 
+/* Resources used by a job, summed over its terminated processes */
+struct job_usage {
+    struct timespec started;        /* When the job was launched */
+    struct timespec finished;       /* When its last process was reaped */
+    struct timeval utime, stime;    /* User and system CPU time */
+    long    maxrss;                 /* Largest resident set of any process, in KB */
+    long    nvcsw, nivcsw;          /* Voluntary and involuntary context switches */
+};
+
+/* One stage of a job's pipeline, and where it runs */
+struct job_stage {
+    pid_t   pid;                    /* Process running it, 0 if none was started */
+    bool    exited;                 /* That process has terminated */
+    int     cpu;                    /* CPU it is pinned to, or -1 */
+    int     nice;                   /* Niceness added by `pin` */
+    bool    batch;                  /* Scheduled as SCHED_BATCH */
+};
+
 struct job {
     struct list_elem elem;          /* Link element for jobs list. */
-    struct ast_pipeline *pipe;      /* The pipeline of commands this job represents */
+    struct ast_pipeline *pipe;      /* Compacted copy of the pipeline this job represents */
     int     jid;                    /* Job id. */
     int     pgid;                   /* The group id of all processes in this job */
     enum job_status status;         /* Job status. */ 
     int  num_processes_alive;       /* The number of processes that we know to be alive */
     struct termios saved_tty_state; /* The state of the terminal when this job was */
     int has_tty_state;              /* stopped after having been in foreground */
+    pid_t   last_pid;               /* Process running the last command */
+    int     exit_status;            /* Exit status of that process */
+    int     num_failed;             /* Processes that exited nonzero or were killed */
+    bool    interrupted;            /* A process was killed by ^C */
+    struct job_usage usage;         /* Accounting, see add_job_usage */
+    struct job_stage *stages;       /* One per command of the pipeline */
+    int     num_stages;
+    struct job_budget *budget;      /* Set by `limit`, or NULL */
+    bool    timed;                  /* Report usage on completion (`time`) */
+    bool    queued;                 /* On the completion queue, see below */
+    struct job *next_completed;     /* Next job on the completion queue */
 };
 
 /* Check against several possible stopped states */
@@ -37,9 +73,27 @@ void jobs_init(void);
 /* Return job corresponding to jid */
 struct job * get_job_from_jid(int jid);
 
-/* Add a new job to the job list */
+/* Add a new job to the job list, copying the pipeline */
 struct job * add_job(struct ast_pipeline *pipe);
 
+/**
+ * Account for a terminated process of this job, as reported by
+ * wait4(). Stamps the finishing time once no process is alive.
+ */
+void add_job_usage(struct job *job, const struct rusage *ru);
+
+/* Note that the process running one of the job's stages terminated */
+void mark_stage_exited(struct job *job, pid_t pid);
+
+/* Print a job's wall time, CPU times, max RSS and context switches */
+void print_job_usage(struct job *job, FILE *out);
+
+/**
+ * Print the usage of a job started with `time` to stderr once all
+ * its processes have terminated. Reports each job only once.
+ */
+void report_job_time(struct job *job);
+
 /**
  * Delete a job.
  * This should be called only when all processes that were
@@ -48,16 +102,29 @@ struct job * add_job(struct ast_pipeline *pipe);
 void delete_job(struct job *job);
 
 /**
- * Remove all completed jobs.
- * Allows removal of jobs from outside of signal handlers.
+ * Queue a job all of whose processes have terminated, for the main
+ * loop to delete. Lock-free, so the SIGCHLD handler may call it;
+ * elsewhere SIGCHLD must be blocked. A job is queued only once.
+ */
+void queue_completed_job(struct job *job);
+
+/**
+ * Delete the jobs on the completion queue, in the order they
+ * completed, and return how many there were. If notify is set,
+ * jobs that did not finish in the foreground are reported as
+ * `[N] Done`. Costs O(completed jobs), not O(all jobs), and may be
+ * called with SIGCHLD unblocked.
  */
-int delete_jobs(void);
+int delete_jobs(bool notify);
 
 /* Print the command line that belongs to one job. */
 void print_cmdline(struct ast_pipeline *pipeline);
 
-/* Print all jobs */
-void print_jobs(int verbose);
+/* Print all jobs, with their resource usage and placement if requested */
+void print_jobs(int verbose, bool usage);
+
+/* Number of jobs with processes alive */
+int count_jobs(void);
 
 /* Print a job */
 void print_job(struct job *job, int verbose);
@@ -70,7 +137,7 @@ void print_job(struct job *job, int verbose);
  * 'fg' command.
  * 
  * Implement handle_child_status such that it records the 
- * information obtained from waitpid() for pid 'child.'
+ * information obtained from wait4() for pid 'child.'
  *
  * If a process exited, it must find the job to which it
  * belongs and decrement num_processes_alive.
@@ -88,4 +155,17 @@ void print_job(struct job *job, int verbose);
  */
 void wait_for_job(struct job *job);
 
+/**
+ * Like wait_for_job, but return as soon as fewer than 'limit'
+ * processes of the job are alive, so that a new one may be started.
+ */
+void wait_for_job_slots(struct job *job, int limit);
+
+/**
+ * Wait until no job has processes running, as for the `wait`
+ * built-in. Stopped jobs are not waited for. Requires SIGCHLD to
+ * be blocked, like wait_for_job.
+ */
+void wait_for_background_jobs(void);
+
 #endif /* __JOB_H */
\ No newline at end of file
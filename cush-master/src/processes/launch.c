@@ -1,14 +1,24 @@
 /**
  * Code that receives parsed commands and launches them.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <spawn.h>
 #include <sys/wait.h>
 
 #include "launch.h"
 #include "pid.h"
+#include "pathcache.h"
+#include "relay.h"
 #include "builtins.h"
+#include "placement.h"
+#include "budget.h"
+#include "handlers.h"
 #include "../signal_support.h"
 #include "../termstate_management.h"
 #include "../utils.h"
@@ -16,6 +26,27 @@
 #define READ_END 0
 #define WRITE_END 1
 
+/* Largest pipe a built-in's output may ask for, the default limit */
+#define PIPE_GROW_MAX (1 << 20)
+
+/* Spawning a terminal owner requires glibc 2.35 or later */
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 35)
+#define HAVE_SPAWN_TCSETPGRP
+#endif
+#endif
+
+extern char **environ;
+
+/* Always launch children through fork(), see launch.h */
+bool launch_force_fork = false;
+
+/* Exit status of the most recent foreground pipeline */
+int launch_last_status;
+
+/* How long the most recent command line took */
+double launch_last_duration;
+
 
 /* Close file descriptors only when they are not STDIN or STDOUT */
 static void
@@ -31,31 +62,79 @@ try_close(int fd_in, int fd_out) {
 }
 
 /**
- * Launch the parsed command and associate it with the given job
- * Additionally accept file descriptors used as STDIN and STDOUT
+ * Fork a child that joins the job's process group and, as the
+ * leader of a foreground job, takes the terminal. Both the parent
+ * and the child return, as from fork().
  */
-static void
-launch_command(struct ast_command *cmd, struct job *job, int fd_in,
-    int fd_out) {
-    /* Child may exit even before the parent returns from fork() */
-    signal_block(SIGCHLD);
-
-    /* Regular commands: spawn several dedicated child processes */    
+static pid_t
+fork_child(struct job *job) {
     pid_t child_pid = fork();
     if (child_pid == -1)
         utils_fatal_error("creating a child process failed: ");
     
     /* Set PGID in both the parent and child, for extra security */
-    if (setpgid(child_pid, job->pgid) == -1)
+    /* EACCES: the child got to exec first, after setting its own */
+    if (setpgid(child_pid, job->pgid) == -1
+        && !(child_pid > 0 && errno == EACCES))
         utils_error("setpgid: ");
 
-    /* Execute requested program by replacing the forked process */
     if (child_pid == 0) {
         if (job->pgid == 0 && !job->pipe->bg_job)
             /* Though a system call, getpid is always successful */
             termstate_give_terminal_to(NULL, getpid());
-        signal(SIGTSTP, SIG_DFL);       /* Reset back to default */
-        signal_unblock(SIGCHLD);        /* Inherited across exec */
+        /* Reset back to default. Relays and builtin helpers never
+         * exec, so would otherwise keep running the shell's handlers
+         * and could jump back to its prompt on ^C */
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        prompt_jump_active = false;
+        signal_release(SIGCHLD);        /* Inherited across exec */
+    }
+    return child_pid;
+}
+
+/**
+ * Arguments that run a script without a #! line with /bin/sh,
+ * as execvp(3) does when the kernel refuses it with ENOEXEC.
+ */
+static char **
+script_argv(const char *path, char **argv) {
+    size_t n = 0;
+    while (argv[n])
+        n++;
+    char **sh = malloc((n + 2) * sizeof *sh);
+    if (sh == NULL)
+        utils_fatal_error("malloc: ");
+    sh[0] = "/bin/sh";
+    sh[1] = (char *) path;
+    memcpy(sh + 2, argv + 1, n * sizeof *sh);   /* With the NULL */
+    return sh;
+}
+
+/**
+ * Fork a child that runs the program at path, or relays its input
+ * if path is NULL. A failed exec sends its errno back through a
+ * close-on-exec pipe, which a successful one closes, so the parent
+ * knows the outcome before it returns. Such a child has run
+ * nothing and is reaped right away; its errno is left in *err.
+ */
+static pid_t
+fork_exec(struct ast_command *cmd, const char *path, struct job *job,
+    struct job_stage *stage, int fd_in, int fd_out, int *err) {
+    int report[2];
+    if (path && pipe2(report, O_CLOEXEC) == -1)
+        utils_fatal_error("pipe2: ");
+    pid_t child_pid = fork_child(job);
+
+    /* Execute requested program by replacing the forked process */
+    if (child_pid == 0) {
+        if (job->budget)
+            budget_apply(job->budget);  /* See budget.h */
+        if (stage)
+            placement_apply(stage);     /* See placement.h */
         if (dup2(fd_in, STDIN_FILENO) == -1)
             utils_error("dup2: ");      /* Redirect input stream */
         if (dup2(fd_out, STDOUT_FILENO) == -1)
@@ -65,27 +144,372 @@ launch_command(struct ast_command *cmd, struct job *job, int fd_in,
                 utils_error("dup2: ");  /* Also the error stream */
         }
         try_close(fd_in, fd_out);
-        if (execvp(cmd->argv[0], cmd->argv) == -1)
-            utils_fatal_error("%s: ", cmd->argv[0]);
+        if (path == NULL)
+            relay_run(cmd);             /* Does not return */
+        close(report[0]);
+        execv(path, cmd->argv);         /* Resolved by the parent */
+        if (errno == ENOEXEC)
+            execv("/bin/sh", script_argv(path, cmd->argv));
+        int error = errno;
+        if (write(report[1], &error, sizeof error) != sizeof error)
+            utils_error("write: ");
+        _exit(127);
+    }
+
+    *err = 0;
+    if (path == NULL)
+        return child_pid;
+    close(report[1]);
+    ssize_t n;
+    while ((n = read(report[0], err, sizeof *err)) == -1 && errno == EINTR)
+        ;
+    close(report[0]);
+    if (n != sizeof *err) {
+        *err = 0;                       /* Closed by exec */
+        return child_pid;
+    }
+    if (waitpid(child_pid, NULL, 0) == -1)
+        utils_error("waitpid: ");
+    return -1;
+}
+
+/**
+ * Create a child with a full fork() and set it up before exec.
+ * Required whenever the child must run code of its own. Without
+ * a path, the child relays its input instead, see relay.h.
+ * Returns -1 if the program could not be run.
+ */
+static pid_t
+fork_command(struct ast_command *cmd, const char *path, struct job *job,
+    struct job_stage *stage, int fd_in, int fd_out) {
+    int err;
+    pid_t child_pid = fork_exec(cmd, path, job, stage, fd_in, fd_out, &err);
+
+    /* The cached path may be stale, so look it up once more */
+    if (err != 0 && pathcache_forget(cmd->argv[0])) {
+        path = pathcache_lookup(cmd->argv[0]);
+        if (path == NULL)
+            err = ENOENT;
+        else
+            child_pid = fork_exec(cmd, path, job, stage, fd_in, fd_out, &err);
+    }
+    if (err != 0) {
+        errno = err;
+        utils_error("%s: ", cmd->argv[0]);
+        return -1;
+    }
+    return child_pid;
+}
+
+/**
+ * Start the program with posix_spawn, running a script without a
+ * #! line with /bin/sh, as fork_exec does. Returns an errno value.
+ */
+static int
+spawn_path(pid_t *child_pid, const char *path, char **argv,
+    const posix_spawn_file_actions_t *actions,
+    const posix_spawnattr_t *attr) {
+    int rc = posix_spawn(child_pid, path, actions, attr, argv, environ);
+    if (rc == ENOEXEC) {
+        char **sh = script_argv(path, argv);
+        rc = posix_spawn(child_pid, "/bin/sh", actions, attr, sh, environ);
+        free(sh);
+    }
+    return rc;
+}
+
+/**
+ * Create a child with posix_spawn, which uses vfork semantics and
+ * so does not copy the shell's page tables. All setup that the
+ * forked child does by hand is expressed as spawn attributes and
+ * file actions instead. Returns -1 if the program could not be run.
+ */
+static pid_t
+spawn_command(struct ast_command *cmd, const char *path, struct job *job,
+    struct job_stage *stage, int fd_in, int fd_out) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&actions);
+
+    /* Join (or start) the job's process group */
+    short flags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF
+        | POSIX_SPAWN_SETSIGMASK;
+    posix_spawnattr_setpgroup(&attr, job->pgid);
+
+    /* Reset SIGTSTP back to default, and start with nothing blocked */
+    sigset_t sigdef, sigmask;
+    sigemptyset(&sigdef);
+    sigaddset(&sigdef, SIGTSTP);
+    posix_spawnattr_setsigdefault(&attr, &sigdef);
+    sigemptyset(&sigmask);
+    posix_spawnattr_setsigmask(&attr, &sigmask);
+    posix_spawnattr_setflags(&attr, flags);
+
+    /* Foreground group leader takes the terminal before exec */
+    int tty = termstate_get_tty_fd();
+    if (job->pgid == 0 && !job->pipe->bg_job && tty != -1)
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, tty);
+
+    /* Same redirections as in fork_command */
+    if (fd_in != STDIN_FILENO)
+        posix_spawn_file_actions_adddup2(&actions, fd_in, STDIN_FILENO);
+    if (fd_out != STDOUT_FILENO)
+        posix_spawn_file_actions_adddup2(&actions, fd_out, STDOUT_FILENO);
+    if (cmd->dup_stderr_to_stdout)
+        posix_spawn_file_actions_adddup2(&actions, fd_out, STDERR_FILENO);
+    if (fd_in != STDIN_FILENO)
+        posix_spawn_file_actions_addclose(&actions, fd_in);
+    if (fd_out != STDOUT_FILENO)
+        posix_spawn_file_actions_addclose(&actions, fd_out);
+
+    /* A placed child starts where the shell moves to, see placement.h */
+    struct placement_saved shell;
+    bool placed = stage && placement_enter(stage, &shell);
+
+    pid_t child_pid;
+    int rc = spawn_path(&child_pid, path, cmd->argv, &actions, &attr);
+
+    /* The cached path may be stale, so look it up once more */
+    if (rc != 0 && pathcache_forget(cmd->argv[0])) {
+        path = pathcache_lookup(cmd->argv[0]);
+        rc = path == NULL ? ENOENT
+            : spawn_path(&child_pid, path, cmd->argv, &actions, &attr);
     }
-    add_pid_to_job(child_pid, job);     /* Needs SIGCHLD blocked */
-    job->num_processes_alive++;
-    signal_unblock(SIGCHLD);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (placed)
+        placement_leave(&shell);
+    if (rc != 0) {
+        errno = rc;
+        utils_error("%s: ", cmd->argv[0]);
+        return -1;
+    }
+    if (stage)
+        placement_renice(child_pid, stage);
+    return child_pid;
+}
+
+/* Check if the child has to run code that posix_spawn cannot express */
+static bool
+needs_fork(struct ast_command *cmd, struct job *job) {
+    if (launch_force_fork)
+        return true;
+    /* Child sets its limits and joins the job's cgroup */
+    if (job->budget)
+        return true;
+#ifndef HAVE_SPAWN_TCSETPGRP
+    /* Child would have to take the terminal by itself */
+    if (job->pgid == 0 && !job->pipe->bg_job && termstate_get_tty_fd() != -1)
+        return true;
+#endif
+    return false;
+}
+
+/**
+ * Launch the parsed command and associate it with the given job
+ * Additionally accept file descriptors used as STDIN and STDOUT,
+ * and the stage of the pipeline it runs, if any
+ */
+static void
+launch_command(struct ast_command *cmd, struct job *job,
+    struct job_stage *stage, int fd_in, int fd_out) {
+    /* Child may exit even before the parent returns from fork() */
+    bool was_blocked = signal_block(SIGCHLD);
+
+    /* Regular commands: spawn several dedicated child processes */
+    /* The program is found once by the shell, see pathcache.h */
+    pid_t child_pid = -1;
+    const char *path = NULL;
+    if (relay_applies(cmd, fd_in, fd_out)) {
+        /* A plain `cat` is run by a copy of the shell */
+        child_pid = fork_command(cmd, NULL, job, stage, fd_in, fd_out);
+    }
+    else if ((path = pathcache_lookup(cmd->argv[0])) == NULL) {
+        errno = ENOENT;
+        utils_error("%s: ", cmd->argv[0]);
+    }
+    else if (needs_fork(cmd, job)) {
+        child_pid = fork_command(cmd, path, job, stage, fd_in, fd_out);
+    }
+    else {
+        child_pid = spawn_command(cmd, path, job, stage, fd_in, fd_out);
+    }
+
+    if (child_pid != -1) {
+        add_pid_to_job(child_pid, job); /* Needs SIGCHLD blocked */
+        job->num_processes_alive++;
+        if (stage)
+            stage->pid = child_pid;
+    }
+    /* The leader took the terminal, even if its exec failed */
+    if (job->pgid == 0 && !job->pipe->bg_job)
+        termstate_invalidate();
+    job->last_pid = child_pid;          /* Last stage decides status */
+    if (child_pid == -1)
+        job->exit_status = 127;         /* Command not found */
+    if (!was_blocked)
+        signal_unblock(SIGCHLD);
     try_close(fd_in, fd_out);
     if (job->pgid == 0)                 /* Only for group leader */
-        job->pgid = child_pid;
+        job->pgid = child_pid == -1 ? 0 : child_pid;
+}
+
+/* Write as much of the buffer as the descriptor takes, or -1 */
+static ssize_t
+write_some(int fd, const char *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, buf + done, len - done);
+        if (n == -1 && errno == EAGAIN)
+            break;                      /* Non-blocking pipe is full */
+        if (n == -1 && errno != EINTR)
+            return -1;
+        if (n > 0)
+            done += n;
+    }
+    return done;
+}
+
+/**
+ * Run a built-in as one stage of a pipeline, see builtins_capture.
+ * Its output is written by the shell itself: into the pipe to the
+ * next stage, which is first grown to hold all of it if the kernel
+ * allows, or to the file or terminal the pipeline ends in. Only
+ * output that does not fit into the pipe needs a helper process,
+ * which writes the rest while the next stage reads. The read end
+ * of that pipe, fd_next, is closed in the helper, so that it gets
+ * SIGPIPE if the reader quits early. Returns false, doing nothing,
+ * if cmd is not a built-in.
+ */
+static bool
+launch_builtin(struct ast_command *cmd, struct job *job,
+    struct job_stage *stage, int fd_in, int fd_out, int fd_next) {
+    char *buf;
+    size_t len;
+    int status;
+    if (!builtins_capture(cmd, &buf, &len, &status))
+        return false;
+
+    ssize_t written = 0;
+    if (fd_next == -1) {
+        /* Last stage: the builtin's status is the job's */
+        job->last_pid = -1;
+        job->exit_status = status;
+        written = write_some(fd_out, buf, len);
+    }
+    else if (len > 0) {
+        int capacity = fcntl(fd_out, F_GETPIPE_SZ);
+        if (capacity != -1 && (size_t) capacity < len && len <= PIPE_GROW_MAX)
+            fcntl(fd_out, F_SETPIPE_SZ, (int) len);
+        int flags = fcntl(fd_out, F_GETFL);
+        fcntl(fd_out, F_SETFL, flags | O_NONBLOCK);
+        written = write_some(fd_out, buf, len);
+        fcntl(fd_out, F_SETFL, flags);
+    }
+    if (written == -1)
+        utils_error("%s: write: ", cmd->argv[0]);
+
+    else if ((size_t) written < len) {
+        bool was_blocked = signal_block(SIGCHLD);
+        pid_t child_pid = fork_child(job);
+        if (child_pid == 0) {
+            close(fd_next);
+            if (fd_in != STDIN_FILENO)
+                close(fd_in);
+            _exit(write_some(fd_out, buf + written, len - written) == -1);
+        }
+        add_pid_to_job(child_pid, job); /* Needs SIGCHLD blocked */
+        job->num_processes_alive++;
+        stage->pid = child_pid;
+        if (job->pgid == 0) {
+            if (!job->pipe->bg_job)
+                termstate_invalidate();
+            job->pgid = child_pid;
+        }
+        if (!was_blocked)
+            signal_unblock(SIGCHLD);
+    }
+    free(buf);
+    try_close(fd_in, fd_out);
+    return true;
+}
+
+/* Launch a command of an existing job, on the shell's stdin/stdout */
+void
+launch_command_in_job(struct ast_command *cmd, struct job *job) {
+    launch_command(cmd, job, NULL, STDIN_FILENO, STDOUT_FILENO);
 }
 
 /* Spawn and connect several processes */
 static void
 launch_pipeline(struct ast_pipeline *pipeline) {
-    /* Built-ins: run directly */
+    /* A leading `time` asks for the job's usage once it is done */
     struct list_elem *e = list_begin (&pipeline->commands);
-    if (builtins_try(list_entry(e, struct ast_command, elem))) {
-        ast_pipeline_free(pipeline);
+    struct ast_command *first = list_entry(e, struct ast_command, elem);
+    bool timed = strcmp(first->argv[0], "time") == 0 && first->argv[1];
+    if (timed)
+        first->argv++;                  /* Argv lives in the arena */
+
+    /**
+     * A leading `pin` places the stages on CPUs, see placement.h,
+     * and `limit` gives the job a budget, see budget.h. Either may
+     * come first.
+     */
+    struct placement place;
+    struct job_budget budget;
+    bool pinned = false, limited = false;
+    for (;;) {
+        bool ok = true;
+        if (!pinned && strcmp(first->argv[0], "pin") == 0)
+            ok = pinned = placement_parse(&first->argv, &place);
+        else if (!limited && strcmp(first->argv[0], "limit") == 0)
+            ok = limited = budget_parse(&first->argv, &budget);
+        else
+            break;
+        if (!ok) {
+            launch_last_status = 2;
+            return;
+        }
+    }
+
+    /**
+     * Built-ins on their own: run directly, and set the status.
+     * Those that only print honor redirections as pipeline stages.
+     */
+    bool lone = e == list_back (&pipeline->commands);
+    if (lone && (pinned || limited) && builtins_is_builtin(first)) {
+        fprintf(stderr, "%s: %s is run by the shell itself\n",
+            pinned ? "pin" : "limit", first->argv[0]);
+        launch_last_status = 2;
+        return;
+    }
+    if (lone && pipeline->bg_job && strcmp(first->argv[0], "parallel") == 0) {
+        /* It waits for its instances to start the next ones */
+        fprintf(stderr, "parallel: cannot run in the background\n");
+        launch_last_status = 2;
+        return;
+    }
+    bool redirected = pipeline->iored_input || pipeline->iored_output;
+    if (lone
+        && !(redirected && builtins_is_stage(first))
+        && builtins_try(first))
+        return;
+    struct job_budget *job_budget = NULL;
+    if (limited && (job_budget = budget_create(&budget)) == NULL) {
+        launch_last_status = 2;
         return;
     }
     struct job *job = add_job(pipeline);
+    job->timed = timed;
+    job->budget = job_budget;
+
+    /**
+     * Keep SIGCHLD blocked until every stage has been launched, so
+     * that a leader which exits early stays a zombie and its group
+     * can still be joined by the remaining stages.
+     */
+    signal_block(SIGCHLD);
 
     /* First child reads from input */
     int pipe_before[2];
@@ -101,10 +525,13 @@ launch_pipeline(struct ast_pipeline *pipeline) {
     }
 
     /* Launch and link several children */
-    for (;
+    for (int i = 0;
         e != list_end (&pipeline->commands);
-        e = list_next (e)) {
+        e = list_next (e), i++) {
         struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+        struct job_stage *stage = &job->stages[i];
+        if (pinned)
+            placement_stage(&place, i, stage);
 
         int pipe_after[2];
         if (e != list_back (&pipeline->commands)) {
@@ -134,9 +561,14 @@ launch_pipeline(struct ast_pipeline *pipeline) {
                     pipe_after[WRITE_END] = file;
             }
         }
-        launch_command(cmd, job,
-            pipe_before[READ_END],
-            pipe_after[WRITE_END]);
+        bool last = e == list_back (&pipeline->commands);
+        if (!launch_builtin(cmd, job, stage,
+                pipe_before[READ_END],
+                pipe_after[WRITE_END],
+                last ? -1 : pipe_after[READ_END]))
+            launch_command(cmd, job, stage,
+                pipe_before[READ_END],
+                pipe_after[WRITE_END]);
         
         /* Store the new pipe for the next iteration */
         pipe_before[READ_END] = pipe_after[READ_END];
@@ -144,22 +576,34 @@ launch_pipeline(struct ast_pipeline *pipeline) {
     }
 
     if (job->pipe->bg_job) {
+        if (job->num_processes_alive == 0)
+            queue_completed_job(job);   /* Nothing was started */
+        signal_unblock(SIGCHLD);
         print_job(job, false);
+        launch_last_status = 0;
     }
     else {
         /* Wait for foreground to finish */
-        signal_block(SIGCHLD);
         wait_for_job(job);              /* Needs SIGCHLD blocked */
+        if (job->num_processes_alive == 0)
+            queue_completed_job(job);
         signal_unblock(SIGCHLD);
+        launch_last_status = job->exit_status;
+        report_job_time(job);
     }
 }
 
 /* Execute all jobs in the given order */
 void
 launch_command_line(struct ast_command_line *cline) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
     while (!list_empty (&cline->pipes)) {
         struct list_elem *e = list_pop_front (&cline->pipes);
         struct ast_pipeline *pipeline = list_entry(e, struct ast_pipeline, elem);
         launch_pipeline(pipeline);
     }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    launch_last_duration = (end.tv_sec - start.tv_sec)
+        + (end.tv_nsec - start.tv_nsec) / 1e9;
 }
\ No newline at end of file
@@ -1,4 +1,23 @@
 #include "../shell-ast.h"
+#include "jobs.h"
+
+/**
+ * Children are normally created with posix_spawn, which avoids
+ * copying the shell's address space. Setting this flag restores
+ * the original fork()/exec() path for every command.
+ */
+extern bool launch_force_fork;
+
+/**
+ * Exit status of the most recent foreground pipeline, taken from
+ * its last command (128+n if killed by signal n, 127 if it could
+ * not be run). Background launches set it to 0; built-ins set
+ * the status their function returns (1 or 2 on errors).
+ */
+extern int launch_last_status;
+
+/* Wall-clock seconds the most recent command line took */
+extern double launch_last_duration;
 
 /**
  * Execute all jobs in the given order.
@@ -11,4 +30,11 @@
  * Pipelines are removed upon processing, and
  * ownership is transferred to the spawned jobs.
  */
-void launch_command_line(struct ast_command_line *cline);
\ No newline at end of file
+void launch_command_line(struct ast_command_line *cline);
+/**
+ * Launch one more process for an existing job, attached to the
+ * shell's stdin and stdout. If the job has no process group yet,
+ * the new process starts one (and, in the foreground, takes the
+ * terminal). Sets job->last_pid to -1 if the command could not run.
+ */
+void launch_command_in_job(struct ast_command *cmd, struct job *job);
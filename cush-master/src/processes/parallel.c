@@ -0,0 +1,146 @@
+/**
+ * The `parallel` built-in.
+ *
+ * Instances are launched into one job through the regular launch
+ * code. Whenever the job is at its cap, the shell reaps children
+ * through handle_child_status (see wait_for_job_slots) until a slot
+ * frees up, then starts the next instance.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parallel.h"
+#include "jobs.h"
+#include "launch.h"
+#include "../arena.h"
+#include "../signal_support.h"
+#include "../termstate_management.h"
+
+#define SEPARATOR ":::"
+#define MAX_STATUS 101
+
+/* Print usage and return the error indicator */
+static int
+usage(const char *name)
+{
+    fprintf(stderr, "%1$s: usage %1$s [-j N] command [args...] "
+        SEPARATOR " arg...\n", name);
+    return -1;
+}
+
+/* Replace every "{}" in word by arg, in the arena */
+static char *
+substitute(struct arena *arena, const char *word, const char *arg)
+{
+    size_t n = 0, arglen = strlen(arg);
+    for (const char *p = word; (p = strstr(p, "{}")) != NULL; p += 2)
+        n++;
+
+    char *result = arena_alloc(arena, strlen(word) + n * arglen + 1);
+    char *out = result;
+    for (const char *p; (p = strstr(word, "{}")) != NULL; word = p + 2) {
+        memcpy(out, word, p - word);
+        out += p - word;
+        memcpy(out, arg, arglen);
+        out += arglen;
+    }
+    strcpy(out, word);
+    return result;
+}
+
+/* Build the argv of the instance for one argument, in the arena */
+static struct ast_command *
+make_instance(struct arena *arena, char **words, int nwords, char *arg)
+{
+    char **argv = arena_alloc(arena, (nwords + 2) * sizeof *argv);
+    bool replaced = false;
+    for (int i = 0; i < nwords; i++) {
+        if (strstr(words[i], "{}")) {
+            argv[i] = substitute(arena, words[i], arg);
+            replaced = true;
+        }
+        else {
+            argv[i] = words[i];
+        }
+    }
+    argv[nwords] = replaced ? NULL : arg;
+    argv[nwords + 1] = NULL;
+    return ast_command_create(arena, argv, false);
+}
+
+/* Run the `parallel` command line given in cmd */
+int
+parallel_run(struct ast_command *cmd)
+{
+    char **argv = cmd->argv;
+    long slots = sysconf(_SC_NPROCESSORS_ONLN);
+    char **words = argv + 1;
+    if (*words && strcmp(*words, "-j") == 0) {
+        char *end;
+        if (!words[1] || (slots = strtol(words[1], &end, 10)) < 1 || *end)
+            return usage(argv[0]);
+        words += 2;
+    }
+    if (slots < 1)
+        slots = 1;
+
+    /* Command words come before the separator, arguments after it */
+    int nwords = 0;
+    while (words[nwords] && strcmp(words[nwords], SEPARATOR) != 0)
+        nwords++;
+    if (nwords == 0 || !words[nwords])
+        return usage(argv[0]);
+    char **args = words + nwords + 1;
+
+    /* One foreground job, listed as the `parallel` command line */
+    struct arena arena;
+    arena_init(&arena);
+    struct ast_pipeline *pipe = ast_pipeline_create(&arena, NULL, NULL, false);
+    ast_pipeline_add_command(pipe, ast_command_create(&arena, argv, false));
+    struct job *job = add_job(pipe);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* Blocked throughout, so the group cannot vanish between launches */
+    int launched = 0;
+    signal_block(SIGCHLD);
+    for (; *args; args++) {
+        /* Wait for a free slot; give up if the job was stopped or ^C'd */
+        wait_for_job_slots(job, slots);
+        if (job->status != FOREGROUND || job->interrupted)
+            break;
+
+        /* The last group died, so the next instance starts a new one */
+        if (job->num_processes_alive == 0 && job->pgid != 0) {
+            job->pgid = 0;
+            termstate_give_terminal_back_to_shell();
+        }
+        launch_command_in_job(make_instance(&arena, words, nwords, *args),
+            job);
+        if (job->last_pid == -1)
+            job->num_failed++;          /* Not found, nothing to reap */
+        launched++;
+        arena_reset(&arena);            /* Instances are not kept */
+    }
+    wait_for_job(job);
+    if (job->num_processes_alive == 0)
+        queue_completed_job(job);
+    signal_unblock(SIGCHLD);
+    arena_destroy(&arena);
+
+    int pending = 0;
+    while (args[pending])
+        pending++;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec)
+        + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%s: %d run, %d failed, %d not started, %.3fs, %.1f/s\n",
+        argv[0], launched, job->num_failed, pending, secs,
+        secs > 0 ? launched / secs : 0.0);
+    return job->num_failed < MAX_STATUS ? job->num_failed : MAX_STATUS;
+}
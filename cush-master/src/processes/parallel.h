@@ -0,0 +1,19 @@
+/**
+ * The `parallel` built-in: run one command per argument, with a cap
+ * on how many run at once.
+ *
+ *   parallel [-j N] command [args...] ::: arg...
+ *
+ * Every instance is `command args... arg`, or has each `{}` in its
+ * words replaced by arg if there is one. N defaults to the number of online
+ * CPUs. All instances belong to a single foreground job, so `parallel`
+ * cannot be run in the background.
+ */
+#include "../shell-ast.h"
+
+/**
+ * Run the `parallel` command line given in cmd. Returns the number
+ * of instances that failed (at most 101, as GNU parallel does),
+ * or -1 after printing a usage error.
+ */
+int parallel_run(struct ast_command *cmd);
@@ -0,0 +1,192 @@
+/**
+ * A hashtable for keeping command name -> path correspondences.
+ *
+ * Open addressing with linear probing, like the pid table.
+ * Only touched from the main loop, so no signal precautions.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pathcache.h"
+#include "../utils.h"
+
+/* Marker for a removed entry; empty slots have a NULL name */
+static char tombstone[1];
+
+struct entry {
+    char *name;             /* Command name as typed */
+    char *path;             /* Where it was found */
+    int hits;               /* Number of times the entry was used */
+};
+
+static struct entry * table;
+static size_t size;         /* Always a power of two */
+static size_t used;         /* Slots holding an entry or a tombstone */
+static char * hashed_path;  /* Value of $PATH the entries belong to */
+
+/* FNV-1a */
+static size_t
+hash(const char *name) {
+    uint32_t h = 2166136261u;
+    while (*name)
+        h = (h ^ (unsigned char) *name++) * 16777619u;
+    return h;
+}
+
+/* Find the slot holding a name, or NULL */
+static struct entry *
+find(const char *name) {
+    if (table == NULL)
+        return NULL;
+    for (size_t i = hash(name) & (size - 1); table[i].name != NULL;
+        i = (i + 1) & (size - 1)) {
+        if (table[i].name != tombstone && strcmp(table[i].name, name) == 0)
+            return &table[i];
+    }
+    return NULL;
+}
+
+/* Place an entry into the first free slot of its probe chain */
+static struct entry *
+insert(char *name, char *path) {
+    size_t i = hash(name) & (size - 1);
+    while (table[i].name != NULL && table[i].name != tombstone)
+        i = (i + 1) & (size - 1);
+    if (table[i].name == NULL)
+        used++;
+    table[i] = (struct entry) { name, path, 0 };
+    return &table[i];
+}
+
+/* Double the table (or create it), dropping tombstones */
+static void
+grow(void) {
+    struct entry *old = table;
+    size_t old_size = size;
+    size = size ? size * 2 : 32;
+    table = calloc(size, sizeof *table);
+    if (table == NULL)
+        utils_fatal_error("calloc: ");
+    used = 0;
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].name != NULL && old[i].name != tombstone)
+            *insert(old[i].name, old[i].path) = old[i];
+    }
+    free(old);
+}
+
+/* Check if the file can be executed by us */
+static bool
+is_executable(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode)
+        && access(path, X_OK) == 0;
+}
+
+/* Walk $PATH like execvp, return an allocated path or NULL */
+static char *
+search(const char *name, const char *dirs) {
+    size_t len = strlen(name);
+    for (;;) {
+        const char *end = strchrnul(dirs, ':');
+
+        /* An empty entry, trailing ones too, means the current directory */
+        const char *dir = end == dirs ? "." : dirs;
+        size_t dlen = end == dirs ? 1 : end - dirs;
+        char *path = malloc(dlen + len + 2);
+        if (path == NULL)
+            utils_fatal_error("malloc: ");
+        memcpy(path, dir, dlen);
+        path[dlen] = '/';
+        memcpy(path + dlen + 1, name, len + 1);
+
+        if (is_executable(path))
+            return path;
+        free(path);
+        if (*end == '\0')
+            return NULL;
+        dirs = end + 1;
+    }
+}
+
+/* Return the path of the executable for a command name */
+const char *
+pathcache_lookup(const char *name) {
+    if (strchr(name, '/'))
+        return name;
+
+    /* Entries are only valid for the $PATH they were found in */
+    const char *dirs = getenv("PATH");
+    if (dirs == NULL)
+        dirs = "/bin:/usr/bin";
+    if (hashed_path == NULL || strcmp(hashed_path, dirs) != 0) {
+        pathcache_clear();
+        free(hashed_path);
+        hashed_path = strdup(dirs);
+        if (hashed_path == NULL)
+            utils_fatal_error("strdup: ");
+    }
+
+    struct entry *e = find(name);
+    if (e == NULL) {
+        char *path = search(name, dirs);
+        if (path == NULL)
+            return NULL;
+        if (used + 1 > size * 3 / 4)
+            grow();
+        char *copy = strdup(name);
+        if (copy == NULL)
+            utils_fatal_error("strdup: ");
+        e = insert(copy, path);
+    }
+    e->hits++;
+    return e->path;
+}
+
+/* Drop the cached path for a name */
+bool
+pathcache_forget(const char *name) {
+    struct entry *e = find(name);
+    if (e == NULL)
+        return false;
+    free(e->name);
+    free(e->path);
+    e->name = tombstone;
+    e->path = NULL;
+    return true;
+}
+
+/* Drop all cached paths */
+void
+pathcache_clear(void) {
+    for (size_t i = 0; i < size; i++) {
+        if (table[i].name != NULL && table[i].name != tombstone) {
+            free(table[i].name);
+            free(table[i].path);
+        }
+    }
+    free(table);
+    table = NULL;
+    size = used = 0;
+}
+
+/* Print all cached paths with their number of hits */
+void
+pathcache_print(void) {
+    bool empty = true;
+    for (size_t i = 0; i < size; i++) {
+        if (table[i].name == NULL || table[i].name == tombstone)
+            continue;
+        if (empty)
+            printf("hits\tcommand\n");
+        empty = false;
+        printf("%4d\t%s\n", table[i].hits, table[i].path);
+    }
+    if (empty)
+        printf("hash: hash table empty\n");
+}
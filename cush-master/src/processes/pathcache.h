@@ -0,0 +1,23 @@
+/**
+ * Cache of command name -> executable path lookups, like the
+ * `hash` built-in of other shells. Resolving a name once in the
+ * shell saves every child from walking $PATH with failed execs.
+ */
+#include <stdbool.h>
+
+/**
+ * Return the path of the executable for the given command name,
+ * searching $PATH and caching the result. Names that contain a
+ * slash are returned unchanged. Returns NULL if nothing is found.
+ * The cache is dropped whenever $PATH has changed.
+ */
+const char * pathcache_lookup(const char *name);
+
+/* Drop the cached path for a name, e.g. because exec failed */
+bool pathcache_forget(const char *name);
+
+/* Drop all cached paths */
+void pathcache_clear(void);
+
+/* Print all cached paths with their number of hits */
+void pathcache_print(void);
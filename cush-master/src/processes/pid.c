@@ -1,44 +1,92 @@
 /**
- * A hashtable-like structure for keeping pid -> job correspondences.
+ * A hashtable for keeping pid -> job correspondences.
+ *
+ * Open addressing with linear probing over a single flat array.
+ * Entries removed from within the SIGCHLD handler only become
+ * tombstones, since the handler must not allocate or move memory.
+ * Tombstones are dropped whenever the table is rebuilt, which
+ * happens on growth and in delete_pids() with SIGCHLD blocked.
  */
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 #include <sys/wait.h>
 
 #include "pid.h"
-#include "../list.h"
 #include "../signal_support.h"
+#include "../utils.h"
+
+/* Slot markers; real pids are always positive */
+#define EMPTY 0
+#define TOMBSTONE -1
 
 struct corresp {
-    struct list_elem elem;  /* Link element for list */
-    int pid;                /* Process id */
+    int pid;                /* Process id, or one of the markers above */
     struct job *job;        /* The job corresponding to the process id */
 };
 
-/* Hash table of size pow(2, HASH) */
-#define HASH 6
-#define SIZE (1<<HASH)
-static struct list * table[SIZE];
+/* Hash table of size pow(2, bits) */
+#define MIN_BITS 6
+static struct corresp * table;
+static int bits;
+static size_t live;         /* Slots holding a pid */
+static size_t dead;         /* Slots holding a tombstone */
 
-/* Get the hash index in the table */
-static int
+/* Get the hash index in the table (Fibonacci hashing) */
+static size_t
 hash(int pid) {
-    return pid & (SIZE - 1);
+    return (uint32_t) ((uint32_t) pid * 2654435769u) >> (32 - bits);
 }
 
-/* Retrieve a list containing the pid */
-static struct list *
-get(int pid, int init) {
-    int h = hash(pid);
-    struct list *list = table[h]; 
-
-    /* Initialize the list if haven't already */
-    if (init && list == NULL) {
-        list = malloc(sizeof *list);
-        list_init(list);
-        table[h] = list;
+/* Find the slot of a live pid, or NULL */
+static struct corresp *
+find(int pid) {
+    if (table == NULL)
+        return NULL;
+    size_t mask = ((size_t) 1 << bits) - 1;
+    for (size_t i = hash(pid); table[i].pid != EMPTY; i = (i + 1) & mask) {
+        if (table[i].pid == pid)
+            return &table[i];
     }
-    return list;
+    return NULL;
+}
+
+/* Place a correspondence into the first free slot of its probe chain */
+static void
+insert(int pid, struct job *job) {
+    size_t mask = ((size_t) 1 << bits) - 1;
+    size_t i = hash(pid);
+    while (table[i].pid != EMPTY && table[i].pid != TOMBSTONE)
+        i = (i + 1) & mask;
+    if (table[i].pid == TOMBSTONE)
+        dead--;
+    table[i].pid = pid;
+    table[i].job = job;
+    live++;
+}
+
+/* Reallocate the table to fit 'count' pids, dropping all tombstones */
+static void
+rebuild(size_t count) {
+    assert(signal_is_blocked(SIGCHLD));
+
+    int new_bits = MIN_BITS;
+    while (((size_t) 1 << new_bits) * 3 / 4 <= count)
+        new_bits++;
+
+    struct corresp *old = table;
+    size_t old_size = old ? (size_t) 1 << bits : 0;
+    table = calloc((size_t) 1 << new_bits, sizeof *table);
+    if (table == NULL)
+        utils_fatal_error("calloc: ");
+    bits = new_bits;
+    live = dead = 0;
+
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].pid > 0)
+            insert(old[i].pid, old[i].job);
+    }
+    free(old);
 }
 
 /* Remove all correspondences that were marked for deletion */
@@ -47,27 +95,11 @@ int delete_pids(void) {
     if ((unblock = !signal_is_blocked(SIGCHLD)))
         signal_block(SIGCHLD);
 
+    /* Only worth a pass once tombstones dominate the table */
     int deleted = 0;
-    for (int h = 0; h < SIZE; h++) {
-        struct list *list = table[h];
-        if (list == NULL) continue;
-        for (struct list_elem * e = list_begin (list);
-            e != list_end (list); ) {
-            struct corresp *corr = list_entry(e, struct corresp, elem);
-
-            /* Check if element should be deleted */
-            if (corr->job == NULL) {
-                e = list_remove (e);
-                free(corr);
-                deleted++;
-            }
-            else {
-                e = list_next (e);
-            }
-        }
-        /* Deallocate if the list is now empty */
-        if (list_empty(list))
-            free(list);
+    if (table != NULL && dead > live) {
+        deleted = dead;
+        rebuild(live);
     }
     
     if (unblock)
@@ -78,23 +110,19 @@ int delete_pids(void) {
 /* Return job corresponding to pid */
 struct job * 
 get_job_from_pid(int pid, int remove) {
-    struct list *list = get(pid, false);
-    if (list == NULL)
+    struct corresp *corr = find(pid);
+    if (corr == NULL)
         return NULL;
-    
-    /* Iterate list to find the needed pid */
-    for (struct list_elem * e = list_begin (list); 
-        e != list_end (list);
-        e = list_next (e)) {
-        struct corresp *corr = list_entry(e, struct corresp, elem);
-        if (corr->pid == pid) {
-            if (remove)
-                /* Can't remove node since called from handler */
-                corr->job = NULL;
-            return corr->job;
-        }
+
+    struct job *job = corr->job;
+    if (remove) {
+        /* Can't move entries since called from handler */
+        corr->pid = TOMBSTONE;
+        corr->job = NULL;
+        live--;
+        dead++;
     }
-    return NULL;
+    return job;
 }
 
 /* Add a correspondence of pid -> job */
@@ -102,11 +130,8 @@ void
 add_pid_to_job(int pid, struct job *job) {
     assert(signal_is_blocked(SIGCHLD));
 
-    struct list *list = get(pid, true);
-
-    /* Create a new correspondence and insert */
-    struct corresp *corr = malloc(sizeof *corr);
-    corr->pid = pid;
-    corr->job = job;
-    list_push_back(list, &corr->elem);
-}
\ No newline at end of file
+    /* Keep at least a quarter of the slots empty */
+    if (table == NULL || (live + dead + 1) > ((size_t) 1 << bits) * 3 / 4)
+        rebuild(live + 1);
+    insert(pid, job);
+}
@@ -17,5 +17,7 @@ void add_pid_to_job(int pid, struct job *job);
 /**
  * Remove all correspondences that were marked for deletion.
  * Useful for calling outside of signal handlers.
+ * Returns the number of tombstones dropped, which is 0 unless
+ * enough have accumulated to make compacting worthwhile.
  */
 int delete_pids(void);
\ No newline at end of file
@@ -0,0 +1,300 @@
+/**
+ * Placement of pipeline stages on CPUs.
+ *
+ * posix_spawn has no attribute for the CPU affinity of the child,
+ * and glibc refuses SCHED_BATCH as its scheduling policy, but the
+ * child inherits both from the shell: the shell moves itself onto
+ * the stage's CPU and policy around the spawn, which costs a few
+ * system calls and keeps the vfork-style launch. Niceness cannot
+ * be taken back that way, so it is the one setting applied to the
+ * child after the fact.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/resource.h>
+
+#include "placement.h"
+#include "../utils.h"
+
+#define NODE_CPULIST "/sys/devices/system/node/node%d/cpulist"
+#define STAT_PROCESSOR 39       /* Field of /proc/PID/stat, see proc(5) */
+
+/* Add a list like 0-3,8,10-11 to the set. Returns false if malformed */
+static bool
+parse_cpulist(const char *list, cpu_set_t *set)
+{
+    const char *p = list;
+    for (;;) {
+        char *end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p || lo < 0)
+            return false;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p || hi < lo)
+                return false;
+        }
+        if (hi >= CPU_SETSIZE)
+            return false;
+        for (long cpu = lo; cpu <= hi; cpu++)
+            CPU_SET(cpu, set);
+        if (*end != ',')
+            return *end == '\0' || *end == '\n';
+        p = end + 1;
+    }
+}
+
+/* Add the CPUs of a NUMA node to the set */
+static bool
+read_node(const char *node, cpu_set_t *set)
+{
+    char *end;
+    long n = strtol(node, &end, 10);
+    if (end == node || *end || n < 0 || n > 65535) {
+        fprintf(stderr, "pin: bad node %s\n", node);
+        return false;
+    }
+    char path[sizeof NODE_CPULIST + 8], list[4096];
+    snprintf(path, sizeof path, NODE_CPULIST, (int) n);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        utils_error("pin: node %s: ", node);
+        return false;
+    }
+    bool ok = fgets(list, sizeof list, file) && parse_cpulist(list, set);
+    fclose(file);
+    if (!ok)
+        fprintf(stderr, "pin: cannot read %s\n", path);
+    return ok;
+}
+
+/* Parse a comma-separated list of nice increments */
+static bool
+parse_nice(const char *list, struct placement *place)
+{
+    const char *p = list;
+    for (place->nnice = 0; place->nnice < PLACEMENT_MAX_NICE; ) {
+        char *end;
+        long nice = strtol(p, &end, 10);
+        if (end == p || nice < -39 || nice > 39)
+            break;
+        place->nice[place->nnice++] = nice;
+        if (*end == '\0')
+            return true;
+        if (*end != ',')
+            break;
+        p = end + 1;
+    }
+    fprintf(stderr, "pin: bad nice list %s\n", list);
+    return false;
+}
+
+static bool
+usage(void)
+{
+    fprintf(stderr, "pin: usage pin [-c CPUS | -n NODE] "
+        "[-N NICE[,NICE...]] [-b] command\n");
+    return false;
+}
+
+/* Parse the options of a leading `pin` */
+bool
+placement_parse(char ***argv, struct placement *place)
+{
+    *place = (struct placement) { .nnice = 0 };
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof allowed, &allowed) == -1) {
+        utils_error("pin: sched_getaffinity: ");
+        return false;
+    }
+
+    /* By default, the stages spread over the shell's own CPUs */
+    const char *cpus = NULL;
+    cpu_set_t chosen = allowed;
+    char **arg = *argv + 1;
+    for (; *arg && (*arg)[0] == '-'; arg++) {
+        if (strcmp(*arg, "--") == 0) {
+            arg++;
+            break;
+        }
+        if (strcmp(*arg, "-b") == 0) {
+            place->batch = true;
+            continue;
+        }
+        char opt = (*arg)[1];
+        if (!opt || !strchr("cnN", opt) || (*arg)[2] || !arg[1])
+            return usage();
+        const char *value = *++arg;
+        if (opt == 'N') {
+            if (!parse_nice(value, place))
+                return false;
+            continue;
+        }
+        CPU_ZERO(&chosen);
+        cpus = value;
+        if (opt == 'n' && !read_node(value, &chosen))
+            return false;
+        if (opt == 'c' && !parse_cpulist(value, &chosen)) {
+            fprintf(stderr, "pin: bad CPU list %s\n", value);
+            return false;
+        }
+    }
+    if (!*arg)
+        return usage();
+
+    CPU_AND(&place->cpus, &chosen, &allowed);
+    place->ncpus = CPU_COUNT(&place->cpus);
+    if (place->ncpus == 0) {
+        fprintf(stderr, "pin: none of the CPUs in %s is available\n", cpus);
+        return false;
+    }
+    *argv = arg;
+    return true;
+}
+
+/* Record where stage i of a pinned pipeline is to run */
+void
+placement_stage(const struct placement *place, int i, struct job_stage *stage)
+{
+    int skip = i % place->ncpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &place->cpus) && skip-- == 0) {
+            stage->cpu = cpu;
+            break;
+        }
+    }
+    if (place->nnice > 0)
+        stage->nice = place->nice[i < place->nnice ? i : place->nnice - 1];
+    stage->batch = place->batch;
+}
+
+/* Move the shell onto the stage's CPU and policy, for a child to inherit */
+bool
+placement_enter(const struct job_stage *stage, struct placement_saved *saved)
+{
+    saved->pinned = false;
+    saved->batched = false;
+    if (stage->cpu != -1) {
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(stage->cpu, &one);
+        saved->pinned = sched_getaffinity(0, sizeof saved->cpus,
+                &saved->cpus) == 0
+            && sched_setaffinity(0, sizeof one, &one) == 0;
+        if (!saved->pinned)
+            utils_error("pin: cpu %d: ", stage->cpu);
+    }
+    if (stage->batch) {
+        struct sched_param param = { .sched_priority = 0 };
+        saved->policy = sched_getscheduler(0);
+        saved->batched = saved->policy != -1
+            && sched_getparam(0, &saved->param) == 0
+            && sched_setscheduler(0, SCHED_BATCH, &param) == 0;
+        if (!saved->batched)
+            utils_error("pin: SCHED_BATCH: ");
+    }
+    return saved->pinned || saved->batched;
+}
+
+/* Give the shell back what it had before placement_enter */
+void
+placement_leave(const struct placement_saved *saved)
+{
+    if (saved->pinned
+        && sched_setaffinity(0, sizeof saved->cpus, &saved->cpus) == -1)
+        utils_error("pin: sched_setaffinity: ");
+    if (saved->batched
+        && sched_setscheduler(0, saved->policy, &saved->param) == -1)
+        utils_error("pin: sched_setscheduler: ");
+}
+
+/* Make a process nicer than the shell by the stage's increment */
+static void
+renice(pid_t pid, int nice)
+{
+    errno = 0;
+    int base = getpriority(PRIO_PROCESS, 0);
+    if ((base == -1 && errno != 0)
+        || setpriority(PRIO_PROCESS, pid, base + nice) == -1)
+        utils_error("pin: nice %d: ", nice);
+}
+
+/* Make a spawned child as nice as its stage asks */
+void
+placement_renice(pid_t pid, const struct job_stage *stage)
+{
+    if (stage->nice != 0)
+        renice(pid, stage->nice);
+}
+
+/* Apply all of the stage's placement to the calling (forked) child */
+void
+placement_apply(const struct job_stage *stage)
+{
+    if (stage->cpu != -1) {
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(stage->cpu, &one);
+        if (sched_setaffinity(0, sizeof one, &one) == -1)
+            utils_error("pin: cpu %d: ", stage->cpu);
+    }
+    if (stage->nice != 0)
+        renice(0, stage->nice);
+    if (stage->batch) {
+        struct sched_param param = { .sched_priority = 0 };
+        if (sched_setscheduler(0, SCHED_BATCH, &param) == -1)
+            utils_error("pin: SCHED_BATCH: ");
+    }
+}
+
+/* CPU the process last ran on, or -1 if it is gone */
+static int
+last_cpu(pid_t pid)
+{
+    char path[32], stat[1024];
+    snprintf(path, sizeof path, "/proc/%d/stat", (int) pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+    size_t len = fread(stat, 1, sizeof stat - 1, file);
+    fclose(file);
+    stat[len] = '\0';
+
+    /* The command name may hold spaces, so count from its end */
+    char *p = strrchr(stat, ')');
+    if (p == NULL)
+        return -1;
+    int field = 2;
+    for (char *word = strtok(p + 1, " "); word; word = strtok(NULL, " "))
+        if (++field == STAT_PROCESSOR)
+            return atoi(word);
+    return -1;
+}
+
+/* Print where each stage of the job runs */
+void
+placement_print(const struct job *job, FILE *out)
+{
+    for (int i = 0; i < job->num_stages; i++) {
+        const struct job_stage *stage = &job->stages[i];
+        if (stage->pid == 0)
+            continue;           /* Run by the shell, or not found */
+        fprintf(out, "\tstage %d\tpid %d", i + 1, (int) stage->pid);
+        int cpu = stage->exited ? -1 : last_cpu(stage->pid);
+        if (cpu != -1)
+            fprintf(out, "\tcpu %d", cpu);
+        else
+            fprintf(out, "\texited");
+        if (stage->cpu != -1)
+            fprintf(out, "\tpinned %d", stage->cpu);
+        if (stage->nice != 0)
+            fprintf(out, "\tnice %+d", stage->nice);
+        if (stage->batch)
+            fprintf(out, "\tbatch");
+        fprintf(out, "\n");
+    }
+}
@@ -0,0 +1,79 @@
+/**
+ * Placement of pipeline stages on CPUs: the `pin` prefix.
+ *
+ *   pin [-c CPUS | -n NODE] [-N NICE[,NICE...]] [-b] command | ...
+ *
+ * Stage i of the pipeline is pinned to the i-th CPU of a set, in
+ * increasing order and wrapping around, so that consecutive stages
+ * sit on adjacent cores and stay there with their caches. The set
+ * is a list like 0-3,8 (-c), the CPUs of a NUMA node (-n), or by
+ * default every CPU the shell may run on. -N makes the stages
+ * nicer by the given amounts, one per stage with the last one
+ * repeating, and -b schedules them as SCHED_BATCH.
+ */
+#ifndef __PLACEMENT_H
+#define __PLACEMENT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sched.h>
+
+#include "jobs.h"
+
+#define PLACEMENT_MAX_NICE 16   /* Stages with a niceness of their own */
+
+struct placement {
+    cpu_set_t cpus;             /* CPUs to spread the stages over */
+    int ncpus;                  /* Number of CPUs in the set */
+    int nice[PLACEMENT_MAX_NICE];
+    int nnice;                  /* Stages given a niceness, 0 for none */
+    bool batch;                 /* Schedule every stage as SCHED_BATCH */
+};
+
+/**
+ * Parse the options of a leading `pin`, advancing *argv past them
+ * to the command. Prints an error and returns false if they are
+ * malformed, name no usable CPU, or are not followed by a command.
+ */
+bool placement_parse(char ***argv, struct placement *place);
+
+/* Record where stage i of a pinned pipeline is to run */
+void placement_stage(const struct placement *place, int i,
+    struct job_stage *stage);
+
+/* What placement_enter changed about the shell */
+struct placement_saved {
+    cpu_set_t cpus;
+    bool pinned;
+    int policy;
+    struct sched_param param;
+    bool batched;
+};
+
+/**
+ * Have a child spawned next start on the stage's CPU, with its
+ * scheduling policy. Both are inherited from the shell, which
+ * takes them on itself until placement_leave(), so the program
+ * never runs elsewhere. Returns false if nothing was changed.
+ */
+bool placement_enter(const struct job_stage *stage,
+    struct placement_saved *saved);
+void placement_leave(const struct placement_saved *saved);
+
+/**
+ * Make a spawned child as nice as its stage asks. posix_spawn has
+ * no attribute for this, so the program may run briefly at the
+ * shell's niceness first.
+ */
+void placement_renice(pid_t pid, const struct job_stage *stage);
+
+/* Apply all of the stage's placement to the calling (forked) child */
+void placement_apply(const struct job_stage *stage);
+
+/**
+ * Print where each stage of the job runs, or was pinned to run:
+ * its process, the CPU it last ran on, and its placement.
+ */
+void placement_print(const struct job *job, FILE *out);
+
+#endif /* __PLACEMENT_H */
@@ -0,0 +1,215 @@
+/**
+ * In-kernel byte relay for `cat` stages.
+ *
+ * relay_copy() tries copy_file_range(2) between regular files,
+ * then splice(2) when one side is a pipe (or through a private
+ * pipe otherwise), and falls back to read/write for O_APPEND
+ * output, terminal input, or when the kernel refuses a combination.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "relay.h"
+
+#define CHUNK (1 << 20)     /* Bytes moved per system call */
+
+enum relay_mode relay_mode = RELAY_AUTO;
+
+/* Outcome of one copying method */
+enum copy_result {
+    COPY_DONE,          /* Reached end of input */
+    COPY_UNSUPPORTED,   /* Kernel refused, try the next method */
+    COPY_ERROR
+};
+
+/* Errors that mean "not for these descriptors" rather than failure */
+static bool
+unsupported(int err)
+{
+    return err == EINVAL || err == EXDEV || err == ENOSYS
+        || err == EOPNOTSUPP || err == EBADF;
+}
+
+/* Regular file to regular file, possibly sharing extents */
+static enum copy_result
+copy_range(int fd_in, int fd_out)
+{
+    ssize_t n;
+    while ((n = copy_file_range(fd_in, NULL, fd_out, NULL, CHUNK, 0)) > 0)
+        ;
+    if (n == 0)
+        return COPY_DONE;
+    return unsupported(errno) ? COPY_UNSUPPORTED : COPY_ERROR;
+}
+
+/* Move pages between the descriptors, one of which is a pipe */
+static enum copy_result
+copy_splice(int fd_in, int fd_out)
+{
+    ssize_t n;
+    while ((n = splice(fd_in, NULL, fd_out, NULL, CHUNK,
+                SPLICE_F_MOVE | SPLICE_F_MORE)) > 0)
+        ;
+    if (n == 0)
+        return COPY_DONE;
+    return errno == EINVAL ? COPY_UNSUPPORTED : COPY_ERROR;
+}
+
+/* Splice through a private pipe when neither side is one */
+static enum copy_result
+copy_splice_via_pipe(int fd_in, int fd_out)
+{
+    int p[2];
+    if (pipe(p) == -1)
+        return COPY_UNSUPPORTED;
+
+    enum copy_result result = COPY_DONE;
+    for (;;) {
+        ssize_t n = splice(fd_in, NULL, p[1], NULL, CHUNK,
+            SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n == 0)
+            break;
+        if (n == -1) {
+            result = errno == EINVAL ? COPY_UNSUPPORTED : COPY_ERROR;
+            break;
+        }
+        /* Drain what was just put into the pipe */
+        while (n > 0) {
+            ssize_t m = splice(p[0], NULL, fd_out, NULL, n,
+                SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (m <= 0) {
+                /* Bytes already in the pipe would be lost */
+                result = COPY_ERROR;
+                goto out;
+            }
+            n -= m;
+        }
+    }
+out:
+    close(p[0]);
+    close(p[1]);
+    return result;
+}
+
+/* Last resort: copy through a buffer */
+static enum copy_result
+copy_buffered(int fd_in, int fd_out)
+{
+    static char buf[1 << 16];
+    ssize_t n;
+    while ((n = read(fd_in, buf, sizeof buf)) > 0) {
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t m = write(fd_out, buf + off, n - off);
+            if (m == -1)
+                return COPY_ERROR;
+            off += m;
+        }
+    }
+    return n == 0 ? COPY_DONE : COPY_ERROR;
+}
+
+/* Copy everything from fd_in to fd_out, -1 on error */
+int
+relay_copy(int fd_in, int fd_out)
+{
+    struct stat in, out;
+    if (fstat(fd_in, &in) == -1 || fstat(fd_out, &out) == -1)
+        return -1;
+
+    /* Neither call writes to a file opened with O_APPEND */
+    int flags = fcntl(fd_out, F_GETFL);
+    bool append = flags != -1 && (flags & O_APPEND) && S_ISREG(out.st_mode);
+
+    /* splice() from a terminal waits for input while holding the
+     * pipe's lock, which stalls the reader of what it already got */
+    bool terminal = isatty(fd_in);
+
+    enum copy_result r = COPY_UNSUPPORTED;
+    if (S_ISREG(in.st_mode) && S_ISREG(out.st_mode) && !append)
+        r = copy_range(fd_in, fd_out);
+    if (r == COPY_UNSUPPORTED && !append && !terminal) {
+        if (S_ISFIFO(in.st_mode) || S_ISFIFO(out.st_mode))
+            r = copy_splice(fd_in, fd_out);
+        else
+            r = copy_splice_via_pipe(fd_in, fd_out);
+    }
+    if (r == COPY_UNSUPPORTED)
+        r = copy_buffered(fd_in, fd_out);
+    return r == COPY_DONE ? 0 : -1;
+}
+
+/* Check whether fd refers to a terminal (or cannot be examined) */
+static bool
+is_terminal(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == -1 || S_ISCHR(st.st_mode);
+}
+
+/* Check whether the command is a `cat` that will be relayed */
+bool
+relay_applies(struct ast_command *cmd, int fd_in, int fd_out)
+{
+    if (relay_mode == RELAY_NEVER || strcmp(cmd->argv[0], "cat") != 0)
+        return false;
+
+    /* Options change the output, only plain file names are relayed */
+    bool reads_stdin = cmd->argv[1] == NULL;
+    for (char **p = cmd->argv + 1; *p; p++) {
+        if (strcmp(*p, "-") == 0)
+            reads_stdin = true;
+        else if (**p == '-')
+            return false;
+    }
+
+    /* Little data passes through a terminal, so leave it to cat */
+    if (relay_mode == RELAY_AUTO) {
+        if (is_terminal(fd_out) || (reads_stdin && is_terminal(fd_in)))
+            return false;
+    }
+    return true;
+}
+
+/* Copy one named input to stdout, 1 if it could not be read */
+static int
+relay_file(const char *name)
+{
+    int fd = STDIN_FILENO;
+    if (strcmp(name, "-") != 0) {
+        fd = open(name, O_RDONLY);
+        if (fd == -1) {
+            fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+            return 1;
+        }
+    }
+
+    int status = 0;
+    if (relay_copy(fd, STDOUT_FILENO) == -1) {
+        /* EPIPE is reported by SIGPIPE, as for any writer */
+        fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+        status = 1;
+    }
+    if (fd != STDIN_FILENO)
+        close(fd);
+    return status;
+}
+
+/* Body of the relay child */
+void
+relay_run(struct ast_command *cmd)
+{
+    int status = 0;
+    if (cmd->argv[1] == NULL)
+        status = relay_file("-");
+    for (char **p = cmd->argv + 1; *p; p++)
+        status |= relay_file(*p);
+
+    /* Do not flush stdio buffers inherited from the shell */
+    _exit(status);
+}
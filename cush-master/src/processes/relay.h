@@ -0,0 +1,37 @@
+/**
+ * In-kernel byte relay for `cat` stages.
+ *
+ * A stage that only copies its inputs to stdout does not need a
+ * program of its own: a forked copy of the shell moves the data
+ * with copy_file_range(2) or splice(2), so it never passes through
+ * user space.
+ */
+#include <stdbool.h>
+#include "../shell-ast.h"
+
+enum relay_mode {
+    RELAY_AUTO,     /* Relay unless the stage talks to a terminal */
+    RELAY_ALWAYS,   /* Relay every plain `cat` */
+    RELAY_NEVER     /* Always run the real program */
+};
+
+/* When to relay, set with -R (always) or -r (never) */
+extern enum relay_mode relay_mode;
+
+/**
+ * Check whether the command is a `cat` without options that will
+ * be run as a relay, given the descriptors it would be attached to.
+ */
+bool relay_applies(struct ast_command *cmd, int fd_in, int fd_out);
+
+/**
+ * Body of the relay child. Copies every named file (or stdin) to
+ * stdout and exits with 1 if a file could not be read, like cat.
+ */
+void relay_run(struct ast_command *cmd) __attribute__((noreturn));
+
+/**
+ * Copy everything from fd_in to fd_out, using the cheapest
+ * mechanism the two descriptors allow. Returns -1 on error.
+ */
+int relay_copy(int fd_in, int fd_out);
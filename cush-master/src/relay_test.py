@@ -0,0 +1,82 @@
+#!/usr/bin/python
+#
+# Tests the in-kernel relay of `cat` stages (-R, -r)
+#
+import atexit, proc_check, time, os, tempfile, shutil, testutils
+from testutils import *
+
+console = setup_tests()
+shell = os.path.abspath(testutils.settings_module.shell)
+
+# Run the shell in batch mode from /bin/sh, see batch_test.py
+def run_batch(cmdline):
+    global console
+    console.close(force=True)
+    console = pexpect.spawn("/bin/sh", ["-c", cmdline + '; echo "status=$?"'],
+        drainpty=False)
+    console.timeout = 5
+    return console
+
+workdir = tempfile.mkdtemp()
+atexit.register(shutil.rmtree, workdir)
+data = "".join("line %d\n" % i for i in range(100000))
+with open(os.path.join(workdir, "in"), "w") as f:
+    f.write(data)
+
+def contents(name):
+    with open(os.path.join(workdir, name)) as f:
+        return f.read()
+
+#################################################################
+# Test #1:  File to file, file to pipe to file, and appending
+#           The data arrives unchanged with the relay forced on
+
+run_batch("cd " + workdir + " && " + shell + " -R -c '"
+    + "cat in > a; cat in | cat | cat > b; cat < in >> c; cat in - >> c < in'")
+console.expect_exact("status=0")
+assert contents("a") == data, "file to file relay corrupted data"
+assert contents("b") == data, "pipe relay corrupted data"
+assert contents("c") == data * 3, "appending relay corrupted data"
+
+#################################################################
+# Test #2:  Errors are reported like cat does
+#           Missing files are skipped and make the stage fail
+
+run_batch("cd " + workdir + " && " + shell + " -R -c 'cat nosuch in | wc -l; cat nosuch'")
+console.expect_exact("cat: nosuch: No such file or directory")
+console.expect_exact("100000")
+console.expect_exact("status=1")
+
+#################################################################
+# Test #3:  Options and -r run the real program
+
+run_batch("cd " + workdir + " && " + shell + " -R -c 'cat -n in | tail -1'")
+console.expect("100000\s+line 99999")
+run_batch("cd " + workdir + " && " + shell + " -r -c 'cat in | cat > d'")
+console.expect_exact("status=0")
+assert contents("d") == data, "cat without relay failed"
+
+#################################################################
+# Test #4:  ^C stops a relayed pipeline reading the terminal
+#           Relay children never exec, and must not keep the
+#           shell's SIGINT handler
+
+console.close(force=True)
+console = pexpect.spawn(shell, ["-R"], drainpty=True)
+console.timeout = 5
+testutils.console = console
+expect_prompt()
+sendline("cat | cat")
+sendline("relayed")
+expect_exact("relayed\r\nrelayed", "relay did not echo its input")
+sendintr()
+expect_prompt("shell did not return to prompt after ^C")
+sendline("echo back")
+expect_exact("back", "shell is not reading commands after ^C")
+expect_prompt()
+assert os.popen("pgrep -P %d" % console.pid).read() == "", \
+    "relay children survived ^C"
+sendline("exit")
+console.expect(pexpect.EOF)
+
+test_success()
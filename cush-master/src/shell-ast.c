@@ -9,15 +9,20 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "shell-ast.h"
+#include "arena.h"
+#include "utils.h"
 
-/* Create new command structure.  Takes ownership of argv. */
+/* Create new command structure.  argv must live in the same arena. */
 struct ast_command * 
-ast_command_create(char ** argv, bool dup_stderr_to_stdout)
+ast_command_create(struct arena *arena, char ** argv,
+                   bool dup_stderr_to_stdout)
 {
-    struct ast_command *cmd = malloc(sizeof *cmd);
+    struct ast_command *cmd = arena_alloc(arena, sizeof *cmd);
 
     cmd->argv = argv;
     cmd->dup_stderr_to_stdout = dup_stderr_to_stdout;
@@ -25,11 +30,12 @@ ast_command_create(char ** argv, bool dup_stderr_to_stdout)
 }
 
 /* Create a new pipeline */
-struct ast_pipeline * ast_pipeline_create(char *iored_input, 
+struct ast_pipeline * ast_pipeline_create(struct arena *arena,
+                                          char *iored_input, 
                                           char *iored_output, 
                                           bool append_to_output)
 {
-    struct ast_pipeline *pipe = malloc(sizeof *pipe);
+    struct ast_pipeline *pipe = arena_alloc(arena, sizeof *pipe);
 
     list_init(&pipe->commands);
     pipe->iored_output = iored_output;
@@ -48,19 +54,20 @@ ast_pipeline_add_command(struct ast_pipeline *pipe, struct ast_command *cmd)
 
 /* Create an empty command line */
 struct ast_command_line *
-ast_command_line_create_empty(void)
+ast_command_line_create_empty(struct arena *arena)
 {
-    struct ast_command_line *cmdline = malloc(sizeof *cmdline);
+    struct ast_command_line *cmdline = arena_alloc(arena, sizeof *cmdline);
 
     list_init(&cmdline->pipes);
+    cmdline->arena = arena;
     return cmdline;
 }
 
 /* Create a command line with a single pipeline */
 struct ast_command_line *
-ast_command_line_create(struct ast_pipeline *pipe)
+ast_command_line_create(struct arena *arena, struct ast_pipeline *pipe)
 {
-    struct ast_command_line *cmdline = ast_command_line_create_empty();
+    struct ast_command_line *cmdline = ast_command_line_create_empty(arena);
 
     list_push_back(&cmdline->pipes, &pipe->elem);
     return cmdline;
@@ -128,36 +135,198 @@ ast_command_line_print(struct ast_command_line *cmdline)
     printf("==========================================\n");
 }
 
-/* Deallocation functions. */
-void 
-ast_command_line_free(struct ast_command_line *cmdline)
+/* Space taken by compacted pipelines */
+struct compact_size {
+    size_t pipes, cmds, words, chars;
+};
+
+/* Copy a string to *dst, advance *dst past it and return the copy */
+static char *
+copy_string(char **dst, const char *src)
 {
-    for (struct list_elem * e = list_begin(&cmdline->pipes); e != list_end(&cmdline->pipes); ) {
-        struct ast_pipeline *pipe = list_entry(e, struct ast_pipeline, elem);
-        e = list_remove(e);
-        ast_pipeline_free(pipe);
+    if (src == NULL)
+        return NULL;
+
+    char *copy = *dst;
+    size_t len = strlen(src) + 1;
+    memcpy(copy, src, len);
+    *dst += len;
+    return copy;
+}
+
+/* Add the space a compacted copy of pipe needs to *sz */
+static void
+measure_pipeline(struct ast_pipeline *pipe, struct compact_size *sz)
+{
+    sz->pipes++;
+    if (pipe->iored_input)
+        sz->chars += strlen(pipe->iored_input) + 1;
+    if (pipe->iored_output)
+        sz->chars += strlen(pipe->iored_output) + 1;
+
+    for (struct list_elem * e = list_begin(&pipe->commands);
+         e != list_end(&pipe->commands);
+         e = list_next(e)) {
+        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+        for (char **p = cmd->argv; *p; p++) {
+            sz->chars += strlen(*p) + 1;
+            sz->words++;
+        }
+        sz->words++;                    /* NULL terminator */
+        sz->cmds++;
     }
-    free(cmdline);
 }
 
-void 
-ast_pipeline_free(struct ast_pipeline *pipe)
+/* Bytes taken by the given parts, after a header of the given size */
+static size_t
+compact_bytes(size_t header, struct compact_size *sz)
 {
-    for (struct list_elem * e = list_begin(&pipe->commands); e != list_end(&pipe->commands); ) {
+    return header + sz->pipes * sizeof(struct ast_pipeline)
+        + sz->cmds * sizeof(struct ast_command)
+        + sz->words * sizeof(char *) + sz->chars;
+}
+
+/* Copy pipe into copy, taking its parts from *cmds, *words, *chars */
+static void
+place_pipeline(struct ast_pipeline *pipe, struct ast_pipeline *copy,
+               struct ast_command **cmds, char ***words, char **chars)
+{
+    list_init(&copy->commands);
+    copy->iored_input = copy_string(chars, pipe->iored_input);
+    copy->iored_output = copy_string(chars, pipe->iored_output);
+    copy->append_to_output = pipe->append_to_output;
+    copy->bg_job = pipe->bg_job;
+
+    for (struct list_elem * e = list_begin(&pipe->commands);
+         e != list_end(&pipe->commands);
+         e = list_next(e)) {
         struct ast_command *cmd = list_entry(e, struct ast_command, elem);
-        e = list_remove(e);
-        ast_command_free(cmd);
+        struct ast_command *c = (*cmds)++;
+        c->argv = *words;
+        c->dup_stderr_to_stdout = cmd->dup_stderr_to_stdout;
+        for (char **p = cmd->argv; *p; p++)
+            *(*words)++ = copy_string(chars, *p);
+        *(*words)++ = NULL;
+        list_push_back(&copy->commands, &c->elem);
     }
-    free(pipe);
 }
 
-void 
-ast_command_free(struct ast_command * cmd)
+/**
+ * Copy a pipeline into one malloc'ed block laid out as
+ *   struct ast_pipeline | struct ast_command[n] | argv arrays | strings
+ * All parts have pointer alignment, so no padding is needed.
+ */
+struct ast_pipeline *
+ast_pipeline_compact(struct ast_pipeline *pipe)
+{
+    struct compact_size sz = { 0 };
+    measure_pipeline(pipe, &sz);
+
+    struct ast_pipeline *copy = malloc(compact_bytes(0, &sz));
+    if (copy == NULL)
+        utils_fatal_error("ast_pipeline_compact: ");
+
+    struct ast_command *cmds = (struct ast_command *) (copy + 1);
+    char **words = (char **) (cmds + sz.cmds);
+    char *chars = (char *) (words + sz.words);
+    place_pipeline(pipe, copy, &cmds, &words, &chars);
+    return copy;
+}
+
+/**
+ * Copy a command line into one malloc'ed block laid out as
+ *   struct ast_command_line | struct ast_pipeline[n] | commands |
+ *   argv arrays | strings
+ */
+struct ast_command_line *
+ast_command_line_compact(struct ast_command_line *cmdline, size_t *size)
 {
-    char ** p = cmd->argv;
-    while (*p) {
-        free(*p++);
+    struct compact_size sz = { 0 };
+    for (struct list_elem * e = list_begin(&cmdline->pipes);
+         e != list_end(&cmdline->pipes);
+         e = list_next(e))
+        measure_pipeline(list_entry(e, struct ast_pipeline, elem), &sz);
+
+    *size = compact_bytes(sizeof *cmdline, &sz);
+    struct ast_command_line *copy = malloc(*size);
+    if (copy == NULL)
+        utils_fatal_error("ast_command_line_compact: ");
+
+    struct ast_pipeline *pipes = (struct ast_pipeline *) (copy + 1);
+    struct ast_command *cmds = (struct ast_command *) (pipes + sz.pipes);
+    char **words = (char **) (cmds + sz.cmds);
+    char *chars = (char *) (words + sz.words);
+
+    list_init(&copy->pipes);
+    copy->arena = NULL;
+    for (struct list_elem * e = list_begin(&cmdline->pipes);
+         e != list_end(&cmdline->pipes);
+         e = list_next(e)) {
+        place_pipeline(list_entry(e, struct ast_pipeline, elem), pipes,
+                       &cmds, &words, &chars);
+        list_push_back(&copy->pipes, &pipes->elem);
+        pipes++;
     }
-    free(cmd->argv);
-    free(cmd);
+    return copy;
+}
+
+/* Where p, which points into a block, is in a copy of that block */
+#define RELOCATE(p, delta) ((p) ? (void *) ((char *) (p) + (delta)) : NULL)
+
+/**
+ * Copy a compacted command line into the arena. The block is copied
+ * as a whole; only its pointers are adjusted, and its lists rebuilt.
+ */
+struct ast_command_line *
+ast_command_line_copy(struct arena *arena,
+                      struct ast_command_line *compact, size_t size)
+{
+    struct ast_command_line *copy = arena_alloc(arena, size);
+    memcpy(copy, compact, size);
+    ptrdiff_t delta = (char *) copy - (char *) compact;
+
+    list_init(&copy->pipes);
+    copy->arena = arena;
+    for (struct list_elem * e = list_begin(&compact->pipes);
+         e != list_end(&compact->pipes);
+         e = list_next(e)) {
+        struct ast_pipeline *pipe = list_entry(e, struct ast_pipeline, elem);
+        struct ast_pipeline *p = RELOCATE(pipe, delta);
+        p->iored_input = RELOCATE(pipe->iored_input, delta);
+        p->iored_output = RELOCATE(pipe->iored_output, delta);
+        list_init(&p->commands);
+        list_push_back(&copy->pipes, &p->elem);
+
+        for (struct list_elem * f = list_begin(&pipe->commands);
+             f != list_end(&pipe->commands);
+             f = list_next(f)) {
+            struct ast_command *cmd = list_entry(f, struct ast_command, elem);
+            struct ast_command *c = RELOCATE(cmd, delta);
+            c->argv = RELOCATE(cmd->argv, delta);
+            for (int i = 0; cmd->argv[i]; i++)
+                c->argv[i] = RELOCATE(cmd->argv[i], delta);
+            list_push_back(&p->commands, &c->elem);
+        }
+    }
+    return copy;
+}
+
+/**
+ * Deallocation functions.
+ * A command line lives in an arena, so freeing it releases every
+ * node and word at once; compacted copies are a single block.
+ */
+void 
+ast_command_line_free(struct ast_command_line *cmdline)
+{
+    if (cmdline->arena)
+        arena_reset(cmdline->arena);
+    else
+        free(cmdline);
+}
+
+void 
+ast_pipeline_free(struct ast_pipeline *pipe)
+{
+    free(pipe);
 }
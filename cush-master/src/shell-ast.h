@@ -7,10 +7,13 @@
 struct ast_command;
 struct ast_pipeline;
 struct ast_command_line;
+struct arena;
 
 /* A command line may contain multiple pipelines. */
 struct ast_command_line {
     struct list/* <ast_pipeline> */ pipes;        /* List of pipelines */
+    struct arena *arena;     /* Holds all its nodes and words, NULL if
+                                it was compacted */
 };
 
 /* A pipeline is a list of one or more commands. 
@@ -35,12 +38,20 @@ struct ast_command {
     struct list_elem elem;   /* Link element to link commands in pipeline. */
 };
 
+/**
+ * All nodes of a command line, including its words, come from one
+ * arena that is reset when the command line is freed. The create
+ * functions allocate from the arena they are given.
+ */
+
 /* Create new command structure and initialize it */
-struct ast_command * ast_command_create(char ** argv,
+struct ast_command * ast_command_create(struct arena *arena,
+                                        char ** argv,
                                         bool dup_stderr_to_stdout);
 
 /* Create a new pipeline containing only one command */
-struct ast_pipeline * ast_pipeline_create(char *iored_input, 
+struct ast_pipeline * ast_pipeline_create(struct arena *arena,
+                                          char *iored_input, 
                                           char *iored_output, 
                                           bool append_to_output);
 
@@ -48,22 +59,59 @@ struct ast_pipeline * ast_pipeline_create(char *iored_input,
 void ast_pipeline_add_command(struct ast_pipeline *pipe, struct ast_command *cmd);
 
 /* Create an empty command line */
-struct ast_command_line * ast_command_line_create_empty(void);
+struct ast_command_line * ast_command_line_create_empty(struct arena *arena);
 
 /* Create a command line with a single pipeline */
-struct ast_command_line * ast_command_line_create(struct ast_pipeline *pipe);
+struct ast_command_line * ast_command_line_create(struct arena *arena,
+                                                  struct ast_pipeline *pipe);
+
+/**
+ * Copy a pipeline into a single malloc'ed block, so it can outlive
+ * its command line (e.g., as part of a job). The copy is released
+ * with ast_pipeline_free().
+ */
+struct ast_pipeline * ast_pipeline_compact(struct ast_pipeline *pipe);
+
+/**
+ * Copy a whole command line into a single malloc'ed block and store
+ * its size in *size. The copy is released with free().
+ */
+struct ast_command_line * ast_command_line_compact(
+                                struct ast_command_line *cmdline,
+                                size_t *size);
+
+/* Copy a compacted command line of the given size into an arena */
+struct ast_command_line * ast_command_line_copy(struct arena *arena,
+                                struct ast_command_line *compact,
+                                size_t size);
 
 /* Deallocation functions */
 void ast_command_line_free(struct ast_command_line *);
 void ast_pipeline_free(struct ast_pipeline *);
-void ast_command_free(struct ast_command *);
 
 /* Print functions */
 void ast_command_print(struct ast_command *cmd);
 void ast_pipeline_print(struct ast_pipeline *pipe);
 void ast_command_line_print(struct ast_command_line *line);
 
-/* Parse a command line.  Implemented in shell-grammar.y */
+/**
+ * A parser instance: a scanner, the arena its command lines live
+ * in and a cache of recently parsed lines. Instances share no
+ * state. Implemented in shell-grammar.y.
+ */
+struct ast_parser;
+
+struct ast_parser * ast_parser_create(void);
+void ast_parser_destroy(struct ast_parser *parser);
+
+/**
+ * Parse a command line, or return NULL on a syntax error. The
+ * result must be freed before the parser is used again.
+ */
+struct ast_command_line * ast_parser_parse(struct ast_parser *parser,
+                                           const char *line);
+
+/* Parse a command line with the shell's own parser instance */
 struct ast_command_line * ast_parse_command_line(char * line);
 
 /** ----------------------------------------------------------- */
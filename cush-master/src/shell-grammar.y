@@ -9,15 +9,16 @@
  * This is based on an assignment as an undergraduate in 1993 
  * as an undergraduate student at Technische Universitaet Berlin.
  *
- * Known bugs: leaks memory when parse errors occur.
+ * The parser is pure and the scanner reentrant: all their state
+ * lives in a struct ast_parser. All nodes, helpers and words are
+ * allocated from the parser's arena, so nothing is leaked when a
+ * parse error occurs.
  */
 %{
 #include <stdio.h>
 #include <stdlib.h>
 #define YYDEBUG	1
 int yydebug;
-void yyerror(const char *msg);
-int yylex(void);
 
 /*
  * Error messages, csh-style
@@ -28,11 +29,26 @@ int yylex(void);
 #define AMBOUT  "Ambiguous output redirect."
 
 #include "shell-ast.h"
+#include "arena.h"
+#include "parsecache.h"
 #include <obstack.h>
 #include <assert.h>
 
-#define obstack_chunk_alloc malloc
-#define obstack_chunk_free free
+#define CACHE_LINES 64          /* Recently parsed lines to remember */
+
+typedef void *yyscan_t;
+#define YY_TYPEDEF_YY_SCANNER_T
+
+struct ast_parser {
+    yyscan_t scanner;
+    struct arena arena;         /* Holds the command line being built */
+    struct ast_command_line *result;
+    struct parsecache *cache;
+};
+
+/* Obstack chunks come from the arena and die with the command line */
+static void no_free(void *arena, void *p) { }
+#define OBSTACK_CHUNK 256
 
 struct cmd_helper {
     struct obstack words;   /* an obstack of char * to collect argv */
@@ -48,21 +64,22 @@ struct pipe_helper {
 };
 
 static struct pipe_helper *
-init_pipe()
+init_pipe(struct arena *arena)
 {
-    struct pipe_helper * pipe = calloc(1, sizeof *pipe);
+    struct pipe_helper * pipe = arena_alloc(arena, sizeof *pipe);
     list_init(&pipe->commands);
     return pipe;
 }
 
 /* Initialize cmd_helper and, optionally, set first argv */
 static struct cmd_helper *
-init_cmd(char *firstcmd, 
+init_cmd(struct arena *arena, char *firstcmd, 
          char *iored_input, char *iored_output, 
          bool append_to_output, bool include_stderr)
 {
-    struct cmd_helper * cmd = malloc(sizeof *cmd);
-    obstack_init(&cmd->words);
+    struct cmd_helper * cmd = arena_alloc(arena, sizeof *cmd);
+    obstack_specify_allocation_with_arg(&cmd->words, OBSTACK_CHUNK, 0,
+                                        arena_alloc, no_free, arena);
     if (firstcmd)
         obstack_ptr_grow(&cmd->words, firstcmd);
 
@@ -77,24 +94,19 @@ init_cmd(char *firstcmd,
 static void p_error(char *msg);
 
 /* Convert cmd_helper to ast_command.
- * Ensures NULL-terminated argv[] array
+ * Ensures NULL-terminated argv[] array, which is used in place
+ * since the obstack already lives in the arena.
  */
 static struct ast_command * 
-make_ast_command(struct cmd_helper *cmd)
+make_ast_command(struct arena *arena, struct cmd_helper *cmd)
 {
     obstack_ptr_grow(&cmd->words, NULL);
 
-    int sz = obstack_object_size(&cmd->words);
-    char **argv = malloc(sz);
-    memcpy(argv, obstack_finish(&cmd->words), sz);
-    obstack_free(&cmd->words, NULL);
-
-    if (*argv == NULL) {
-        free(argv);
+    char **argv = obstack_finish(&cmd->words);
+    if (*argv == NULL)
         return NULL; 
-    }
 
-    return ast_command_create(argv, cmd->redirect_stderr);
+    return ast_command_create(arena, argv, cmd->redirect_stderr);
 }
 
 static bool
@@ -121,14 +133,12 @@ add_to_pipeline(struct pipe_helper *pipe,
     return true;
 }
 
-/* Called by parser when command line is complete */
-static void cmdline_complete(struct ast_command_line *);
-
-/* work-around for bug in flex 2.31 and later */
-static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
-
 %}
 
+%define api.pure full
+%param {yyscan_t scanner}
+%parse-param {struct ast_parser *parser}
+
 /* LALR stack types */
 %union {
   struct cmd_helper *command;
@@ -149,12 +159,19 @@ static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
 %token <word> WORD
 %token GREATER_GREATER GREATER_AMPERSAND PIPE_AMPERSAND
 
+%code {
+int yylex(YYSTYPE *yylval, yyscan_t scanner);
+static void yyerror(yyscan_t scanner, struct ast_parser *parser,
+                    const char *msg);
+#define ARENA (&parser->arena)
+}
+
 %%
-cmd_line: cmd_list { cmdline_complete($1); }
+cmd_line: cmd_list { parser->result = $1; }
 
-cmd_list:	/* Null Command */ { $$ = ast_command_line_create_empty(); }
+cmd_list:	/* Null Command */ { $$ = ast_command_line_create_empty(ARENA); }
 |		ast_pipeline { 
-            $$ = ast_command_line_create($1);
+            $$ = ast_command_line_create(ARENA, $1);
         } 
 |		cmd_list ';'
 |		cmd_list '&' {
@@ -186,7 +203,7 @@ ast_pipeline: pipeline {
             struct cmd_helper * last;
             last = list_entry(list_back(&pipe->commands), struct cmd_helper, elem);
 
-            $$ = ast_pipeline_create(
+            $$ = ast_pipeline_create(ARENA,
                 first->iored_input,
                 last->iored_output,
                 last->append_to_output
@@ -194,15 +211,13 @@ ast_pipeline: pipeline {
             for (struct list_elem * e = list_begin(&pipe->commands);
                                     e != list_end(&pipe->commands);) {
                 struct cmd_helper * cmd = list_entry(e, struct cmd_helper, elem);
-                ast_pipeline_add_command($$, make_ast_command(cmd));
-                e = list_remove(e);
-                free(cmd);
+                ast_pipeline_add_command($$, make_ast_command(ARENA, cmd));
+                e = list_next(e);
             }
-            free(pipe);
         }
 
 pipeline: command {
-            $$ = init_pipe();
+            $$ = init_pipe(ARENA);
             if (!add_to_pipeline($$, $1, false))
                 YYABORT;
 		}
@@ -220,7 +235,7 @@ pipeline: command {
 |		pipeline '|' error { p_error(INVNUL); YYABORT; }
 
 command:   WORD { 
-            $$ = init_cmd($1, NULL, NULL, false, false);
+            $$ = init_cmd(ARENA, $1, NULL, NULL, false, false);
         }
 |		input   
 |		output
@@ -229,14 +244,12 @@ command:   WORD {
             obstack_ptr_grow(&$$->words, $2);
 		}
 |		command input {
-            obstack_free(&$2->words, NULL);
             /* Error: ambiguous redirect 'a <b <c' */
             if ($1->iored_input)   { p_error(AMBINP); YYABORT; }
             $$ = $1; 
             $$->iored_input = $2->iored_input;
 		}
 |		command output {
-            obstack_free(&$2->words, NULL);
             /* Error: ambiguous redirect 'a >b >c' */
             if ($1->iored_output) { p_error(AMBOUT); YYABORT; }
             $$ = $1; 
@@ -246,31 +259,24 @@ command:   WORD {
 		}
 
 input:	'<' WORD { 
-            $$ = init_cmd(NULL, $2, NULL, false, false);
+            $$ = init_cmd(ARENA, NULL, $2, NULL, false, false);
         }
 |		'<' error	  { p_error(MISRED); YYABORT; }
 
 output:	'>' WORD { 
-            $$ = init_cmd(NULL, NULL, $2, false, false);
+            $$ = init_cmd(ARENA, NULL, NULL, $2, false, false);
         }
 |		GREATER_AMPERSAND WORD { 
-            $$ = init_cmd(NULL, NULL, $2, false, true);
+            $$ = init_cmd(ARENA, NULL, NULL, $2, false, true);
         }
 |		GREATER_GREATER WORD { 
-            $$ = init_cmd(NULL, NULL, $2, true, false);
+            $$ = init_cmd(ARENA, NULL, NULL, $2, true, false);
         }
 		/* Error: missing redirect */
 |		'>' error 	  { p_error(MISRED); YYABORT; }
 |		GREATER_GREATER error { p_error(MISRED); YYABORT; }
 
 %%
-static char * inputline;    /* currently processed input line */
-#define YY_INPUT(buf,result,max_size) \
-    { \
-        result = *inputline ? (buf[0] = *inputline++, 1) : YY_NULL; \
-    }
-
-#define YY_NO_INPUT
 #include "lex.yy.c"
 
 static void
@@ -280,28 +286,66 @@ p_error(char *msg)
     fprintf(stderr, "%s\n", msg); 
 }
 
-extern int yyparse (void);
-
 /* do not use default error handling since errors are handled above. */
-void 
-yyerror(const char *msg) { }
+static void 
+yyerror(yyscan_t scanner, struct ast_parser *parser, const char *msg) { }
 
-static struct ast_command_line * commandline;
-static void cmdline_complete(struct ast_command_line *cline)
+/* Create a parser instance */
+struct ast_parser *
+ast_parser_create(void)
 {
-    commandline = cline;
+    struct ast_parser *parser = malloc(sizeof *parser);
+    if (parser == NULL || yylex_init(&parser->scanner) != 0) {
+        perror("ast_parser_create");
+        exit(EXIT_FAILURE);
+    }
+    arena_init(&parser->arena);
+    yyset_extra(&parser->arena, parser->scanner);
+    parser->cache = parsecache_create(CACHE_LINES);
+    return parser;
+}
+
+void
+ast_parser_destroy(struct ast_parser *parser)
+{
+    yylex_destroy(parser->scanner);
+    arena_destroy(&parser->arena);
+    parsecache_destroy(parser->cache);
+    free(parser);
 }
 
 /* 
  * parse a commandline.
+ * Lines seen recently are copied from the cache instead.
  */
 struct ast_command_line *
-ast_parse_command_line(char * line)
+ast_parser_parse(struct ast_parser *parser, const char *line)
 {
-    inputline = line;
-    commandline = NULL;
-
-    int error = yyparse();
+    struct ast_command_line *cmdline;
+    cmdline = parsecache_lookup(parser->cache, line, &parser->arena);
+    if (cmdline)
+        return cmdline;
+
+    /* The scanner gets the whole line at once */
+    YY_BUFFER_STATE buffer = yy_scan_string(line, parser->scanner);
+    parser->result = NULL;
+    int error = yyparse(parser->scanner, parser);
+    yy_delete_buffer(buffer, parser->scanner);
+    if (error) {
+        /* Release whatever was built before the error */
+        arena_reset(&parser->arena);
+        return NULL;
+    }
+    parsecache_insert(parser->cache, line, parser->result);
+    return parser->result;
+}
 
-    return error ? NULL : commandline;
+/* Parse with the parser of the shell itself */
+struct ast_command_line *
+ast_parse_command_line(char * line)
+{
+    static struct ast_parser *parser;
+    if (parser == NULL)
+        parser = ast_parser_create();
+    return ast_parser_parse(parser, line);
 }
@@ -13,10 +13,16 @@
 #include "signal_support.h"
 #include "utils.h"
 
+/* Signals kept blocked for good, see signal_hold */
+static sigset_t held;
+
 /* Return true if this signal is blocked */
 bool 
 signal_is_blocked(int sig)
 {
+    if (sigismember(&held, sig))
+        return true;
+
     sigset_t mask;
     if (sigprocmask(0, NULL, &mask) == -1)
         utils_error("sigprocmask failed while retrieving current mask");
@@ -28,6 +34,9 @@ signal_is_blocked(int sig)
 static bool
 __mask_signal(int sig, int how)
 {
+    if (sigismember(&held, sig))
+        return true;
+
     sigset_t mask, omask;
     sigemptyset(&mask);
     sigaddset(&mask, sig);
@@ -50,6 +59,22 @@ signal_unblock(int sig)
     return __mask_signal(sig, SIG_UNBLOCK);
 }
 
+/* Block a signal for good, making signal_block and signal_unblock no-ops */
+void
+signal_hold(int sig)
+{
+    signal_block(sig);
+    sigaddset(&held, sig);
+}
+
+/* Undo signal_hold and unblock the signal */
+void
+signal_release(int sig)
+{
+    sigdelset(&held, sig);
+    signal_unblock(sig);
+}
+
 /* Install signal handler for signal 'sig' */
 void
 signal_set_handler(int sig, sa_sigaction_t handler)
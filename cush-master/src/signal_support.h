@@ -16,6 +16,16 @@ bool signal_block(int sig);
 /* Unblock a signal. Returns true it was blocked before */
 bool signal_unblock(int sig);
 
+/**
+ * Block a signal for good, e.g. because it is consumed through a
+ * signalfd. Later signal_block and signal_unblock calls for it
+ * return immediately without a system call.
+ */
+void signal_hold(int sig);
+
+/* Undo signal_hold and unblock the signal */
+void signal_release(int sig);
+
 /* Install signal handler for signal 'sig' */
 void signal_set_handler(int sig, sa_sigaction_t handler);
 
@@ -8,6 +8,7 @@
 #include <termios.h>
 #include <errno.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <assert.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -22,6 +23,17 @@ static struct termios saved_tty_state; /* The state of the terminal when shell
                                            was started. */
 static int shell_pgrp;          /* The pgrp of the shell when it started */
 
+/**
+ * What the shell last did to the terminal. While both still hold,
+ * handing the terminal back to the shell needs no system call:
+ * tcsetpgrp and, above all, tcsetattr(TCSADRAIN), which waits for
+ * pending output, are skipped. termstate_invalidate forgets both.
+ */
+static pid_t tty_owner;         /* Group last given the terminal, or 0 */
+static bool tty_attrs_current;  /* It still has the shell's attributes */
+
+static struct termstate_stats stats;
+
 /* Initialize tty support. */
 void
 termstate_init(void)
@@ -45,6 +57,9 @@ termstate_init(void)
 void 
 termstate_save(struct termios *saved_tty_state)
 {
+    if (terminal_fd == -1)
+        return;
+
     int rc = tcgetattr(terminal_fd, saved_tty_state);
     if (rc == -1)
         utils_fatal_error("tcgetattr failed: ");
@@ -70,10 +85,9 @@ retry:
 }
 
 /* Get a file descriptor that refers to controlling terminal */
-static int 
+int 
 termstate_get_tty_fd(void)
 {
-    assert(terminal_fd != -1 || !!!"termstate_init() must be called");
     return terminal_fd;
 }
 
@@ -90,19 +104,57 @@ termstate_get_tty_fd(void)
 void
 termstate_give_terminal_to(struct termios *pg_tty_state, pid_t pgrp)
 {
+    if (terminal_fd == -1)
+        return;
+
+    /* Only the shell's own state is known to be in place */
+    bool shell_state = pg_tty_state == &saved_tty_state;
+    bool set_owner = pgrp != tty_owner;
+    bool set_attrs = pg_tty_state && !(shell_state && tty_attrs_current);
+    if (!set_owner && !set_attrs) {
+        stats.avoided++;
+        return;
+    }
+
     signal_block(SIGTTOU);
-    int rc = tcsetpgrp(termstate_get_tty_fd(), pgrp);
-    if (rc == -1)
-        utils_fatal_error("tcsetpgrp: ");
+    if (set_owner) {
+        int rc = tcsetpgrp(termstate_get_tty_fd(), pgrp);
+        if (rc == -1)
+            utils_fatal_error("tcsetpgrp: ");
+        stats.tcsetpgrp++;
+    }
 
-    if (pg_tty_state)
+    if (set_attrs) {
         termstate_restore(pg_tty_state);
+        stats.tcsetattr++;
+    }
     signal_unblock(SIGTTOU);
+
+    tty_owner = pgrp;
+    tty_attrs_current = shell_state;
+}
+
+/* Forget what was last done to the terminal */
+void
+termstate_invalidate(void)
+{
+    tty_owner = 0;
+    tty_attrs_current = false;
+}
+
+/* Counts of terminal transitions made and avoided */
+const struct termstate_stats *
+termstate_get_stats(void)
+{
+    return &stats;
 }
 
 void 
 termstate_give_terminal_back_to_shell(void)
 {
+    if (terminal_fd == -1)
+        return;
+
     assert (shell_pgrp > 0 || !!!"termstate_init was not called");
     termstate_give_terminal_to(&saved_tty_state, shell_pgrp);
 }
@@ -111,4 +163,5 @@ void
 termstate_sample(void)
 {
     termstate_save(&saved_tty_state);
+    tty_attrs_current = false;      /* Sampled while a job owns it */
 }
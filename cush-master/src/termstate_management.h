@@ -4,9 +4,16 @@
 #include <sys/types.h>
 #include <termios.h>
 
-/* Initialize tty support. */
+/**
+ * Initialize tty support.
+ * When this is never called (batch mode), there is no terminal
+ * to manage and all functions below do nothing.
+ */
 void termstate_init(void);
 
+/* Get a file descriptor that refers to controlling terminal, or -1 */
+int termstate_get_tty_fd(void);
+
 /**
  * Save current terminal settings.
  * This function should be called when a job is suspended and the
@@ -19,9 +26,30 @@ void termstate_save(struct termios *saved_tty_state);
 /**
  * Assign ownership of the terminal to process group
  * pgrp, restoring its terminal state if provided.
+ * Does nothing if the terminal is known to be in that state
+ * already, see termstate_invalidate.
  */
 void termstate_give_terminal_to(struct termios *pg_tty_state, pid_t pgrp);
 
+/**
+ * Forget which process group owns the terminal and what state it
+ * is in. Must be called whenever something other than the
+ * functions above may have changed either: when a foreground
+ * child takes the terminal by itself, or when readline was left
+ * without restoring the terminal. Until the next hand-off, none
+ * is skipped.
+ */
+void termstate_invalidate(void);
+
+/* Terminal transitions since the shell started */
+struct termstate_stats {
+    unsigned long tcsetpgrp;    /* Ownership changes made */
+    unsigned long tcsetattr;    /* Attribute restores made */
+    unsigned long avoided;      /* Hand-offs that changed nothing */
+};
+
+const struct termstate_stats * termstate_get_stats(void);
+
 /**
  * Sample the current terminal state as the "last known good
  * state" (that is, the state that is restored when
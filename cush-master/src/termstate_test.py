@@ -0,0 +1,45 @@
+#!/usr/bin/python
+#
+# Tests that the terminal is only handed back when it changed hands
+#
+import atexit, proc_check, time, os
+from testutils import *
+
+console = setup_tests()
+
+# Ensure that shell prints expected prompt
+no_prompt = "Shell did not print expected prompt (%d)"
+expect_prompt(no_prompt % 0)
+
+stats = "termstate: (\d+) tcsetpgrp, (\d+) tcsetattr, (\d+) avoided\r\n"
+
+def counters(n):
+    sendline("termstate")
+    expect(stats, "termstate does not print its counters")
+    counts = [int(c) for c in console.match.groups()]
+    expect_prompt(no_prompt % n)
+    return counts
+
+#################################################################
+# Test #1:  Built-ins and background jobs leave the terminal alone
+
+before = counters(1)
+sendline("sleep 0.1 &")
+expect("\[\d+\] \d+", "background job was not started")
+expect_prompt(no_prompt % 2)
+after = counters(3)
+assert after[0] == before[0], "terminal was handed over for a background job"
+assert after[1] == before[1], "attributes were restored needlessly"
+assert after[2] >= before[2] + 2, "hand-offs were not avoided"
+
+#################################################################
+# Test #2:  A foreground job gets the terminal and gives it back
+
+sendline("echo owned")
+expect_exact("owned\r\n", "foreground job does not run")
+expect_prompt(no_prompt % 4)
+later = counters(5)
+assert later[0] > after[0], "terminal was not taken back from the job"
+assert later[1] > after[1], "shell state was not restored after the job"
+
+test_success()
@@ -0,0 +1,46 @@
+#!/usr/bin/python
+#
+# Tests the `time` prefix and `jobs -v`
+#
+import atexit, proc_check, time, os
+from testutils import *
+
+console = setup_tests()
+
+# Ensure that shell prints expected prompt
+no_prompt = "Shell did not print expected prompt (%d)"
+expect_prompt(no_prompt % 0)
+
+usage = "\treal (\d+\.\d+)s\tuser \d+\.\d+s\tsys \d+\.\d+s\tmaxrss (\d+)k\tcsw \d+/\d+"
+
+#################################################################
+# Test #1:  `time` reports the usage of the whole pipeline
+
+sendline("time sleep 0.5 | echo timed")
+expect_exact("timed\r\n", "timed pipeline does not run")
+expect(usage, "time did not report usage")
+real, maxrss = console.match.groups()
+assert float(real) >= 0.5, "wall time shorter than the job"
+assert int(maxrss) > 0, "max RSS was not recorded"
+expect_prompt(no_prompt % 1)
+
+#################################################################
+# Test #2:  Without `time`, nothing is reported
+
+sendline("echo untimed")
+expect_exact("untimed\r\n", "pipeline does not run")
+expect_prompt(no_prompt % 2)
+assert "real" not in console.before, "usage reported without time"
+
+#################################################################
+# Test #3:  `jobs -v` shows the usage of running jobs
+
+sendline("sleep 1 &")
+expect("\[\d+\] \d+", "background job was not started")
+expect_prompt(no_prompt % 3)
+sendline("jobs -v")
+expect("Running\s+\(sleep 1\)\r\n", "job is not listed")
+expect(usage, "jobs -v does not show usage")
+expect_prompt(no_prompt % 4)
+
+test_success()
@@ -47,11 +47,26 @@ sys.excepthook = handle_exception
 
 console = None
 settings_module = None
+histfile = None
+
+def history_file():
+    """Path of $HISTFILE for the shells under test, in a temporary
+    directory removed at exit, so that no test writes the history
+    of the user running it. The same file is used throughout a test.
+    """
+    global histfile
+    if histfile is None:
+        histdir = tempfile.mkdtemp("-cush-tests")
+        atexit.register(shutil.rmtree, histdir, True)
+        histfile = histdir + "/history"
+        os.environ["HISTFILE"] = histfile
+    return histfile
 
 def setup_tests(additional_cmdline_arguments = []):
     global console
     global settings_module
     
+    history_file()
     definitions_scriptname = sys.argv[1]
     settings_module = imp.load_source('', definitions_scriptname)
     logfile = None